@@ -0,0 +1,162 @@
+// ----------------------------------------------------------------------------
+// School: University of Victoria, Canada.
+// Course: ECE 355 "Microprocessor-Based Systems".
+// Edge-timing measurement core shared by Part 2 and the Main Project.
+//
+// See "system/include/cmsis/stm32f051x8.h" for register/bit definitions.
+// See "system/src/cmsis/vectors_stm32f051x8.c" for handler declarations.
+// ----------------------------------------------------------------------------
+//
+// The including file fixes everything at compile time by defining, before the #include:
+//
+//   MEAS_CHANNELS(X)          X(n) once per input channel, n = 1, 2, ...
+//   MEAS_CHn_PIN              GPIOA pin, and so EXTI line, of channel n
+//   MEAS_TIM                  timer that counts the period (started/stopped by the edges)
+//   MEAS_TIM_CLKEN            its enable bit in RCC->APB1ENR
+//   MEAS_TIM_IRQn             its interrupt (overflow), handled by the including file
+//   MEAS_TIM_PRIO             NVIC priority of that interrupt
+//   MEAS_EDGE_PRIO            NVIC priority of the EXTI lines of all channels
+//   MEAS_PRESCALER            timer clock prescaler
+//   MEAS_PERIOD               timer auto-reload (overflow) value
+//   MEAS_SINK(count, n)       where a finished period goes: trace ring, edge queue, ...
+//
+// and optionally:
+//
+//   MEAS_ACCEPT(n)            nonzero if an edge on channel n is to be timed (default: always)
+//   MEAS_LATENCY(ticks)       given the delay between the hardware latch and the software read,
+//                             needs MEAS_CHn_LATCH (capture register latching channel n's edges)
+//   MEAS_HOT                  placement attribute for the edge state (default: none)
+//
+// Each EXTI handler expands MEAS_EDGE(n) for its own channel(s). The channel number, pin and
+// latch register are constants there, so the body compiles to the same straight-line code as a
+// hand-written handler: no table is read and nothing is dispatched at run time, and adding a
+// channel adds no cycles to the others.
+//
+// Include once per project, after the sink and accept functions are declared. The edge state
+// and the init functions are static, so each application (or host test) that includes this
+// header gets its own copy and nothing here clashes at link time.
+//
+
+#ifndef MEAS_CORE_H_
+#define MEAS_CORE_H_
+
+#ifndef MEAS_ACCEPT
+#define MEAS_ACCEPT(n) (1)
+#endif
+
+#ifndef MEAS_HOT
+#define MEAS_HOT
+#endif
+
+/* EXTI interrupt serving a given pin: lines 0-1, 2-3 and 4-15 share one vector each */
+#define MEAS_EXTI_IRQn(pin) ((pin) < 2 ? EXTI0_1_IRQn : (pin) < 4 ? EXTI2_3_IRQn : EXTI4_15_IRQn)
+
+
+static MEAS_HOT uint16_t edge_count = 0; //0 = waiting for the first edge of a period, 1 = timer running
+
+
+/*** Call this function to boost the STM32F0xx clock to 48 MHz ***/
+
+static void SystemClock48MHz( void )
+{
+    RCC->CR &= ~(RCC_CR_PLLON); // Disable the PLL
+
+    while (( RCC->CR & RCC_CR_PLLRDY ) != 0 ); // Wait for the PLL to unlock
+
+    RCC->CFGR = 0x00280000; // Configure the PLL for a 48MHz system clock
+
+    RCC->CR |= RCC_CR_PLLON; // Enable the PLL
+
+    while (( RCC->CR & RCC_CR_PLLRDY ) != RCC_CR_PLLRDY ); // Wait for the PLL to lock
+
+    RCC->CFGR = ( RCC->CFGR & (~RCC_CFGR_SW_Msk)) | RCC_CFGR_SW_PLL; // Switch the processor to the PLL clock source
+
+    SystemCoreClockUpdate(); // Update the system with the new clock frequency
+}
+
+
+/* Initialization for the period timer */
+static void meas_timer_init(void)
+{
+	/* Enable clock for the timer peripheral */
+	RCC->APB1ENR |= MEAS_TIM_CLKEN;
+
+	/* Configure the timer: buffer auto-reload, count up, stop on overflow,
+	 * enable update events, interrupt on overflow only */
+	MEAS_TIM->CR1 = 0x008C;
+
+	/* Set clock prescaler value */
+	MEAS_TIM->PSC = MEAS_PRESCALER;
+	/* Set auto-reloaded delay */
+	MEAS_TIM->ARR = MEAS_PERIOD;
+
+	/* Update timer registers */
+	MEAS_TIM->EGR = 0x0001;
+
+	NVIC_SetPriority(MEAS_TIM_IRQn, MEAS_TIM_PRIO);
+	NVIC_EnableIRQ(MEAS_TIM_IRQn);
+
+	/* Enable update interrupt generation */
+	MEAS_TIM->DIER |= TIM_DIER_UIE;
+}
+
+
+/* Map, arm and unmask the EXTI line of one channel (PA<pin>, rising edges) */
+#define MEAS_EXTI_LINE(n) \
+	SYSCFG->EXTICR[MEAS_CH##n##_PIN >> 2] &= ~(0xFUL << ((MEAS_CH##n##_PIN & 3) * 4)); \
+	EXTI->RTSR |= (1UL << MEAS_CH##n##_PIN); \
+	EXTI->IMR |= (1UL << MEAS_CH##n##_PIN); \
+	NVIC_SetPriority(MEAS_EXTI_IRQn(MEAS_CH##n##_PIN), MEAS_EDGE_PRIO); \
+	NVIC_EnableIRQ(MEAS_EXTI_IRQn(MEAS_CH##n##_PIN));
+
+/* Initialization for the edge interrupts of every channel */
+static void meas_exti_init(void)
+{
+	MEAS_CHANNELS(MEAS_EXTI_LINE)
+}
+
+
+/* Edge body for one channel: time one period between two rising edges */
+static inline __attribute__((always_inline)) void meas_edge(const uint16_t channel, const uint16_t pin,
+		volatile uint32_t *latch)
+{
+	/* Check if the channel's EXTI pending flag is indeed set */
+	if ((EXTI->PR & (1UL << pin)) == 0) {
+		return;
+	}
+
+	if (MEAS_ACCEPT(channel)) {
+		// 1. If this is the first edge:
+		if (edge_count == 0) {
+			//	- Clear count register and start the timer.
+			MEAS_TIM->CNT = 0;
+			MEAS_TIM->CR1 |= TIM_CR1_CEN;
+			edge_count = 1;
+
+		} else {
+			//	- Stop the timer and read out the count register.
+			MEAS_TIM->CR1 &= ~TIM_CR1_CEN;
+			uint32_t count = MEAS_TIM->CNT;
+#ifdef MEAS_LATENCY
+			//the same edge was latched in hardware: the difference is the software delay
+			MEAS_LATENCY(count - *latch);
+#else
+			(void)latch;
+#endif
+			//	- Hand the raw count on: the sink does the (slow) frequency math elsewhere.
+			MEAS_SINK(count, channel);
+			edge_count = 0;
+		}
+	}
+
+	// 2. Clear the pending flag (write 1 to it), whether or not the edge was timed.
+	EXTI->PR = (1UL << pin);
+}
+
+#ifdef MEAS_LATENCY
+#define MEAS_EDGE(n) meas_edge((n), MEAS_CH##n##_PIN, &MEAS_TIM->MEAS_CH##n##_LATCH)
+#else
+#define MEAS_EDGE(n) meas_edge((n), MEAS_CH##n##_PIN, 0)
+#endif
+
+#endif // MEAS_CORE_H_
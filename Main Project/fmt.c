@@ -0,0 +1,123 @@
+// ----------------------------------------------------------------------------
+// School: University of Victoria, Canada.
+// Course: ECE 355 "Microprocessor-Based Systems".
+// Decimal formatting for the OLED and the command replies (see fmt.h).
+// ----------------------------------------------------------------------------
+
+#include "fmt.h"
+
+static const uint32_t fmt_pow10[10] =
+{
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+//the same for 64-bit counts, up to the 20 digits of UINT64_MAX
+static const uint64_t fmt_pow10_64[20] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+};
+
+//Function to send a zero-terminated string
+void fmt_string( fmt_sink_t sink, const char *s )
+{
+    while (*s != '\0') {
+        sink((unsigned char)*s++);
+    }
+}
+
+//Function to print value / 10^decimals right-aligned in width characters (e.g. 1234, 2 -> "12.34")
+void fmt_digits( fmt_sink_t sink, uint32_t value, uint16_t width, uint16_t decimals )
+{
+    uint16_t digits = 1;
+    while (digits < 10 && value >= fmt_pow10[digits]) {
+        digits++;
+    }
+    if (digits <= decimals) {
+        digits = decimals + 1; //always print the leading "0." of a pure fraction
+    }
+
+    uint16_t length = digits + (decimals != 0 ? 1 : 0);
+    while (length < width) {
+        sink(' ');
+        length++;
+    }
+
+    while (digits-- > 0) {
+        uint32_t step = fmt_pow10[digits];
+        unsigned char d = '0';
+        while (value >= step) {
+            value -= step;
+            d++;
+        }
+        sink(d);
+        if (digits == decimals && decimals != 0) {
+            sink('.');
+        }
+    }
+}
+
+//Function to print an unsigned integer right-aligned in width characters
+void fmt_uint( fmt_sink_t sink, uint32_t value, uint16_t width )
+{
+    fmt_digits(sink, value, width, 0);
+}
+
+//Function to print a 64-bit count without leading blanks (13 characters cover 31 years at 10 kHz)
+void fmt_uint64( fmt_sink_t sink, uint64_t value )
+{
+    uint16_t digits = 1;
+    while (digits < 20 && value >= fmt_pow10_64[digits]) {
+        digits++;
+    }
+
+    while (digits-- > 0) {
+        uint64_t step = fmt_pow10_64[digits];
+        unsigned char d = '0';
+        while (value >= step) {
+            value -= step;
+            d++;
+        }
+        sink(d);
+    }
+}
+
+//Function to print a value in base units as 5 characters plus an SI prefix (" 999 Hz", "1.234 kHz", "12.34 MOhm").
+//The leading 4 significant digits are produced directly, the digits below them are dropped.
+void fmt_si( fmt_sink_t sink, uint32_t value, const char *unit )
+{
+    if (value < 1000) {
+        fmt_uint(sink, value, 5);
+        sink(' ');
+        fmt_string(sink, unit);
+        return;
+    }
+
+    uint16_t digits = 4;
+    while (digits < 10 && value >= fmt_pow10[digits]) {
+        digits++;
+    }
+
+    char prefix = (digits > 6) ? 'M' : 'k';
+    uint16_t point = digits - ((digits > 6) ? 6 : 3); //digits ahead of the decimal point, 1-3 (4 above 1 GOhm)
+    uint16_t shown = (point < 4) ? 4 : 5;
+
+    for (uint16_t n = 1; n <= shown; n++) {
+        uint32_t step = fmt_pow10[--digits];
+        unsigned char d = '0';
+        while (value >= step) {
+            value -= step;
+            d++;
+        }
+        sink(d);
+        if (n == point) {
+            sink('.');
+        }
+    }
+
+    sink(' ');
+    sink(prefix);
+    fmt_string(sink, unit);
+}
@@ -0,0 +1,26 @@
+// ----------------------------------------------------------------------------
+// School: University of Victoria, Canada.
+// Course: ECE 355 "Microprocessor-Based Systems".
+// Decimal formatting for the OLED and the command replies.
+// ----------------------------------------------------------------------------
+//
+// Every function hands its characters one at a time to a sink (oled_Write_Char, or the
+// reply buffer), so nothing is assembled in a temporary string. The Cortex-M0 has no
+// divide instruction: digits are produced by repeated subtraction of powers of ten (at
+// most 9 per digit) instead of snprintf's library division.
+//
+
+#ifndef FMT_H_
+#define FMT_H_
+
+#include <stdint.h>
+
+typedef void (*fmt_sink_t)(unsigned char c); //receives each character in order
+
+void fmt_digits(fmt_sink_t sink, uint32_t value, uint16_t width, uint16_t decimals); //right-aligned fixed-point decimal
+void fmt_uint(fmt_sink_t sink, uint32_t value, uint16_t width); //right-aligned unsigned integer (width 0: no padding)
+void fmt_uint64(fmt_sink_t sink, uint64_t value); //64-bit count without padding
+void fmt_si(fmt_sink_t sink, uint32_t value, const char *unit); //5-character value with k/M prefix and unit
+void fmt_string(fmt_sink_t sink, const char *s);
+
+#endif // FMT_H_
@@ -6,13 +6,13 @@
 
 // ----------------------------------------------------------------------------
 
-#include <stdio.h>
 #include "diag/Trace.h"
 #include <string.h>
 #include "stm32f0xx.h"
 #include "cmsis/cmsis_device.h"
 #include "cmsis/stm32f0xx.h"
 #include "stm32f0xx_hal.h"
+#include "fmt.h"
 
 // ----------------------------------------------------------------------------
 //
@@ -62,19 +62,235 @@
 #define myTIM2_PRESCALER ((uint16_t)0x0000) //no prescaling
 #define myTIM2_PERIOD ((uint32_t)0xFFFFFFFF) //max setting for overflow
 
-#define myTIM3_PRESCALER (0xBB74) //47999 for 1ms prescaler
+#define myTIM3_PRESCALER (SystemCoreClock / 1000 - 1) //1ms prescaler (47999 at 48 MHz)
 #define myTIM3_PERIOD (100) //10ms base value
 
+#define myTIM14_PRESCALER (SystemCoreClock / 1000 - 1) //1ms ticks for the free-running boot/uptime clock
+
+/*Clock scaling presets*/
+
+#define CLK_SCALING (1) //1: clk_policy picks the system clock, 0: stay at 48 MHz
+#define CLK_LEVEL_8MHZ (0) //HSI directly, PLL off
+#define CLK_LEVEL_24MHZ (1) //PLL x6 from HSI/2
+#define CLK_LEVEL_48MHZ (2) //PLL x12 from HSI/2, as set up by SystemClock48MHz
+#define CLK_IDLE_MS (5000) //stable reading and no commands for this long before slowing down
+#define CLK_STABLE_DIV (100) //the reading counts as stable while it stays within 1/100 of itself
+#define CLK_LOW_EDGE_RATE (1000) //capture interrupts per second that need at least 24 MHz
+#define CLK_HIGH_EDGE_RATE (10000) //capture interrupts per second that need 48 MHz
+#define CLK_INPUT_DIV (3) //a timer input must stay under half the clock that samples it, with a margin
+#define CLK_PWM_MIN_TICKS (1000) //ticks per PA1 PWM period that still resolve the 0.1% duty steps
+
+/*Boot presets*/
+
+#define FAST_BOOT (1) //1: measure while the splash is up, 0: hold the splash before measuring
+#define SPLASH_MS (2000) //time the welcome message stays on screen
+#define MAIN_LOOP_MS (100) //main loop period: ADC reading, display refresh
+
+/*Interrupt priority scheme (Cortex-M0 NVIC: 4 levels, 0 preempts everything else)
+ *  0 - edge timestamping: EXTI0_1 (PA1, shares its vector with the PA0 button),
+ *      EXTI2_3 (PA2) and TIM2 while it does the input capture
+ *  1 - TIM2 overflow housekeeping in edge-timing mode, must never delay an edge
+ *  2 - deferred work that post-processes edges
+ *  3 - TIM3 delay timer and anything else that can wait
+ */
+
+#define IRQ_PRIO_EDGE (0)
+#define IRQ_PRIO_HOUSEKEEPING (1)
+#define IRQ_PRIO_DEFERRED (2)
+#define IRQ_PRIO_BACKGROUND (3)
+
+#define EDGE_QUEUE_LEN (16) //raw edge slots between the ISRs and the bottom half (power of two)
+#define MEAS_AVG_SHIFT_MAX (8) //strongest edge-mode filter: 1/256 weight per new period
+
+#define LAT_BUDGET_NS (2000) //worst allowed delay from an input edge to its software timestamp
+
+/*Calibration store presets*/
+
+#define CAL_FLASH_ADDR ((uint32_t)0x0800FC00) //last 1KB page of the 64KB flash, the CALIB region in ldscripts/mem.ld
+#define CAL_MAGIC ((uint16_t)0xCA1B) //marks a programmed calibration record
+#define CAL_VERSION ((uint16_t)0x0001) //bump whenever cal_record_t changes layout
+#define CAL_GAIN_ONE ((uint32_t)0x10000) //unity gain in Q16
+#define CAL_PPM_LIMIT (20000) //reject clock corrections beyond +-2%
+#define CAL_REF_FREQ (1000) //frequency of the reference signal fed to PA2 during calibration (Hz)
+#define CAL_REF_PERIODS (64) //number of reference periods averaged during calibration
+#define CAL_REF_TIMEOUT (100) //ms to wait for each reference period before giving up
+
+#define POT_FULL_SCALE (5000) //potentiometer full scale resistance in ohms
+#define ADC_FULL_SCALE (0xFFF) //12-bit ADC full scale
+
+/*Measurement mode presets*/
+
+#define MEAS_MODE_EDGE (0) //EXTI edge timing, one period per pair of edges
+#define MEAS_MODE_AUTORANGE (1) //TIM2 input capture over an auto-ranged number of periods
+#define MEAS_MODE_PWM (2) //paired-channel PWM input: period, high time and low time in hardware
+#define MEAS_MODE_RPM (3) //hardware pulse counting, shown as revolutions per minute
+#define MEAS_MODE_TOTAL (4) //hardware pulse counting, shown as a 64-bit running total
+#define MEAS_MODE_RATE (5) //hardware pulse counting, shown as events per minute
+#define MEAS_MODE_COMP (6) //PA1 through COMP1 (threshold + hysteresis) into TIM2 IC4, auto-ranged
+#define MEAS_MODE_COUNTING(m) ((m) >= MEAS_MODE_RPM && (m) <= MEAS_MODE_RATE) //modes where the input clocks a timer directly
+#define MEAS_MODE_CAPTURE(m) ((m) == MEAS_MODE_AUTORANGE || (m) == MEAS_MODE_COMP) //auto-ranged TIM2 capture
+#define MEAS_MODE_DEFAULT MEAS_MODE_AUTORANGE //mode entered once boot-time calibration is done
+
+#define AR_TARGET_PPM (10) //quantisation error (+-1 count) the gate is sized for
+#define AR_TARGET_COUNTS (1000000 / AR_TARGET_PPM) //timer ticks a gate must span to reach AR_TARGET_PPM
+#define AR_MAX_CAPTURE_RATE (100000) //capture interrupts per second before the input prescaler steps up
+#define AR_MAX_INTERVALS (4096) //longest gate, in captures
+#define AR_PSC_MAX (3) //largest input capture prescaler code (8 edges per capture)
+#define AR_HW_ENTER_RATE (AR_MAX_CAPTURE_RATE << AR_PSC_MAX) //input rate (Hz) above which the edges are counted in hardware
+#define AR_HW_EXIT_RATE (AR_HW_ENTER_RATE / 4 * 3) //back to captures below this, the gap is hysteresis
+#define AR_HW_MAX_EDGES (65536) //longest hardware gate, in edges (TIM15 is 16 bits)
+
+#define PWM_TIM15_PRESCALER (SystemCoreClock / 1000000 - 1) //1us ticks on the 16-bit TIM15 used for PA2 (periods up to 65ms)
+
+#define COUNT_READ_MS (10) //counter readout period: PA2 counts on the 16-bit TIM15, so 6.5 MHz at most
+#define COUNT_GATE_MS (1000) //default rate gate
+#define COUNT_PPR_DEFAULT (1) //pulses per revolution
+
+/*Measurement logger presets*/
+
+#define LOG_WORDS (1024) //16-bit records in the RAM arena (power of two)
+#define LOG_KEY_INTERVAL (64) //deltas between absolute period records, bounds the resync loss
+#define LOG_DELTA_MAX (8191) //largest period change a 14-bit delta record can hold
+#define LOG_ABS_MAX ((uint32_t)0x0FFFFFFF) //largest period an absolute record can hold (28 bits)
+
+#define LOG_TAG_MASK ((uint16_t)0xC000)
+#define LOG_TAG_DELTA ((uint16_t)0x0000) //signed 14-bit change from the previous period
+#define LOG_TAG_ADC ((uint16_t)0x8000) //12-bit PA5 sample
+#define LOG_TAG_ABS_HI ((uint16_t)0x4000) //period bits 27..14, always followed by LOG_TAG_ABS_LO
+#define LOG_TAG_ABS_LO ((uint16_t)0xC000) //period bits 13..0, then two more words with the time stamp
+#define LOG_TIME_MASK ((uint32_t)0x0FFFFFFF) //absolute records carry 28 bits of common time since arming (us)
+#define LOG_DUMP_RECORDS (4) //records log_dump_step prints per main loop pass (one semihosting call each)
+
+#define LOG_IDLE (0) //not recording
+#define LOG_ARMED (1) //recording into the ring, waiting for the trigger
+#define LOG_TRIGGERED (2) //recording the post-trigger window
+#define LOG_DONE (3) //capture complete, arena frozen for replay/dump
+
+#define LOG_TRIG_NONE (0) //trigger as soon as the pre-trigger window is full
+#define LOG_TRIG_FREQ_ABOVE (1) //a single period shorter than the threshold frequency
+#define LOG_TRIG_FREQ_BELOW (2) //a single period longer than the threshold frequency
+#define LOG_TRIG_RES_STEP (3) //Res changes by at least the threshold (ohms) between readings
+
+/*ADC scan sequence presets*/
+
+#define ADC_SEQ_LEN (3) //channels per scan, in CHSEL order: PA5, temperature sensor, VREFINT
+#define ADC_SEQ_POT (0) //index of PA5 within a scan
+#define ADC_SEQ_TEMP (1) //index of the temperature sensor (channel 16) within a scan
+#define ADC_SEQ_VREF (2) //index of VREFINT (channel 17) within a scan
+#define ADC_OVERSAMPLE (8) //scans kept in the DMA ring and averaged per reading
+#define ADC_RECAL_INTERVAL (1000) //ADC_reader passes between background recalibrations
+#define ADC_EVENT_DEFAULT (1) //1: recompute only when the analog watchdog sees PA5 move, 0: every pass
+#define ADC_AWD_WINDOW (24) //raw counts either side of the last accepted PA5 reading (above sample noise)
+#define ADC_AWD_REFRESH (50) //passes without an event before VDDA/temperature are refreshed anyway
+
+#define VDDA_NOMINAL (3300) //supply (mV) the factory calibration values were taken at
+#define FACTORY_VREFINT_CAL (*(const uint16_t *)0x1FFFF7BA) //VREFINT reading at 3.3V, 30C
+#define FACTORY_TS_CAL1 (*(const uint16_t *)0x1FFFF7B8) //temperature sensor reading at 3.3V, 30C
+#define FACTORY_TS_CAL2 (*(const uint16_t *)0x1FFFF7C2) //temperature sensor reading at 3.3V, 110C
+
+/*Frequency-to-voltage output presets*/
+
+#define DAC_OUT_POT (0) //DAC mirrors the potentiometer on PA5
+#define DAC_OUT_FREQ_LIN (1) //DAC proportional to the measured frequency across the span
+#define DAC_OUT_FREQ_LOG (2) //DAC proportional to log(frequency) across the span
+#define DAC_OUT_SERVO (3) //DAC driven by the PI controller, setpoint from the potentiometer across the span
+#define DAC_FULL_SCALE (0xFFF) //12-bit DAC full scale
+#define FV_SPAN_LO (10) //default frequency (Hz) for 0V
+#define FV_SPAN_HI (100000) //default frequency (Hz) for full scale
+
+/*Closed-loop control presets*/
+
+#define PI_TIM16_PRESCALER (SystemCoreClock / 1000000 - 1) //1us ticks on TIM16, the control-rate timer
+#define PI_RATE_HZ (100) //controller updates per second
+#define PI_KP_DEFAULT (0x0800) //Q16 DAC codes per Hz of error (1/32)
+#define PI_KI_DEFAULT (0x0100) //Q16 DAC codes per Hz of error, added every update (1/256)
+#define PI_STALE_UPDATES (10) //updates without a new period before the input counts as stopped
+#define PI_IN_TICKS (1) //pi_fresh: pi_ticks holds a period from the bottom half
+#define PI_IN_HZ (2) //pi_fresh: pi_freq holds a frequency from meas_update (PWM, counting, hardware gates)
+
+/*Spectrum analyser presets*/
+
+#define FFT_LEN (256) //PA5 samples per spectrum (power of two)
+#define FFT_LOG2_LEN (8)
+#define FFT_RATE_DEFAULT (10000) //sample rate (Hz), the spectrum spans half of it
+#define FFT_RATE_MAX (40000) //the 239.5-cycle sampling time allows about 50k conversions per second
+#define FFT_TIM1_PRESCALER (SystemCoreClock / 1000000 - 1) //1us ticks on TIM1, whose update triggers each conversion
+#define FFT_PX_PER_OCTAVE (5) //bar height per doubling of the bin magnitude
+
+#define VIEW_MAIN (0) //Res/Freq readout
+#define VIEW_SPECTRUM (1) //PA5 spectrum bar graph
+#define VIEW_REPLAY (2) //finished capture, one decoded record per main loop pass
+
+/*Comparator front-end presets*/
+
+#define COMP_THR_VREF_1_4 (0) //COMP1 inverting input: 1/4 VREFINT (COMP1INSEL encoding)
+#define COMP_THR_VREF_1_2 (1) //1/2 VREFINT
+#define COMP_THR_VREF_3_4 (2) //3/4 VREFINT
+#define COMP_THR_VREF (3) //VREFINT (about 1.23 V)
+#define COMP_THR_DAC (4) //DAC channel 1, so DAC POT puts the threshold on the potentiometer
+#define COMP_THR_DEFAULT COMP_THR_VREF_1_2
+#define COMP_HYST_DEFAULT (2) //0 none, 1 low, 2 medium, 3 high (COMP1HYST encoding)
+
+/*Multi-board sync presets*/
+
+#define SYNC_OFF (0) //local timebase only
+#define SYNC_MASTER (1) //drive the sync pulse train on PA7, the local timebase is the common one
+#define SYNC_SLAVE (2) //capture the sync pulse train on PA7 and follow the master's timebase
+#define SYNC_TIM17_PRESCALER (SystemCoreClock / 1000000 - 1) //1us ticks on TIM17, the timebase
+#define SYNC_PERIOD_US (65536) //one pulse per TIM17 wrap
+#define SYNC_FRAME_BITS (32) //bits after each mark: the mark's pulse index, MSB first
+#define SYNC_WIDTH_0 (20) //pulse width (us) of a 0 bit
+#define SYNC_WIDTH_1 (40) //pulse width (us) of a 1 bit
+#define SYNC_WIDTH_MARK (80) //pulse width (us) of a frame mark
+#define SYNC_WIDTH_MIN (10) //narrower pulses are glitches
+#define SYNC_WIDTH_MAX (160) //wider means an edge was missed
+#define SYNC_RATE_ONE ((uint32_t)1 << 24) //Q24 unity rate (master us per local us)
+#define SYNC_RATE_SHIFT (4) //drift filter, 1/16 weight per new pulse interval
+
+/*Remote command interface presets*/
+
+#define CMD_BAUD (115200) //USART1, PA9 = TX, PA10 = RX
+#define CMD_RX_LEN (256) //DMA receive ring (power of two), holds 22ms of back-to-back input
+#define CMD_LINE_LEN (48) //longest command line including the terminator
+#define CMD_TX_LEN (128) //longest reply line (a full READ)
+
+/*Trace recorder presets*/
+
+#define REC_LEN (252) //bytes of records waiting for USART1 (a multiple of REC_SIZE)
+#define REC_SIZE (12) //bytes per record: sync, type, aux (16-bit), value (32-bit), time (32-bit), little-endian
+#define REC_SYNC (0xA5) //first byte of every record, never part of a text reply
+#define REC_HEADER (0) //aux = meas_mode, value = timer_clock (Hz): on start, mode and clock changes
+#define REC_CAPTURE (1) //aux = input_line, value = raw TIM2 capture timestamp (AUTO and COMP modes)
+#define REC_PERIOD (2) //aux = input_line, value = raw TIM2 count between two edges (EDGE mode)
+#define REC_ADC (3) //aux = VREFINT sum, value = temperature sum << 16 | PA5 sum (one ADC_reader pass)
+#define REC_DROP (4) //value = running total of records lost because the ring was full, aux = 1 on the REC OFF trailer
+#define REC_EDGES (1) //rec_flags bit: record edges
+#define REC_ADC_PASSES (2) //rec_flags bit: record ADC_reader inputs
+
+/*Memory budget presets*/
+
+#define RAM_SIZE (8192) //STM32F051 SRAM
+#define RAM_STACK_RESERVE (1536) //main stack plus one frame per interrupt priority level
+#define RAM_GLOBALS_RESERVE (1024) //scalar globals, the HAL SPI handle and libc state
+
+//State touched on every edge, kept in one contiguous block next to the edge queue
+#define EDGE_HOT __attribute__((section(".data.edge_hot")))
+
 /*Initialization Method definitions*/
 
 void myGPIOA_Init(void);
 void myGPIOB_Init(void);
-void myTIM2_Init(void);
 void myTIM3_Init(void);
 void myEXTI_Init(void);
+void myTIM14_Init(void);
+void myTIM16_Init(void); //control-rate timer for the PI servo, started by fv_config
+void myTIM1_Init(void); //conversion trigger for the spectrum capture
+void myTIM17_Init(void); //free-running 1us timebase, also the sync pulse output/capture
 void myADC_Init(void);
+void ADC_Start(void); //finish the calibration started by myADC_Init and start scanning
 void myDAC_Init(void);
 void mySPI_Init(void);
+void myUSART1_Init(void); //command interface: USART1 with DMA receive ring and DMA replies
 
 /* Functional Method definitions*/
 
@@ -84,8 +300,74 @@ void oled_Write_Data(unsigned char);
 void perma_print(void);
 void oled_config(void);
 void refresh_OLED(void);
+void oled_Set_Cursor(unsigned char page); //select a page and move to its first character cell
+void oled_Write_Char(unsigned char c); //send the 8 glyph bytes of one character
+void oled_Write_String(const char *s);
+void oled_Write_Digits(uint32_t value, uint16_t width, uint16_t decimals); //right-aligned fixed-point decimal
+void oled_Write_Uint(uint32_t value, uint16_t width); //right-aligned unsigned integer
+void oled_Write_SI(uint32_t value, const char *unit); //5-character value with k/M prefix and unit
+void oled_Clear_To_End(void); //blank the rest of the current page
+void oled_Write_Data_Block(const unsigned char *data, uint16_t length); //several data bytes in one CS cycle
+void oled_Begin_Frame(void); //draw into oled_fb instead of sending to the display
+void oled_End_Frame(void); //send oled_fb to the display, one bulk transfer per page
+uint16_t ms_now(void); //milliseconds since myTIM14_Init (wraps every 65s)
 void ADC_reader(void); // for reading ADC values and setting DAC value
+void ADC_awd_centre(uint32_t raw); //re-centre the analog watchdog window and re-arm it
+void ADC_recal_step(void); //advance the background ADC recalibration by one non-blocking step
+uint32_t ADC_compensate(uint32_t raw, uint32_t vref_raw); //rescale a reading to the nominal 3.3V supply
 void wait(uint32_t wait_time); //Use tim3 to generate a delay
+void meas_set_mode(uint16_t mode); //reconfigure PA1/PA2 and TIM2 for a measurement mode
+void meas_route_input(void); //enable the edge source of the selected input_line only
+void meas_update(void); //turn the latest raw capture into Freq and pick the next range
+void cnt_read(void); //periodic readout of the hardware pulse counter
+void cnt_reset(void); //restart the running total and the rate gate
+void oled_Write_Uint64(uint64_t value); //left-aligned 64-bit count
+void log_arm(uint16_t trigger, uint32_t threshold, uint16_t pre, uint16_t post); //start a triggered capture
+void log_period(uint32_t ticks); //record one raw period (called from the bottom half)
+void log_adc(uint32_t raw); //record one PA5 sample and evaluate the Res-step trigger
+void log_dump_start(void); //start printing the decoded capture on the trace output
+void log_dump_step(void); //print the next few records of the capture, once per main loop pass
+int log_replay_start(void); //rewind the OLED replay to the first record of the finished capture
+void log_replay_step(void); //show the next decoded record on the OLED, once per main loop pass
+void meas_process(uint32_t count, uint16_t channel); //bottom-half conversion, filtering and statistics
+void stats_reset(void);
+void lat_record(uint32_t ticks); //account one edge-to-timestamp delay (called from the edge ISRs)
+static void edge_push(uint32_t count, uint16_t channel); //queue one raw count for the bottom half
+void lat_check(void); //compare the latency instrumentation against LAT_BUDGET_NS
+void lat_reset(void); //clear the worst case, the lost captures and the latched failure
+void cal_load(void); //load calibration record from flash (or defaults)
+int cal_save(void); //erase the calibration page and program the current record
+void cal_run(void); //measure the PA2 reference signal and store a new clock correction
+int cal_pot_two_point(uint32_t raw_lo, uint32_t ohms_lo, uint32_t raw_hi, uint32_t ohms_hi);
+uint32_t cal_crc(const uint32_t *data, uint32_t words); //CRC-32 using the CRC peripheral
+int fv_config(uint16_t source, uint32_t lo, uint32_t hi); //select the DAC source and frequency span
+uint32_t fv_log2(uint32_t x); //Q16 base-2 logarithm, table-interpolated
+void fv_output(uint32_t freq); //map a frequency onto the DAC (F/V modes only)
+void pi_feed(uint32_t freq, uint32_t every_ms); //hand the servo a frequency measured every every_ms
+void fft_step(void); //advance the spectrum capture without blocking, transform and draw when done
+void fft_run(void); //in-place fixed-point FFT of the captured samples
+uint32_t fft_mag(uint16_t k); //approximate magnitude of one bin
+void fft_draw(void); //spectrum bar graph on the OLED
+void comp_config(uint16_t threshold, uint16_t hysteresis); //COMP1 threshold source and hysteresis
+void sync_set_role(uint16_t role); //configure PA7/TIM17 as sync master, slave or neither
+void sync_master_next(void); //shape the master's next sync pulse
+void sync_edge(uint64_t stamp); //one captured sync edge on the slave
+uint64_t sync_local_now(void); //local timebase in us
+uint64_t sync_to_common(uint64_t local); //convert a local timestamp to the master's timebase
+void clk_policy(void); //pick the system clock for the current workload
+void clk_set(uint16_t level); //switch the system clock and re-derive everything that depends on it
+void cal_apply(void); //derive timer_clock from SystemCoreClock and the calibrated ppm error
+void cmd_poll(void); //parse whatever the DMA has received since the last call
+void cmd_execute(char *line); //run one complete command line and queue its reply
+void cmd_Write_String(const char *s); //append to the reply being assembled
+void cmd_Write_Char(unsigned char c);
+void cmd_Write_Uint(uint32_t value);
+void cmd_Write_Int(int32_t value);
+void cmd_Write_Uint64(uint64_t value);
+void cmd_Send(void); //terminate the reply and hand it to the transmit DMA
+int rec_put(uint16_t type, uint16_t aux, uint32_t value); //queue one trace record (any context), -1 if the ring is full
+void rec_header(void); //queue a REC_HEADER while recording
+void rec_flush(void); //hand queued records to the transmit DMA when it is idle
 
 /*Global Variable definitions*/
 
@@ -93,18 +375,231 @@ void wait(uint32_t wait_time); //Use tim3 to generate a delay
 unsigned int Freq = 0;  // measured period value
 unsigned int Res = 0;   // measured resistance value
 
-uint16_t edge_count = 0; //for measuring frequency of source
-uint16_t input_line = 1; //to tell which line (555 or function) we are currently measuring
+EDGE_HOT uint16_t input_line = 1; //to tell which line (555 or function) we are currently measuring
 uint32_t POT_val = 0; //raw data from the ADC
-uint16_t bufferindex = 0; //index to move through buffer array to print to screen
-uint16_t characterindex = 0; //index to move through each string in buffer index
+unsigned int VDDA_mV = VDDA_NOMINAL; //measured analog supply voltage
+int Temp = 0; //die temperature in degrees C
+volatile uint16_t adc_samples[ADC_OVERSAMPLE * ADC_SEQ_LEN]; //DMA ring filled by the ADC scan sequence
+uint16_t adc_recal_state = 0; //0 = idle, otherwise the current step of the background recalibration
+uint16_t adc_recal_timer = 0; //ADC_reader passes since the last recalibration
+uint16_t adc_event = ADC_EVENT_DEFAULT; //1 = event-driven ADC_reader (analog watchdog)
+volatile uint16_t adc_awd_hit = 1; //set by ADC1_COMP_IRQHandler when PA5 leaves the window (and at boot, for the first reading)
+volatile uint32_t adc_awd_events = 0; //watchdog interrupts taken, for the ADC command
+uint16_t adc_awd_idle = 0; //ADC_reader passes skipped since the last recompute
+uint16_t oled_column = 0; //characters written on the current page since the last oled_Set_Cursor
+uint16_t oled_page = 0; //page selected by the last oled_Set_Cursor
+uint16_t oled_framing = 0; //1 between oled_Begin_Frame and oled_End_Frame
+unsigned char oled_fb[8][128]; //one frame, 8 pages of 128 columns
+uint16_t boot_splash_ms = 0; //ms from clock setup until the splash was on screen
+uint16_t boot_first_ms = 0; //ms from clock setup until the first non-zero Freq
+uint16_t boot_reported = 0; //1 once the boot timings have been traced
 SPI_HandleTypeDef SPI_Handle;
 
+volatile uint32_t period_count = 0; //raw TIM2 count of the last measured period
+volatile uint16_t period_ready = 0; //set by the bottom half whenever period_count is updated
+
+//
+// Raw edge slot passed from the edge ISRs to the PendSV bottom half. All producers run at
+// IRQ_PRIO_EDGE and cannot preempt each other, so one head index is enough.
+//
+typedef struct {
+	uint32_t count; //raw TIM2 ticks of one period (or one capture interval)
+	uint16_t channel; //input_line the edge came from
+} edge_slot_t;
+
+EDGE_HOT edge_slot_t edge_queue[EDGE_QUEUE_LEN];
+EDGE_HOT volatile uint16_t edge_head = 0; //written only by the edge ISRs
+EDGE_HOT volatile uint16_t edge_tail = 0; //written only by the bottom half
+EDGE_HOT volatile uint32_t edge_dropped = 0; //slots lost because the bottom half fell behind
+
+uint16_t meas_avg_shift = 0; //averaging: edge-mode IIR filter strength, 2^n longer auto-range gates
+uint32_t edge_filtered = 0; //filtered period in ticks
+uint32_t stat_min = 0; //shortest period since stats_reset, in ticks per edge
+uint32_t stat_max = 0; //longest period since stats_reset, in ticks per edge
+uint64_t stat_sum = 0; //sum of periods since stats_reset, in ticks per edge
+uint32_t stat_n = 0; //periods since stats_reset
+uint32_t timer_clock = 48000000; //SystemCoreClock corrected by the calibrated ppm error
+uint16_t clk_level = CLK_LEVEL_48MHZ; //current system clock
+uint16_t clk_auto = CLK_SCALING; //0 while the clock is pinned by the CLK command
+uint16_t clk_idle = 0; //1 once nothing has happened for CLK_IDLE_MS
+uint16_t clk_busy_ms = 0; //ms_now() of the last activity
+uint16_t clk_activity = 0; //set by anything that should bring the clock back up
+uint32_t clk_ref_freq = 0; //reading the stability check compares against
+
+uint16_t comp_threshold = COMP_THR_DEFAULT; //COMP1 inverting input selection
+uint16_t comp_hysteresis = COMP_HYST_DEFAULT;
+
+uint16_t sync_role = SYNC_OFF;
+volatile uint32_t sync_local_hi = 0; //TIM17 wraps, the upper bits of the local timebase
+uint64_t sync_rise = 0; //local time of the last rising sync edge
+uint64_t sync_prev_local = 0; //local time of the previous valid pulse
+uint16_t sync_have_prev = 0;
+uint32_t sync_index = 0; //master pulse index of the last pulse (valid once locked)
+uint16_t sync_frame_pos = 0xFFFF; //bits received since the last mark, 0xFFFF until a mark is seen
+uint32_t sync_frame_bits = 0; //time code being shifted in
+volatile uint16_t sync_locked = 0; //1 once a complete time code has been decoded
+volatile uint64_t sync_anchor_local = 0; //local time of the last locked pulse
+volatile uint64_t sync_anchor_master = 0; //master time of the same pulse
+volatile uint16_t sync_have_anchor = 0;
+volatile uint32_t sync_rate = SYNC_RATE_ONE; //filtered master/local clock ratio, Q24
+uint64_t meas_stamp = 0; //local time of the last Freq update
+
+uint16_t meas_mode = MEAS_MODE_EDGE; //active measurement mode
+unsigned int meas_time_us = 0; //time the last Freq value was measured over
+unsigned int meas_ppm = 0; //quantisation error bound of the last Freq value
+unsigned int Duty = 0; //duty cycle in tenths of a percent (PWM mode)
+uint32_t pwm_high_ns = 0; //high time of the last period (PWM mode)
+uint32_t pwm_low_ns = 0; //low time of the last period (PWM mode)
+uint16_t pwm_skip = 0; //1: drop the next period, it was timed partly at the clock before a switch
+
+uint16_t cnt_ppr = COUNT_PPR_DEFAULT; //pulses per revolution (RPM mode)
+uint16_t cnt_gate_ms = COUNT_GATE_MS; //rate gate, a multiple of COUNT_READ_MS
+volatile uint32_t cnt_last = 0; //counter value at the previous readout
+volatile uint64_t cnt_total = 0; //pulses since the last cnt_reset
+volatile uint32_t cnt_gate_pulses = 0; //pulses in the gate being accumulated
+volatile uint16_t cnt_gate_reads = 0; //readouts in the gate being accumulated
+volatile uint32_t cnt_pulses = 0; //pulses in the last closed gate
+volatile uint16_t cnt_ready = 0; //set by cnt_read when a gate closes
+uint32_t cnt_per_min = 0; //events per minute over the last gate
+uint32_t cnt_rpm10 = 0; //tenths of a revolution per minute over the last gate
+
+EDGE_HOT volatile uint32_t ar_first = 0; //capture that opened the current gate
+EDGE_HOT volatile uint32_t ar_intervals = 0; //captures since the gate opened
+EDGE_HOT volatile uint16_t ar_armed = 0; //0 until the first capture of a gate has been taken
+EDGE_HOT volatile uint32_t ar_target = 1; //captures that close a gate
+EDGE_HOT volatile uint32_t ar_span = 0; //timer ticks covered by the last closed gate
+EDGE_HOT volatile uint32_t ar_edges = 0; //input edges covered by the last closed gate
+EDGE_HOT volatile uint16_t ar_ready = 0; //set by TIM2_IRQHandler when a gate closes
+EDGE_HOT uint16_t ar_psc = 0; //input capture prescaler code: edges per capture = 1 << ar_psc
+EDGE_HOT volatile uint32_t ar_prev = 0; //previous capture, for the per-capture period fed to the logger
+EDGE_HOT uint16_t ar_hw = 0; //1 while the input clocks a counter and only the gate ends are captured
+EDGE_HOT volatile uint32_t ar_hw_len = 0; //edges in the hardware gate now running
+EDGE_HOT volatile uint32_t ar_hw_next = 0; //edges in the gate after it (already in the counter's ARR preload)
+EDGE_HOT volatile uint32_t ar_hw_high = 0; //upper 16 bits of TIM15 while it is the timebase of a PA1 gate
+
+EDGE_HOT volatile uint32_t lat_worst = 0; //worst edge-to-timestamp delay seen, in timer ticks
+EDGE_HOT volatile uint32_t lat_samples = 0; //edges the delay has been measured on
+EDGE_HOT volatile uint32_t lat_missed = 0; //captures overwritten before the ISR read them
+uint16_t lat_fail = 0; //latched once the budget has been exceeded
+
+uint16_t log_arena[LOG_WORDS]; //delta-encoded capture ring
+volatile uint16_t log_head = 0; //next word to write
+volatile uint16_t log_count = 0; //words written so far, saturates at LOG_WORDS
+volatile uint16_t log_state = LOG_IDLE;
+volatile uint16_t log_post_left = 0; //words still to record after the trigger
+volatile uint16_t log_trig_pos = 0; //log_head right after the triggering record
+volatile uint16_t log_since_key = 0; //delta records since the last absolute record
+volatile uint32_t log_last_period = 0; //reference for the next delta record
+uint16_t log_trigger = LOG_TRIG_NONE;
+uint32_t log_threshold = 0; //period in ticks for frequency triggers, ohms for LOG_TRIG_RES_STEP
+uint16_t log_pre = 0; //words to keep before the trigger
+uint16_t log_post = 0; //words to record after the trigger
+uint16_t log_edges = 1; //input edges covered by each logged period
+uint64_t log_t0 = 0; //common time the capture was armed at (us)
+unsigned int log_last_res = 0; //Res at the previous logged ADC sample
+uint16_t log_replay_pos = 0; //decoder state of the OLED replay, kept between main loop passes
+uint16_t log_replay_left = 0;
+uint32_t log_replay_period = 0;
+uint16_t log_replay_synced = 0;
+uint16_t log_replay_n = 0; //records shown so far
+uint16_t log_dump_busy = 0; //1 while log_dump_step still has records to print
+uint16_t log_dump_pos = 0; //decoder state of the trace dump, kept between main loop passes
+uint16_t log_dump_left = 0;
+uint32_t log_dump_period = 0;
+uint16_t log_dump_synced = 0;
+uint16_t log_dump_n = 0; //records printed so far
+uint32_t log_dump_time = 0; //stamps unwrapped past LOG_TIME_MASK (consecutive stamps are under 268 s apart)
+
+//
+// One decoded logger record
+//
+typedef struct {
+	uint16_t tag; //LOG_TAG_DELTA for periods (already integrated), LOG_TAG_ADC for samples
+	uint16_t trigger; //1 for the record that fired the trigger
+	uint16_t timed; //1 if time holds a stamp (absolute period records)
+	uint32_t value; //period in timer ticks, or raw ADC sample
+	uint32_t time; //common time since arming, us modulo LOG_TIME_MASK + 1
+} log_record_t;
+
+
+//
+// Calibration record kept in the last flash page. All fields are 32-bit aligned
+// so the CRC can be computed over whole words, and the record is programmed
+// one half-word at a time.
+//
+typedef struct {
+	uint16_t magic; //CAL_MAGIC when the page holds a record
+	uint16_t version; //CAL_VERSION the record was written with
+	uint32_t pot_gain; //Q16 gain applied to the ADC-derived resistance
+	int32_t pot_offset; //offset in ohms added after the gain
+	int32_t clk_ppm; //clock error in ppm (positive = clock runs fast)
+	uint32_t crc; //CRC-32 over all preceding words
+} cal_record_t;
+
+cal_record_t cal = { CAL_MAGIC, CAL_VERSION, CAL_GAIN_ONE, 0, 0, 0 };
+volatile uint16_t cal_active = 0; //1 while cal_run times the reference: no stats, latency or outputs
+uint32_t cal_pot_raw_lo = 0; //POT_val at the first potentiometer point (CAL POT LO)
+uint32_t cal_pot_ohms_lo = 0; //known resistance at that point
+uint16_t cal_pot_have_lo = 0; //1 once CAL POT LO has been taken
+
+uint16_t dac_source = DAC_OUT_POT; //what drives PA4
+uint32_t fv_lo = FV_SPAN_LO; //span start (Hz)
+uint32_t fv_hi = FV_SPAN_HI; //span end (Hz)
+uint32_t fv_origin = 0; //span start in mapping units (Hz, or Q16 log2 of Hz)
+uint32_t fv_scale = 0; //Q16 DAC codes per mapping unit above fv_origin
+
+uint32_t pi_setpoint = 0; //target frequency (Hz), from the potentiometer
+uint32_t pi_kp = PI_KP_DEFAULT; //Q16 proportional gain
+uint32_t pi_ki = PI_KI_DEFAULT; //Q16 integral gain per update
+int32_t pi_integ = 0; //integrator, Q16 DAC codes
+volatile uint32_t pi_ticks = 0; //latest period from the bottom half, in ticks per edge
+volatile uint32_t pi_freq = 0; //latest frequency from meas_update, in Hz
+volatile uint16_t pi_fresh = 0; //PI_IN_TICKS or PI_IN_HZ when a new input has arrived since the last control step
+uint16_t pi_stale = 0; //control steps since the last new period
+volatile uint16_t pi_stale_limit = PI_STALE_UPDATES; //control steps without input before it counts as stopped
+
+int16_t fft_re[FFT_LEN]; //DMA target for the raw PA5 samples, then the real part of the spectrum
+int16_t fft_im[FFT_LEN]; //imaginary part of the spectrum
+uint16_t fft_state = 0; //0 = scan running normally, otherwise the current capture step
+uint32_t fft_rate = FFT_RATE_DEFAULT; //sample rate of the next capture (Hz)
+uint16_t oled_view = VIEW_MAIN; //what the main loop draws
+
+volatile unsigned char cmd_rx_ring[CMD_RX_LEN]; //written by DMA1 channel 3 from USART1->RDR
+uint16_t cmd_rx_tail = 0; //next ring byte the parser reads
+char cmd_line[CMD_LINE_LEN]; //command line being assembled
+uint16_t cmd_line_len = 0;
+uint16_t cmd_line_long = 0; //1 while the rest of an over-long line is being discarded
+char cmd_tx[2][CMD_TX_LEN]; //one reply is assembled while the other is transmitted
+uint16_t cmd_tx_buf = 0; //buffer the next reply is assembled in
+uint16_t cmd_tx_len = 0; //bytes assembled so far
+
+uint8_t rec_ring[REC_LEN]; //trace records waiting for the transmit DMA
+volatile uint16_t rec_head = 0; //advanced by rec_put
+uint16_t rec_tail = 0; //advanced by rec_flush once the DMA has sent the bytes
+uint16_t rec_inflight = 0; //bytes handed to the DMA by the last rec_flush
+volatile uint16_t rec_flags = 0; //REC_EDGES | REC_ADC_PASSES while recording
+volatile uint32_t rec_dropped = 0; //records lost because the ring was full
+uint32_t rec_dropped_sent = 0; //rec_dropped at the last REC_DROP
+uint16_t rec_closing = 0; //set by REC OFF until the trailing REC_DROP has been queued
+
+//
+// RAM budget: every buffer above plus the reserves has to fit in the part, checked at compile
+// time so a new buffer that does not fit fails the build instead of the stack. The constant
+// tables below (init commands, glyphs, lookup tables) are const and stay in flash.
+//
+#define RAM_BUFFERS (sizeof(oled_fb) + sizeof(log_arena) + sizeof(adc_samples) + sizeof(edge_queue) \
+		+ sizeof(cmd_rx_ring) + sizeof(cmd_line) + sizeof(cmd_tx) + sizeof(cal) + sizeof(fft_re) + sizeof(fft_im) \
+		+ sizeof(rec_ring))
+
+_Static_assert(RAM_BUFFERS + RAM_STACK_RESERVE + RAM_GLOBALS_RESERVE <= RAM_SIZE, "RAM budget exceeded");
+
+extern uint32_t _sdata, _ebss; //start of .data and end of .bss, from the linker script
+
 
 //
 // LED Display initialization commands
 //
-unsigned char oled_init_cmds[] =
+const unsigned char oled_init_cmds[] =
 {
     0xAE,
     0x20, 0x00,
@@ -134,7 +629,7 @@ unsigned char oled_init_cmds[] =
 //          (where X = 0, 1, ..., 7) and send them one by one to LED Display.
 // Row number = character ASCII code (e.g., ASCII code of '4' is 0x34 = 52)
 //
-unsigned char Characters[][8] = {
+const unsigned char Characters[][8] = {
     {0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000,0b00000000, 0b00000000, 0b00000000},  // SPACE
     {0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000,0b00000000, 0b00000000, 0b00000000},  // SPACE
     {0b00000000, 0b00000000, 0b00000000, 0b00000000, 0b00000000,0b00000000, 0b00000000, 0b00000000},  // SPACE
@@ -266,24 +761,181 @@ unsigned char Characters[][8] = {
 };
 
 
-//function to set system clock speed to 48 MHz
-void SystemClock48MHz( void )
-{
-    RCC->CR &= ~(RCC_CR_PLLON); // Disable the PLL
+//Measurement core: PA1 and PA2 timed by TIM2, one line at a time (input_line), each edge also
+//latched in CCR2/CCR3 for the latency check, periods queued for the PendSV bottom half
+#define MEAS_CHANNELS(X) X(1) X(2)
+#define MEAS_CH1_PIN (1)
+#define MEAS_CH1_LATCH CCR2
+#define MEAS_CH2_PIN (2)
+#define MEAS_CH2_LATCH CCR3
+#define MEAS_TIM TIM2
+#define MEAS_TIM_CLKEN RCC_APB1ENR_TIM2EN
+#define MEAS_TIM_IRQn TIM2_IRQn
+#define MEAS_TIM_PRIO IRQ_PRIO_HOUSEKEEPING //overflow only until meas_set_mode makes it the capture source
+#define MEAS_EDGE_PRIO IRQ_PRIO_EDGE
+#define MEAS_PRESCALER myTIM2_PRESCALER
+#define MEAS_PERIOD myTIM2_PERIOD
+#define MEAS_SINK(count, n) do { \
+		if ((rec_flags & REC_EDGES) != 0) { \
+			rec_put(REC_PERIOD, (n), (count)); \
+		} \
+		edge_push((count), (n)); \
+	} while (0)
+#define MEAS_ACCEPT(n) (input_line == (n)) //PA1 stays unmasked in edge mode, so check the line
+#define MEAS_LATENCY(ticks) lat_record(ticks)
+#define MEAS_HOT EDGE_HOT
+
+//SystemClock48MHz, the TIM2/EXTI set-up and the edge handler bodies
+#include "../Common/meas_core.h"
+
+
+//function to choose the slowest system clock the workload allows. Software edge timing,
+//the spectrum capture, an armed logger and a changing reading or recent command all need
+//48 MHz, and so do sync and the recorder (a switch disturbs their timebase); a stable reading drops to 24 or 8 MHz depending on the capture interrupt rate.
+//A lower clock must also still sample the input itself (every mode but EDGE feeds it to a
+//timer), and in PWM on PA1 still give CLK_PWM_MIN_TICKS per period.
+void clk_policy(void){
+
+	uint16_t level = CLK_LEVEL_8MHZ;
+	uint32_t rate = 0;
+	uint64_t need_hz = 0; //slowest system clock the input allows
+
+	uint32_t diff = (Freq > clk_ref_freq) ? Freq - clk_ref_freq : clk_ref_freq - Freq;
+	if (diff > clk_ref_freq / CLK_STABLE_DIV || clk_activity != 0) {
+		clk_ref_freq = Freq;
+		clk_busy_ms = ms_now();
+		clk_activity = 0;
+		clk_idle = 0;
+	} else if (clk_idle == 0 && (uint16_t)(ms_now() - clk_busy_ms) >= CLK_IDLE_MS) {
+		clk_idle = 1; //latched, ms_now wraps every 65s
+	}
+
+	if (clk_auto == 0) {
+		return;
+	}
 
-    while (( RCC->CR & RCC_CR_PLLRDY ) != 0 ); // Wait for the PLL to unlock
+	if (MEAS_MODE_CAPTURE(meas_mode)) {
+		rate = (ar_hw != 0) ? 0 : Freq >> ar_psc; //hardware gates interrupt a few hundred times a second
+	}
 
-    RCC->CFGR = 0x00280000; // Configure the PLL for a 48MHz system clock
+	if (meas_mode == MEAS_MODE_PWM && input_line == 1) {
+		need_hz = (uint64_t)Freq * CLK_PWM_MIN_TICKS; //PA2 is timed in 1us ticks at any clock
+	} else if (meas_mode != MEAS_MODE_EDGE) {
+		need_hz = (uint64_t)Freq * CLK_INPUT_DIV;
+	}
 
-    RCC->CR |= RCC_CR_PLLON; // Enable the PLL
+	if (clk_idle == 0 || meas_mode == MEAS_MODE_EDGE || oled_view == VIEW_SPECTRUM
+			|| log_state == LOG_ARMED || log_state == LOG_TRIGGERED || rate > CLK_HIGH_EDGE_RATE
+			|| sync_role != SYNC_OFF || rec_flags != 0 || need_hz > 24000000) {
+		level = CLK_LEVEL_48MHZ;
+	} else if (rate > CLK_LOW_EDGE_RATE || need_hz > 8000000) {
+		level = CLK_LEVEL_24MHZ;
+	}
 
-    while (( RCC->CR & RCC_CR_PLLRDY ) != RCC_CR_PLLRDY ); // Wait for the PLL to lock
+	if (level == clk_level || fft_state != 0) {
+		return; //a spectrum capture is paced by TIM1, let it finish first
+	}
 
-    RCC->CFGR = ( RCC->CFGR & (~RCC_CFGR_SW_Msk)) | RCC_CFGR_SW_PLL; // Switch the processor to the PLL clock source
+	//never retime a character that is on the wire
+	if ((USART1->ISR & USART_ISR_BUSY) != 0 || (USART1->ISR & USART_ISR_TC) == 0 || DMA1_Channel2->CNDTR != 0) {
+		return;
+	}
 
-    SystemCoreClockUpdate(); // Update the system with the new clock frequency
+	clk_set(level);
 }
 
+//function to switch the system clock. Interrupts stay off for the whole switch (mostly the
+//PLL lock time), then every prescaler, baud rate and tick-based value is re-derived, so
+//measurements continue in the same units. Periods timed across the switch are discarded.
+void clk_set(uint16_t level){
+
+	uint32_t old_mhz = SystemCoreClock / 1000000;
+	uint32_t new_mhz;
+
+	__disable_irq();
+
+	FLASH->ACR |= FLASH_ACR_LATENCY; //one wait state until the clock is known to be 24 MHz or less
+
+	RCC->CFGR = (RCC->CFGR & (~RCC_CFGR_SW_Msk)) | RCC_CFGR_SW_HSI; // Run from HSI while the PLL changes
+	while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_HSI);
+
+	RCC->CR &= ~(RCC_CR_PLLON); // Disable the PLL
+	while (( RCC->CR & RCC_CR_PLLRDY ) != 0 ); // Wait for the PLL to unlock
+
+	if (level != CLK_LEVEL_8MHZ) {
+		RCC->CFGR = (level == CLK_LEVEL_48MHZ) ? 0x00280000 : 0x00100000; // PLL x12 or x6 from HSI/2
+		RCC->CR |= RCC_CR_PLLON; // Enable the PLL
+		while (( RCC->CR & RCC_CR_PLLRDY ) != RCC_CR_PLLRDY ); // Wait for the PLL to lock
+		RCC->CFGR = ( RCC->CFGR & (~RCC_CFGR_SW_Msk)) | RCC_CFGR_SW_PLL; // Switch the processor to the PLL
+		while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+	}
+
+	SystemCoreClockUpdate();
+	clk_level = level;
+	new_mhz = SystemCoreClock / 1000000;
+
+	if (level != CLK_LEVEL_48MHZ) {
+		FLASH->ACR &= ~(FLASH_ACR_LATENCY); //zero wait states up to 24 MHz
+	}
+
+	cal_apply(); //timer_clock follows SystemCoreClock
+	rec_header(); //a recorded trace is rescaled from here on
+
+	/* millisecond clock: new prescaler, same count */
+	uint16_t ms = TIM14->CNT;
+	TIM14->PSC = myTIM14_PRESCALER;
+	TIM14->EGR = TIM_EGR_UG;
+	TIM14->CNT = ms;
+
+	/* 1us timebase: new prescaler, same count (URS keeps the reload from counting as a wrap) */
+	uint16_t us = TIM17->CNT;
+	TIM17->PSC = SYNC_TIM17_PRESCALER;
+	TIM17->EGR = TIM_EGR_UG;
+	TIM17->CNT = us;
+
+	TIM3->PSC = myTIM3_PRESCALER; //loaded by the next wait()
+	TIM1->PSC = FFT_TIM1_PRESCALER; //loaded at the start of the next spectrum capture
+	TIM16->PSC = PI_TIM16_PRESCALER;
+	TIM16->EGR = TIM_EGR_UG;
+	TIM16->SR &= ~(TIM_SR_UIF);
+
+	if (meas_mode == MEAS_MODE_PWM) {
+		TIM15->PSC = PWM_TIM15_PRESCALER;
+		TIM15->EGR = TIM_EGR_UG;
+		TIM15->SR &= ~(TIM_SR_CC1IF | TIM_SR_CC2IF); //skip the period timed across the switch
+		TIM2->SR = (uint32_t)~(TIM_SR_CC1IF | TIM_SR_CC2IF);
+		pwm_skip = 1; //and the one still running, which ends with the next capture
+	}
+	if (meas_mode == MEAS_MODE_EDGE) {
+		TIM2->CR1 &= ~(TIM_CR1_CEN);
+		edge_count = 0;
+	}
+
+	/* USART1: the baud rate register can only change while the USART is disabled */
+	USART1->CR1 &= ~(USART_CR1_UE);
+	USART1->BRR = (SystemCoreClock + CMD_BAUD / 2) / CMD_BAUD;
+	USART1->CR1 |= USART_CR1_UE;
+
+	/* SPI1: keep the OLED clock at or under 4 MHz */
+	SPI_Handle.Init.BaudRatePrescaler = (level == CLK_LEVEL_48MHZ) ? SPI_BAUDRATEPRESCALER_16
+			: (level == CLK_LEVEL_24MHZ) ? SPI_BAUDRATEPRESCALER_8 : SPI_BAUDRATEPRESCALER_2;
+	SPI1->CR1 &= ~(SPI_CR1_SPE);
+	SPI1->CR1 = (SPI1->CR1 & ~SPI_CR1_BR) | SPI_Handle.Init.BaudRatePrescaler;
+	SPI1->CR1 |= SPI_CR1_SPE;
+
+	/* drop what was timed with the old clock, rescale what is kept in ticks */
+	edge_tail = edge_head;
+	ar_armed = 0;
+	ar_ready = 0;
+	pi_fresh = 0;
+	edge_filtered = (uint32_t)(((uint64_t)edge_filtered * new_mhz) / old_mhz);
+	stat_min = (uint32_t)(((uint64_t)stat_min * new_mhz) / old_mhz);
+	stat_max = (uint32_t)(((uint64_t)stat_max * new_mhz) / old_mhz);
+	stat_sum = (stat_sum * new_mhz) / old_mhz;
+	lat_worst = (uint32_t)(((uint64_t)lat_worst * new_mhz) / old_mhz);
+
+	__enable_irq();
+}
 
 //Main function
 int main(int argc, char* argv[])
@@ -291,24 +943,86 @@ int main(int argc, char* argv[])
 
 	SystemClock48MHz();
 
+	myTIM14_Init();		/* Start the uptime clock used for boot timing */
 	myGPIOA_Init();		/* Initialize I/O port PA */
 	myGPIOB_Init();		/* Initialize I/O port PB */
-	myTIM2_Init();		/* Initialize timer TIM2 */
+	meas_timer_init();	/* Initialize timer TIM2 */
 	myTIM3_Init();		/* Initialize timer TIM3 */
+	myTIM16_Init();		/* Initialize the control-rate timer TIM16 */
+	myTIM1_Init();		/* Initialize the spectrum sample trigger TIM1 */
+	myTIM17_Init();		/* Start the 1us timebase TIM17 */
 	myEXTI_Init();		/* Initialize EXTI */
 
-    	myADC_Init();       /* Initialize ADC*/
+    	myADC_Init();       /* Initialize ADC and start its calibration*/
     	myDAC_Init();       /* Initialize DAC*/
 
+    	cal_load();         /* Load per-unit calibration from flash*/
+    	if ((GPIOA->IDR & GPIO_IDR_0) != 0) {
+    		cal_run();      /* Button held at boot: calibrate against the PA2 reference*/
+    	}
+
+    	meas_set_mode(MEAS_MODE_DEFAULT); /* Switch from edge timing to the auto-ranging counter*/
+
+#ifdef LOG_ARM_AT_BOOT
+    	log_arm(LOG_TRIG_NONE, 0, LOG_WORDS / 2, LOG_WORDS / 2); /* Capture the first half-arena after boot*/
+#endif
+
+    	myUSART1_Init();    /* Start receiving remote commands*/
     	mySPI_Init();       /* Initialize for SPI communications with OLED*/
-    	oled_config();      /*Reset OLED*/
+    	oled_config();      /*Reset and clear OLED while the ADC calibrates*/
+    	ADC_Start();        /* Calibration has long finished by now: start scanning*/
     	perma_print();      /*Print welcome message to OLED*/
-    	oled_config();      /*Reset OLEd again to begin printing res and freq*/
+    	boot_splash_ms = ms_now();
+
+    	uint16_t splash_up = 1; //refresh_OLED takes over the screen once the splash has timed out
+#if !FAST_BOOT
+    	wait(SPLASH_MS);
+#endif
 
 	while (1)
 	{
+		uint16_t loop_ms = ms_now();
+
 		ADC_reader(); //continuously reading from the ADC to update DAC output
-		refresh_OLED(); //continuously refreshing the OLED screen
+		meas_update(); //convert the latest capture into a frequency
+		lat_check(); //flag any edge that was timestamped too late
+		clk_policy(); //slow down while idle, speed up when the workload needs it
+
+		if (log_state == LOG_DONE) {
+			log_dump_start(); //hand the finished capture to the trace output once
+			log_state = LOG_IDLE;
+		}
+		log_dump_step(); //a few records per pass, so the loop period holds during the dump
+
+		if (boot_reported == 0 && Freq != 0) {
+			boot_first_ms = ms_now(); //time to first reading
+			boot_reported = 1;
+			trace_printf("boot: splash at %u ms, first reading at %u ms\n", boot_splash_ms, boot_first_ms);
+			trace_printf("ram: %u bytes static (%u in buffers), budget %u\n",
+					(uint32_t)((char *)&_ebss - (char *)&_sdata), (uint32_t)RAM_BUFFERS,
+					RAM_SIZE - RAM_STACK_RESERVE);
+		}
+
+		if (splash_up != 0) {
+			//keep measuring while the splash is shown
+			if ((uint16_t)(ms_now() - boot_splash_ms) >= SPLASH_MS || !FAST_BOOT) {
+				oled_Begin_Frame(); //blank frame
+				oled_End_Frame();
+				splash_up = 0;
+			}
+		} else if (oled_view == VIEW_SPECTRUM || fft_state != 0) {
+			fft_step(); //a capture in flight is always completed so the ADC scan comes back
+		} else if (oled_view == VIEW_REPLAY) {
+			log_replay_step(); //one logged record per pass
+		} else {
+			refresh_OLED(); //continuously refreshing the OLED screen
+		}
+
+		//hold the loop period without blocking, so commands are answered within one refresh
+		do {
+			cmd_poll();
+			rec_flush();
+		} while ((uint16_t)(ms_now() - loop_ms) < MAIN_LOOP_MS);
 
 	}
 }
@@ -318,155 +1032,170 @@ int main(int argc, char* argv[])
 void perma_print( void )
 {
 
-    // Buffer size = at most 16 characters per PAGE + terminating '\0'
-    unsigned char Buffer[17];
-    unsigned char c; //to index through Buffer
-
-    snprintf( Buffer, sizeof( Buffer ), "Hi Guoliang! :)");
-    /* Buffer now contains your character ASCII codes for LED Display
-       - select PAGE (LED Display line) and set starting SEG (column)
-       - for each c = ASCII code = Buffer[0], Buffer[1], ...,
-           send 8 bytes in Characters[c][0-7] to LED Display
-    */
-    oled_Write_Cmd(0xB0); //select the row on which we want to display this info
-    oled_Write_Cmd(0x10); //select first segment
-    oled_Write_Cmd(0x02); //select first segment
+    //the whole welcome message goes out as one frame instead of character by character
+    oled_Begin_Frame();
 
-    bufferindex = 0;
-    characterindex = 0;
+    oled_Set_Cursor(0); //select the row on which we want to display this info
+    oled_Write_String("Hi Guoliang! :)");
 
-    while(Buffer[bufferindex] != '\0') {
-    	c = Buffer[bufferindex];
-    	characterindex = 0;
+    oled_Set_Cursor(2);
+    oled_Write_String("Presenting...");
 
-        while(characterindex <= 7) {
-        	oled_Write_Data(Characters[c][characterindex]); //Loads all values from the first index of the buffer then goes to next row
-        	characterindex++;
-        }
-        bufferindex++;
+    oled_Set_Cursor(4);
+    oled_Write_String("ECE 355 Project");
 
-    }
-    wait(500);
-
-     snprintf( Buffer, sizeof( Buffer ), "Presenting...");
-     oled_Write_Cmd(0xB2); //select the row on which we want to display this info
-     oled_Write_Cmd(0x10); //select first segment
-     oled_Write_Cmd(0x02); //select first segment
-     bufferindex = 0;
-     characterindex = 0;
-
-     while(Buffer[bufferindex] != '\0') {
-     	c = Buffer[bufferindex];
-     	characterindex = 0;
-
-         while(characterindex <= 7) {
-         	oled_Write_Data(Characters[c][characterindex]); //Loads all values from the first index of the buffer then goes to next row
-         	characterindex++;
-         }
-         bufferindex++;
-
-     }
-     wait(500);
-
-     snprintf( Buffer, sizeof( Buffer ), "ECE 355 Project");
-      oled_Write_Cmd(0xB4); //select the row on which we want to display this info
-      oled_Write_Cmd(0x10); //select first segment
-      oled_Write_Cmd(0x02); //select first segment
-      bufferindex = 0;
-      characterindex = 0;
-
-      while(Buffer[bufferindex] != '\0') {
-      	c = Buffer[bufferindex];
-      	characterindex = 0;
-
-          while(characterindex <= 7) {
-          	oled_Write_Data(Characters[c][characterindex]); //Loads all values from the first index of the buffer then goes to next row
-          	characterindex++;
-          }
-          bufferindex++;
-
-      }
-      wait(500);
-
-      snprintf( Buffer, sizeof( Buffer ), "Sophie & Menoa");
-        oled_Write_Cmd(0xB6); //select the row on which we want to display this info
-        oled_Write_Cmd(0x10); //select first segment
-        oled_Write_Cmd(0x02); //select first segment
-        bufferindex = 0;
-        characterindex = 0;
+    oled_Set_Cursor(6);
+    oled_Write_String("Sophie & Menoa");
 
-        while(Buffer[bufferindex] != '\0') {
-        	c = Buffer[bufferindex];
-        	characterindex = 0;
+    oled_End_Frame();
 
-            while(characterindex <= 7) {
-            	oled_Write_Data(Characters[c][characterindex]); //Loads all values from the first index of the buffer then goes to next row
-            	characterindex++;
-            }
-            bufferindex++;
+}
 
-        }
+//function that continuously is called in main to print current frequency and resistance values
+void refresh_OLED( void )
+{
 
-    wait(500);
+    oled_Set_Cursor(2); //select the row on which we want to display this info
+    oled_Write_String("Res: ");
+    oled_Write_SI(Res, "Ohm");
+    oled_Clear_To_End(); //erase leftovers from a longer previous reading
+
+    oled_Set_Cursor(4); //select the fourth page
+    oled_Write_String("Freq: ");
+    oled_Write_SI(Freq, "Hz");
+    oled_Clear_To_End();
+
+    if (meas_mode == MEAS_MODE_PWM) {
+        oled_Set_Cursor(0);
+        oled_Write_String("Hi:");
+        oled_Write_Digits(pwm_high_ns / 100, 8, 1);
+        oled_Write_String(" us");
+        oled_Clear_To_End();
+
+        oled_Set_Cursor(6);
+        oled_Write_String("Duty: ");
+        oled_Write_Digits(Duty, 5, 1);
+        oled_Write_String(" %");
+        oled_Clear_To_End();
+
+        oled_Set_Cursor(7);
+        oled_Write_String("Lo:");
+        oled_Write_Digits(pwm_low_ns / 100, 8, 1);
+        oled_Write_String(" us");
+        oled_Clear_To_End();
+    } else if (meas_mode == MEAS_MODE_RPM) {
+        oled_Set_Cursor(6);
+        oled_Write_String("RPM: ");
+        oled_Write_Digits(cnt_rpm10, 8, 1);
+        oled_Clear_To_End();
+    } else if (meas_mode == MEAS_MODE_TOTAL) {
+        __disable_irq(); //64-bit total, updated by the readout interrupt
+        uint64_t total = cnt_total;
+        __enable_irq();
+
+        oled_Set_Cursor(6);
+        oled_Write_String("N: ");
+        oled_Write_Uint64(total);
+        oled_Clear_To_End();
+    } else if (meas_mode == MEAS_MODE_RATE) {
+        oled_Set_Cursor(6);
+        oled_Write_String("/min: ");
+        oled_Write_Uint(cnt_per_min, 9);
+        oled_Clear_To_End();
+    } else {
+        oled_Set_Cursor(6); //gate time tells how much the reading can be trusted
+        oled_Write_String("Gate: ");
+        oled_Write_Digits(meas_time_us / 100, 6, 1);
+        oled_Write_String(" ms");
+        oled_Clear_To_End();
+    }
 
 }
 
-//function that continuously is called in main to print current frequency and resistance values
-void refresh_OLED( void )
+//Function to select a page (0-7) and move to its first character cell
+void oled_Set_Cursor( unsigned char page )
 {
+    oled_page = page;
+    oled_column = 0;
 
-    // Buffer size = at most 16 characters per PAGE + terminating '\0'
-    unsigned char Buffer[17];
-    unsigned char c; //to index through Buffer
+    if (oled_framing != 0) {
+        return; //the page is selected when the frame is sent
+    }
 
-    snprintf( Buffer, sizeof( Buffer ), "Res: %5u Ohms", Res );
-    /* Buffer now contains your character ASCII codes for LED Display
-       - select PAGE (LED Display line) and set starting SEG (column)
-       - for each c = ASCII code = Buffer[0], Buffer[1], ...,
-           send 8 bytes in Characters[c][0-7] to LED Display
-    */
-    oled_Write_Cmd(0xB2); //select the row on which we want to display this info
+    oled_Write_Cmd(0xB0 | page); //select the page
     oled_Write_Cmd(0x10); //select first segment
     oled_Write_Cmd(0x02); //select first segment
+}
 
-    bufferindex = 0;
-    characterindex = 0;
-
-    while(Buffer[bufferindex] != '\0') {
-    	c = Buffer[bufferindex];
-    	characterindex = 0;
-
-        while(characterindex <= 7) {
-        	oled_Write_Data(Characters[c][characterindex]); //Loads all values from the first index of the buffer then goes to next row
-        	characterindex++;
+//Function to send one character: 8 bytes in Characters[c][0-7]
+void oled_Write_Char( unsigned char c )
+{
+    if (oled_framing != 0) {
+        if (oled_column < 16) {
+            memcpy(&oled_fb[oled_page & 7][oled_column * 8], Characters[c], 8);
         }
-        bufferindex++;
-
+    } else {
+        oled_Write_Data_Block(Characters[c], 8);
     }
+    oled_column++;
+}
+
+//Function to start drawing a frame: glyphs land in a blank oled_fb until oled_End_Frame
+void oled_Begin_Frame( void )
+{
+    memset(oled_fb, 0, sizeof(oled_fb));
+    oled_framing = 1;
+}
 
-    snprintf( Buffer, sizeof( Buffer ), "Freq: %5u Hz", Freq ); //prints only when the buffer is full (sizeof(Buffer))
+//Function to send oled_fb to the display with a single CS cycle per page
+void oled_End_Frame( void )
+{
+    oled_framing = 0;
 
-    oled_Write_Cmd(0xB4); //select the fourth page
-    oled_Write_Cmd(0x10); //select first segment
-    oled_Write_Cmd(0x02); //select first segment
-    bufferindex = 0;
-    characterindex = 0;
+    for (unsigned char page = 0; page <= 7; page++) {
+        oled_Write_Cmd(0xB0 | page); //select the page
+        oled_Write_Cmd(0x10); //select first segment
+        oled_Write_Cmd(0x02); //select first segment
+        oled_Write_Data_Block(oled_fb[page], sizeof(oled_fb[page]));
+    }
+}
 
-	while(Buffer[bufferindex] != '\0') {
-		c = Buffer[bufferindex];
-		characterindex = 0;
+//Function to send a zero-terminated string
+void oled_Write_String( const char *s )
+{
+    fmt_string(oled_Write_Char, s);
+}
 
-		while(characterindex <= 7) {
-			oled_Write_Data(Characters[c][characterindex]); //Loads all values from the first index of the buffer then goes to next row
-			characterindex++;
-		}
-		bufferindex++;
-	}
+//Function to print value / 10^decimals right-aligned in width characters (e.g. 1234, 2 -> "12.34")
+void oled_Write_Digits( uint32_t value, uint16_t width, uint16_t decimals )
+{
+    fmt_digits(oled_Write_Char, value, width, decimals);
+}
 
+//Function to print an unsigned integer right-aligned in width characters
+void oled_Write_Uint( uint32_t value, uint16_t width )
+{
+    fmt_uint(oled_Write_Char, value, width);
+}
 
-    wait(100);
+//Function to print a 64-bit count without leading blanks
+void oled_Write_Uint64( uint64_t value )
+{
+    fmt_uint64(oled_Write_Char, value);
+}
 
+//Function to print a value in base units as 5 characters plus an SI prefix (" 999 Hz", "1.234 kHz")
+void oled_Write_SI( uint32_t value, const char *unit )
+{
+    fmt_si(oled_Write_Char, value, unit);
+}
 
+//Function to blank the remaining character cells of the current page
+void oled_Clear_To_End( void )
+{
+    while (oled_column < 16) {
+        oled_Write_Char(' ');
+    }
 }
 
 //Intialize general purpose input/output pins in port A
@@ -527,36 +1256,6 @@ void myGPIOB_Init()
     	GPIOB->PUPDR &= ~(GPIO_PUPDR_PUPDR7);
 }
 
-//Initialization for timer 2
-void myTIM2_Init()
-{
-	/* Enable clock for TIM2 peripheral */
-	RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
-
-	/* Configure TIM2: buffer auto-reload, count up, stop on overflow,
-	 * enable update events, interrupt on overflow only */
-	TIM2->CR1 = 0x008C;
-
-	/* Set clock prescaler value */
-	TIM2->PSC = myTIM2_PRESCALER;
-
-	/* Set auto-reloaded delay */
-	TIM2->ARR = myTIM2_PERIOD;
-
-	/* Update timer registers */
-	TIM2->EGR = 0x0001;
-
-	/* Assign TIM2 interrupt priority = 0 in NVIC */
-	NVIC_SetPriority(TIM2_IRQn, 0);
-
-	/* Enable TIM2 interrupts in NVIC */
-	NVIC_EnableIRQ(TIM2_IRQn);
-
-	/* Enable update interrupt generation */
-	TIM2->DIER |= TIM_DIER_UIE;
-
-}
-
 //Initialization for timer 3
 void myTIM3_Init()
 {
@@ -575,8 +1274,8 @@ void myTIM3_Init()
 	/* Update timer registers */
 	TIM3->EGR = 0x0001;
 
-	/* Assign TIM3 interrupt priority = 0 in NVIC */
-	NVIC_SetPriority(TIM3_IRQn, 0);
+	/* The delay timer is the least urgent interrupt */
+	NVIC_SetPriority(TIM3_IRQn, IRQ_PRIO_BACKGROUND);
 
 	/* Enable TIM3 interrupts in NVIC */
 	NVIC_EnableIRQ(TIM3_IRQn);
@@ -586,47 +1285,158 @@ void myTIM3_Init()
 
 }
 
+//Initialization for timer 14, a free-running millisecond clock
+void myTIM14_Init()
+{
+	/* Enable clock for TIM14 peripheral */
+	RCC->APB1ENR |= RCC_APB1ENR_TIM14EN;
+
+	/* Set clock prescaler value */
+	TIM14->PSC = myTIM14_PRESCALER;
+	/* Count through the whole 16-bit range */
+	TIM14->ARR = 0xFFFF;
+
+	/* Update timer registers */
+	TIM14->EGR = 0x0001;
+
+	/* Channel 1 compare paces the pulse counter readout, enabled by the counting modes only */
+	NVIC_SetPriority(TIM14_IRQn, IRQ_PRIO_DEFERRED);
+	NVIC_EnableIRQ(TIM14_IRQn);
+
+	/* Start counting */
+	TIM14->CR1 |= TIM_CR1_CEN;
+}
+
+//Initialization for timer 16, the fixed control rate of the PI servo
+void myTIM16_Init()
+{
+	/* Enable clock for TIM16 peripheral */
+	RCC->APB2ENR |= RCC_APB2ENR_TIM16EN;
+
+	/* Set clock prescaler value */
+	TIM16->PSC = PI_TIM16_PRESCALER;
+	/* One update per control step */
+	TIM16->ARR = 1000000 / PI_RATE_HZ - 1;
+
+	/* Update timer registers */
+	TIM16->EGR = 0x0001;
+	TIM16->SR &= ~(TIM_SR_UIF);
+
+	/* The controller is deferred work: every edge source preempts it */
+	NVIC_SetPriority(TIM16_IRQn, IRQ_PRIO_DEFERRED);
+	NVIC_EnableIRQ(TIM16_IRQn);
+
+	/* Enable update interrupt generation, counting starts with DAC_OUT_SERVO */
+	TIM16->DIER |= TIM_DIER_UIE;
+}
+
+//Initialization for timer 1, which paces the spectrum capture through its TRGO output
+void myTIM1_Init()
+{
+	/* Enable clock for TIM1 peripheral */
+	RCC->APB2ENR |= RCC_APB2ENR_TIM1EN;
+
+	/* Set clock prescaler value, the period is set per capture in fft_step */
+	TIM1->PSC = FFT_TIM1_PRESCALER;
+	TIM1->ARR = 1000000 / FFT_RATE_DEFAULT - 1;
+
+	/* Update event drives TRGO, the ADC external trigger 0 */
+	TIM1->CR2 = (TIM1->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_1;
+
+	/* Update timer registers, no interrupts: the ADC and DMA do the rest */
+	TIM1->EGR = 0x0001;
+}
+
+//Initialization for timer 17, a free-running 1us timebase extended in software by its wraps.
+//PA7 (TIM17_CH1) carries the sync pulse train once sync_set_role picks a role.
+void myTIM17_Init()
+{
+	/* Enable clock for TIM17 peripheral */
+	RCC->APB2ENR |= RCC_APB2ENR_TIM17EN;
+
+	/* Only a real wrap may count as one, not a prescaler reload (URS) */
+	TIM17->CR1 = TIM_CR1_URS | TIM_CR1_ARPE;
+
+	/* Set clock prescaler value */
+	TIM17->PSC = SYNC_TIM17_PRESCALER;
+	/* Count through the whole 16-bit range */
+	TIM17->ARR = 0xFFFF;
+
+	/* Update timer registers */
+	TIM17->EGR = 0x0001;
+
+	/* Wraps and sync captures are housekeeping: timestamps come from the hardware */
+	NVIC_SetPriority(TIM17_IRQn, IRQ_PRIO_HOUSEKEEPING);
+	NVIC_EnableIRQ(TIM17_IRQn);
+
+	TIM17->DIER |= TIM_DIER_UIE;
+	TIM17->CR1 |= TIM_CR1_CEN;
+}
+
+//Function to read the millisecond clock
+uint16_t ms_now(void)
+{
+	return (uint16_t)TIM14->CNT;
+}
+
 //Initialization for external interrupts
 void myEXTI_Init()
 {
-	/* Map EXTI2 line to PA2 */
 	SYSCFG->EXTICR[0] |= SYSCFG_EXTICR1_EXTI0_PA ; //To connect PA0 to EXTI0 (button)
-	SYSCFG->EXTICR[0] |= SYSCFG_EXTICR1_EXTI1_PA ; //To connect PA1 to EXTI1
-	SYSCFG->EXTICR[0] |= SYSCFG_EXTICR1_EXTI2_PA ; //Now connect PA2 (0x00) to EXTI2 (bits 8-11 of EXTICR)
-
-	/* EXTI2 line interrupts: set rising-edge trigger */
 	EXTI->RTSR |= EXTI_RTSR_TR0; //Set rising edge trigger for EXTI0
-	EXTI->RTSR |= EXTI_RTSR_TR1; //Set rising edge trigger for EXTI1
-	EXTI->RTSR |= EXTI_RTSR_TR2; //Set rising edge trigger for EXTI2
-
-	/* Unmask interrupts from EXTI lines */
 	EXTI->IMR |= EXTI_IMR_IM0;
-	EXTI->IMR |= EXTI_IMR_IM1;
-	EXTI->IMR |= EXTI_IMR_IM2;
 
-	/* Assign EXTI2 interrupt priority = 0 in NVIC */
-	NVIC_SetPriority(EXTI0_1_IRQn, 0); //Make sure EXTI0 is priority 0
-	NVIC_SetPriority(EXTI2_3_IRQn, 1); //Make sure EXTI2 is priority 0
+	/* Edge post-processing runs in PendSV, below every edge source */
+	NVIC_SetPriority(PendSV_IRQn, IRQ_PRIO_DEFERRED);
 
-	/* Enable EXTI2 interrupts in NVIC */
-	NVIC_EnableIRQ(EXTI0_1_IRQn); //enable EXTI0 interrupt line
-	NVIC_EnableIRQ(EXTI2_3_IRQn); //enable EXTI2 interrupt line
+	/* PA1 and PA2 edge lines at the highest priority; the button shares EXTI0_1 with PA1 */
+	meas_exti_init();
 }
 
 //Initialization for internal ADC
 void myADC_Init()
 {
 	RCC->APB2ENR |= RCC_APB2ENR_ADCEN; //Enable clock for the ADC1 on the board
+	RCC->AHBENR |= RCC_AHBENR_DMA1EN; //Enable clock for the DMA that empties the scan sequence
+
+	ADC1->CR = ADC_CR_ADCAL; // calibrate the ADC contol register, finished in ADC_Start while the OLED resets
 
-	ADC1->CR = ADC_CR_ADCAL; // calibrate the ADC contol register
+	ADC->CCR |= ADC_CCR_VREFEN | ADC_CCR_TSEN; //wake up VREFINT and the temperature sensor
 
+	//scan PA5, the temperature sensor and VREFINT (converted in ascending channel order)
+	ADC1->CHSELR = ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL16 | ADC_CHSELR_CHSEL17;
+
+	ADC1->SMPR = ADC_SMPR_SMP; //239.5 cycles: the internal channels need more than 17us of sampling
+
+	//continuous sampling, each result moved by circular DMA (DMAEN is set once calibration is done)
+	ADC1->CFGR1 |= ADC_CFGR1_CONT | ADC_CFGR1_DMACFG;
+
+	//analog watchdog on PA5 only; the window is set and armed by ADC_awd_centre
+	ADC1->CFGR1 |= ADC_CFGR1_AWDEN | ADC_CFGR1_AWDSGL | (5 << ADC_CFGR1_AWDCH_Pos);
+	ADC1->TR = ((uint32_t)ADC_FULL_SCALE << ADC_TR_HT_Pos); //whole range until the first reading
+
+	NVIC_SetPriority(ADC1_COMP_IRQn, IRQ_PRIO_BACKGROUND); //only raises a flag for ADC_reader
+	NVIC_EnableIRQ(ADC1_COMP_IRQn);
+
+	/* DMA1 channel 1: ADC1->DR into the sample ring, half-words, circular */
+	DMA1_Channel1->CPAR = (uint32_t)&ADC1->DR;
+	DMA1_Channel1->CMAR = (uint32_t)adc_samples;
+	DMA1_Channel1->CNDTR = ADC_OVERSAMPLE * ADC_SEQ_LEN;
+	DMA1_Channel1->CCR = DMA_CCR_MINC | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_CIRC;
+	DMA1_Channel1->CCR |= DMA_CCR_EN;
+
+}
+
+//Function to finish the ADC bring-up started by myADC_Init
+void ADC_Start()
+{
 	while ((ADC1->CR & ADC_CR_ADCAL) != 0 ); //once done calibrating, the bit will be set back to 0. Ensure program waits for this
 
-	ADC1->CR |= ADC_CR_ADEN; //enable the ADC
+	ADC1->CFGR1 |= ADC_CFGR1_DMAEN;
 
-	ADC1->CHSELR |= ADC_CHSELR_CHSEL5; //set internal ADC to read from ADC channel 5 (PA5)
+	ADC1->CR |= ADC_CR_ADEN; //enable the ADC
 
-	ADC1->CFGR1 |= ADC_CFGR1_CONT; //set up the ADC for continuous sampling
+	while ((ADC1->ISR & ADC_ISR_ADRDY) == 0){}; //wait until the ADC is ready to convert
 
 	ADC1->CR |= ADC_CR_ADSTART; //Start group regular conversion
 
@@ -664,7 +1474,7 @@ void mySPI_Init(void) {
 
 	SPI_Handle.Init.NSS = SPI_NSS_SOFT;
 
-	SPI_Handle.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_256;
+	SPI_Handle.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16; //3 MHz, within the OLED controller's 4 MHz limit
 
 	SPI_Handle.Init.FirstBit = SPI_FIRSTBIT_MSB;
 
@@ -676,15 +1486,168 @@ void mySPI_Init(void) {
 
 }
 
+//Initialization for USART1, the remote command interface. Both directions run on DMA,
+//so receiving and replying never raise an interrupt that could delay an edge.
+void myUSART1_Init(void)
+{
+	RCC->APB2ENR |= RCC_APB2ENR_USART1EN; //Enable the USART1 clock
+	RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+
+	/* PA9 = USART1_TX, PA10 = USART1_RX (AF1) */
+	GPIOA->MODER &= ~(GPIO_MODER_MODER9 | GPIO_MODER_MODER10);
+	GPIOA->MODER |= GPIO_MODER_MODER9_1 | GPIO_MODER_MODER10_1;
+	GPIOA->AFR[1] &= ~(GPIO_AFRH_AFSEL9 | GPIO_AFRH_AFSEL10);
+	GPIOA->AFR[1] |= (0x1 << GPIO_AFRH_AFSEL9_Pos) | (0x1 << GPIO_AFRH_AFSEL10_Pos);
+	GPIOA->PUPDR &= ~(GPIO_PUPDR_PUPDR10);
+	GPIOA->PUPDR |= GPIO_PUPDR_PUPDR10_0; //keep RX idle when no cable is plugged in
+
+	USART1->BRR = (SystemCoreClock + CMD_BAUD / 2) / CMD_BAUD;
+
+	//overrun detection off: the DMA keeps receiving even if a byte was ever missed
+	USART1->CR3 = USART_CR3_DMAR | USART_CR3_DMAT | USART_CR3_OVRDIS;
+
+	/* DMA1 channel 3: USART1->RDR into the receive ring, bytes, circular */
+	DMA1_Channel3->CPAR = (uint32_t)&USART1->RDR;
+	DMA1_Channel3->CMAR = (uint32_t)cmd_rx_ring;
+	DMA1_Channel3->CNDTR = CMD_RX_LEN;
+	DMA1_Channel3->CCR = DMA_CCR_MINC | DMA_CCR_CIRC;
+	DMA1_Channel3->CCR |= DMA_CCR_EN;
+
+	/* DMA1 channel 2: reply buffer into USART1->TDR, armed by cmd_Send */
+	DMA1_Channel2->CPAR = (uint32_t)&USART1->TDR;
+	DMA1_Channel2->CCR = DMA_CCR_MINC | DMA_CCR_DIR;
+
+	USART1->CR1 = USART_CR1_TE | USART_CR1_RE | USART_CR1_UE; //8N1, enable
+}
+
+//Function to queue one raw count for the bottom half, the only work left in the edge ISRs
+static void edge_push(uint32_t count, uint16_t channel)
+{
+	uint16_t next = (edge_head + 1) & (EDGE_QUEUE_LEN - 1);
+
+	if (next == edge_tail) {
+		edge_dropped++; //queue full: keep the older, unprocessed edges
+		return;
+	}
+
+	edge_queue[edge_head].count = count;
+	edge_queue[edge_head].channel = channel;
+	edge_head = next;
+
+	SCB->ICSR = SCB_ICSR_PENDSVSET_Msk; //run the bottom half once no edge ISR is active
+}
+
+/* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
+void PendSV_Handler()
+{
+	/* Bottom half: drain every slot queued since the last run */
+	while (edge_tail != edge_head)
+	{
+		edge_slot_t slot = edge_queue[edge_tail];
+		edge_tail = (edge_tail + 1) & (EDGE_QUEUE_LEN - 1);
+
+		meas_process(slot.count, slot.channel);
+	}
+}
+
+//function to close one hardware counting gate. counter has just counted ar_hw_len input edges
+//and its update was captured as stamp on the timebase; the next gate is already running.
+static inline __attribute__((always_inline)) void ar_hw_gate(uint32_t stamp, uint16_t missed, TIM_TypeDef *counter){
+
+	if (missed != 0) {
+		ar_armed = 0; //a gate end was overwritten, the span would cover two gates
+		lat_missed++;
+	}
+	if (ar_armed != 0) {
+		ar_span = stamp - ar_first;
+		ar_edges = ar_hw_len;
+		ar_ready = 1;
+	}
+	ar_first = stamp;
+	ar_armed = 1;
+
+	//the preload became the running length at this update, load the one after it
+	ar_hw_len = ar_hw_next;
+	ar_hw_next = ar_target;
+	counter->ARR = ar_target - 1;
+}
+
 /* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
 void TIM2_IRQHandler()
 {
+	uint32_t sr = TIM2->SR;
+
+	/* Input capture on PA1 (CH2), PA2 (CH3) or COMP1 (CH4): only one is enabled at a time */
+	if ((sr & (TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF)) != 0)
+	{
+		//reading CCRx also clears the capture flag
+		uint32_t stamp = ((sr & TIM_SR_CC2IF) != 0) ? TIM2->CCR2
+				: ((sr & TIM_SR_CC3IF) != 0) ? TIM2->CCR3 : TIM2->CCR4;
+
+		if ((rec_flags & REC_EDGES) != 0) {
+			rec_put(REC_CAPTURE, input_line, stamp);
+		}
+
+		//a capture overwritten before it was read means this ISR fell behind the input
+		if ((sr & (TIM_SR_CC2OF | TIM_SR_CC3OF | TIM_SR_CC4OF)) != 0) {
+			TIM2->SR = (uint32_t)~(TIM_SR_CC2OF | TIM_SR_CC3OF | TIM_SR_CC4OF); //write-0-to-clear, so a capture or update flag set meanwhile is kept
+			lat_missed++;
+
+			//a rate jump this ISR cannot keep up with would leave no time for the main loop that
+			//picks the prescaler, so step it up here and restart the gate on this capture
+			if (ar_psc < AR_PSC_MAX) {
+				ar_psc++;
+				ar_armed = 0;
+				if ((sr & TIM_SR_CC2IF) != 0) {
+					TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_IC2PSC) | (ar_psc << TIM_CCMR1_IC2PSC_Pos);
+				} else if ((sr & TIM_SR_CC3IF) != 0) {
+					TIM2->CCMR2 = (TIM2->CCMR2 & ~TIM_CCMR2_IC3PSC) | (ar_psc << TIM_CCMR2_IC3PSC_Pos);
+				} else {
+					TIM2->CCMR2 = (TIM2->CCMR2 & ~TIM_CCMR2_IC4PSC) | (ar_psc << TIM_CCMR2_IC4PSC_Pos);
+				}
+			}
+		}
+
+		if (ar_armed == 0) {
+			ar_first = stamp;
+			ar_intervals = 0;
+			ar_armed = 1;
+		} else {
+			if (ar_psc < AR_PSC_MAX) {
+				//per-capture period for logging and statistics, dropped at the top of the range
+				//where the bottom half would cost as much as the captures themselves
+				edge_push(stamp - ar_prev, input_line);
+			}
+
+			if (++ar_intervals >= ar_target) {
+				//close the gate and open the next one on the same capture, so no edges are lost
+				ar_span = stamp - ar_first;
+				ar_edges = ar_intervals << ar_psc;
+				ar_ready = 1;
+				ar_first = stamp;
+				ar_intervals = 0;
+			}
+		}
+		ar_prev = stamp;
+	}
+
+	/* End of a hardware counting gate on PA2: TIM15 counted the edges, IC1 captured its update */
+	if ((sr & TIM_SR_CC1IF) != 0 && (TIM2->DIER & TIM_DIER_CC1IE) != 0)
+	{
+		uint32_t stamp = TIM2->CCR1;
+
+		if ((sr & TIM_SR_CC1OF) != 0) {
+			TIM2->SR = (uint32_t)~(TIM_SR_CC1OF);
+		}
+		ar_hw_gate(stamp, sr & TIM_SR_CC1OF, TIM15);
+	}
+
 	/* Check if update interrupt flag is indeed set */
 	if ((TIM2->SR & TIM_SR_UIF) != 0)
 	{
 		/* Clear update interrupt flag */
 		// Relevant register: TIM2->SR
-		TIM2->SR &= ~(TIM_SR_UIF);
+		TIM2->SR = (uint32_t)~(TIM_SR_UIF);
 
 		/* Restart stopped timer */
 		// Relevant register: TIM2->CR1
@@ -692,6 +1655,51 @@ void TIM2_IRQHandler()
 	}
 }
 
+/* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
+void TIM15_IRQHandler()
+{
+	uint32_t sr = TIM15->SR;
+
+	/* End of a hardware counting gate on PA1: TIM2 counted the edges, IC1 captured its update */
+	if ((sr & TIM_SR_CC1IF) != 0)
+	{
+		uint32_t low = TIM15->CCR1;
+		uint32_t high = ar_hw_high;
+
+		//an overflow still pending happened before the capture if the capture is in the lower half
+		if ((TIM15->SR & TIM_SR_UIF) != 0 && low < 0x8000) {
+			high += 0x10000;
+		}
+		if ((sr & TIM_SR_CC1OF) != 0) {
+			TIM15->SR = (uint32_t)~(TIM_SR_CC1OF); //write-0-to-clear, so a new overflow is kept
+		}
+		ar_hw_gate(high | low, sr & TIM_SR_CC1OF, TIM2);
+	}
+
+	/* Overflow: extend the 16-bit timebase */
+	if ((TIM15->SR & TIM_SR_UIF) != 0)
+	{
+		TIM15->SR = (uint32_t)~(TIM_SR_UIF);
+		ar_hw_high += 0x10000;
+	}
+}
+
+/* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
+void ADC1_COMP_IRQHandler()
+{
+	/* Check if the analog watchdog flag is indeed set */
+	if ((ADC1->ISR & ADC_ISR_AWD) != 0)
+	{
+		//disarm until ADC_reader has taken the new reading and re-centred the window,
+		//otherwise every conversion outside the window would interrupt again
+		ADC1->IER &= ~(ADC_IER_AWDIE);
+		ADC1->ISR = ADC_ISR_AWD;
+
+		adc_awd_hit = 1;
+		adc_awd_events++;
+	}
+}
+
 /* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
 void TIM3_IRQHandler()
 {
@@ -708,104 +1716,2342 @@ void TIM3_IRQHandler()
 	}
 }
 
-
 /* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
-void EXTI2_3_IRQHandler()
+void TIM14_IRQHandler()
 {
-	/* Check if EXTI2 interrupt pending flag is indeed set */
-	if ((EXTI->PR & EXTI_PR_PR2) != 0)
-
+	/* Check if the readout compare flag is indeed set */
+	if ((TIM14->SR & TIM_SR_CC1IF) != 0)
 	{
-        //only want to manipulate values and measure if the input line is set to 2 currently (PA2 as input).
-        if(input_line == 2){
-            // 1. If this is the first edge:
-            if (edge_count == 0) {
-                //	- Clear count register (TIM2->CNT).
-                TIM2->CNT &= 0b00000000;
-                //	- Start timer (TIM2->CR1).
-                TIM2->CR1 |= TIM_CR1_CEN;
-                edge_count = 1;
-
-            } else {
-                //	- Stop timer (TIM2->CR1).
-                TIM2->CR1 &= ~TIM_CR1_CEN;
-                //	- Read out count register (TIM2->CNT).
-                float periodd = (float)(TIM2->CNT) / (float)SystemCoreClock;
-                //	- Calculate signal period and frequency.
-                Freq = (unsigned int)((1)/(periodd)); //update frequency value
-                edge_count = 0;
-
-            }
+		TIM14->SR &= ~(TIM_SR_CC1IF);
+		TIM14->CCR1 = (TIM14->CCR1 + COUNT_READ_MS) & 0xFFFF; //next readout, no drift
 
-        }
-            // 2. Clear EXTI2 interrupt pending flag (EXTI->PR).
-            // note we want to clear it no matter if the operations were performed or not
-            EXTI->PR |= EXTI_PR_PR2;
+		cnt_read();
 	}
 }
 
-void EXTI0_1_IRQHandler()
+/* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
+void TIM17_IRQHandler()
 {
-	// Check if EXTI0 interrupt pending flag is indeed set (button pushed)
-	if ((EXTI->PR & EXTI_PR_PR0) != 0) {
-
-		if(input_line == 1) {
-			input_line = 2;
-            //clear the mask on EXTI2 line interrupts
-        	EXTI->IMR |= EXTI_IMR_IM2;
-		} else {
-			input_line = 1;
-            //mask the EXTI2 interrupt line
-            EXTI->IMR &= ~(EXTI_IMR_IM2);
-		}
-		EXTI->PR |= EXTI_PR_PR0; //clear pending flag
+	uint32_t sr = TIM17->SR;
+	uint32_t ccr = 0;
+	uint16_t captured = 0;
 
+	if (sync_role == SYNC_SLAVE && (sr & TIM_SR_CC1IF) != 0) {
+		ccr = TIM17->CCR1; //reading the capture also clears the flag
+		captured = 1;
 	}
-	// Check if EXTI1 interrupt pending flag is indeed set
-	if ((EXTI->PR & EXTI_PR_PR1) != 0){
 
-        //only want to manipulate values and measure if the input line is set to 1 currently (PA1 as input).
-        if(input_line == 1){
-            // 1. If this is the first edge:
-            if (edge_count == 0) {
-                //	- Clear count register (TIM2->CNT).
-                TIM2->CNT &= 0b00000000;
-                //	- Start timer (TIM2->CR1).
-                TIM2->CR1 |= TIM_CR1_CEN;
-                edge_count = 1;
-
-            } else {
-                //	- Stop timer (TIM2->CR1).
-                TIM2->CR1 &= ~TIM_CR1_CEN;
-                //	- Read out count register (TIM2->CNT).
-                float periodd = (float)(TIM2->CNT) / (float)SystemCoreClock;
-                //	- Calculate signal period and frequency.
-                Freq = (unsigned int)((1)/(periodd)); //update frequency value
-                edge_count = 0;
+	/* Check if update interrupt flag is indeed set */
+	if ((sr & TIM_SR_UIF) != 0)
+	{
+		TIM17->SR &= ~(TIM_SR_UIF);
 
-            }
+		//a capture from the top half of the range was taken before this wrap
+		if (captured != 0 && ccr >= 0x8000) {
+			sync_edge(((uint64_t)sync_local_hi << 16) | ccr);
+			captured = 0;
+		}
+		sync_local_hi++;
 
-        }
+		if (sync_role == SYNC_MASTER) {
+			sync_master_next();
+		}
+	}
 
-		EXTI->PR |= EXTI_PR_PR1; //clear pending flag even if measurement is not taken
+	if (captured != 0) {
+		sync_edge(((uint64_t)sync_local_hi << 16) | ccr);
 	}
 }
 
-//function to read input values from potentiometer and set to output of DAC
-void ADC_reader(){
-
-	while ((ADC1->ISR & ADC_ISR_EOC) == 0){}; //wait until the end of conversion flag is set
-
-	ADC1->ISR &= ~ADC_ISR_EOC; //Clear the end of conversion flag
-
+/* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
+void TIM16_IRQHandler()
+{
+	/* Check if update interrupt flag is indeed set */
+	if ((TIM16->SR & TIM_SR_UIF) != 0)
+	{
+		TIM16->SR &= ~(TIM_SR_UIF);
+
+		/* Same priority as PendSV, so pi_ticks cannot change under us */
+		uint32_t freq = 0;
+		if (pi_fresh != 0) {
+			freq = (pi_fresh == PI_IN_HZ) ? pi_freq : timer_clock / pi_ticks;
+			pi_fresh = 0;
+			pi_stale = 0;
+		} else if (pi_stale < pi_stale_limit) {
+			pi_stale++;
+			return; //no new period yet: hold the output rather than act on old data
+		}
+		//after pi_stale_limit the input counts as stopped (0 Hz), which drives the output up
+
+		int32_t error = (int32_t)pi_setpoint - (int32_t)freq;
+		int64_t integ = (int64_t)pi_integ + (int64_t)pi_ki * error;
+		int64_t out = (int64_t)pi_kp * error + integ;
+
+		//anti-windup: while the output is saturated, only integrate back towards the range
+		if (out > ((int64_t)DAC_FULL_SCALE << 16)) {
+			out = (int64_t)DAC_FULL_SCALE << 16;
+			if (error > 0) {
+				integ = pi_integ;
+			}
+		} else if (out < 0) {
+			out = 0;
+			if (error < 0) {
+				integ = pi_integ;
+			}
+		}
+		if (integ > ((int64_t)DAC_FULL_SCALE << 16)) {
+			integ = (int64_t)DAC_FULL_SCALE << 16;
+		} else if (integ < 0) {
+			integ = 0;
+		}
+
+		pi_integ = (int32_t)integ;
+		DAC->DHR12R1 = (uint32_t)(out >> 16);
+	}
+}
+
+
+/* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
+void EXTI2_3_IRQHandler()
+{
+	MEAS_EDGE(2); //PA2, timed only while input_line is 2
+}
+
+void EXTI0_1_IRQHandler()
+{
+	// Check if EXTI0 interrupt pending flag is indeed set (button pushed)
+	if ((EXTI->PR & EXTI_PR_PR0) != 0) {
+
+		if(input_line == 1) {
+			input_line = 2;
+		} else {
+			input_line = 1;
+		}
+		//unmask the edge source of the new line and mask the other
+		meas_route_input();
+		EXTI->PR = EXTI_PR_PR0; //clear pending flag
+
+	}
+
+	MEAS_EDGE(1); //PA1, timed only while input_line is 1
+}
+
+//function to hand TIM2 and TIM15 back from hardware reciprocal counting
+static void ar_hw_stop(void){
+
+	TIM15->CR1 &= ~TIM_CR1_CEN;
+	TIM15->DIER &= ~(TIM_DIER_CC1IE | TIM_DIER_UIE);
+	TIM15->CCER = 0;
+	TIM15->SMCR = 0;
+	TIM15->CR2 = 0;
+	NVIC_DisableIRQ(TIM15_IRQn);
+
+	TIM2->DIER &= ~(TIM_DIER_CC1IE);
+	TIM2->CCER &= ~(TIM_CCER_CC1E);
+	TIM2->CR2 = 0;
+	TIM2->SMCR = 0;
+	GPIOA->AFR[0] = (GPIOA->AFR[0] & ~GPIO_AFRL_AFSEL2) | (0x2 << GPIO_AFRL_AFSEL2_Pos); //PA2 back on TIM2_CH3
+
+	if (TIM2->ARR != MEAS_PERIOD) {
+		//TIM2 was the edge counter: back to the free-running 32-bit timebase
+		TIM2->CR1 &= ~TIM_CR1_CEN;
+		TIM2->ARR = MEAS_PERIOD;
+		TIM2->EGR = TIM_EGR_UG;
+		TIM2->SR = (uint32_t)~(TIM_SR_UIF);
+		TIM2->DIER |= TIM_DIER_UIE;
+		TIM2->CR1 |= TIM_CR1_CEN;
+	}
+}
+
+//function to count the selected input in hardware above AR_HW_ENTER_RATE, where even the largest
+//capture prescaler interrupts too often. The input clocks one timer, whose update every ar_target
+//edges is captured on the other one: reciprocal counting with one interrupt per gate.
+static void ar_hw_start(void){
+
+	uint32_t edges = ar_target;
+
+	ar_hw_len = edges;
+	ar_hw_next = edges;
+	ar_hw_high = 0;
+	ar_armed = 0; //the first gate starts at an arbitrary edge
+
+	RCC->APB2ENR |= RCC_APB2ENR_TIM15EN;
+
+	if (input_line == 1) {
+		/* TIM2 counts PA1: external clock mode 1 from TI2FP2, update (every ARR+1 edges) -> TRGO.
+		 * The update ends a gate here, so it must not restart the timer in TIM2_IRQHandler. */
+		TIM2->CR1 &= ~TIM_CR1_CEN;
+		TIM2->DIER &= ~(TIM_DIER_UIE);
+		TIM2->CCMR1 = (TIM2->CCMR1 & ~(TIM_CCMR1_CC2S | TIM_CCMR1_IC2PSC | TIM_CCMR1_IC2F)) | TIM_CCMR1_CC2S_0;
+		TIM2->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_1 | TIM_SMCR_SMS;
+		TIM2->CR2 = TIM_CR2_MMS_1;
+		TIM2->ARR = edges - 1;
+		TIM2->EGR = TIM_EGR_UG;
+		TIM2->CR1 |= TIM_CR1_CEN;
+
+		/* TIM15 is the timebase: internal clock, IC1 on TRC = ITR0 (TIM2 TRGO), overflow extends it */
+		TIM15->CR1 &= ~TIM_CR1_CEN;
+		TIM15->PSC = 0;
+		TIM15->ARR = 0xFFFF;
+		TIM15->CCMR1 = TIM_CCMR1_CC1S;
+		TIM15->SMCR = 0;
+		TIM15->EGR = TIM_EGR_UG;
+		TIM15->SR = 0;
+		TIM15->CCER = TIM_CCER_CC1E;
+		TIM15->DIER = TIM_DIER_CC1IE | TIM_DIER_UIE;
+		NVIC_SetPriority(TIM15_IRQn, IRQ_PRIO_EDGE);
+		NVIC_EnableIRQ(TIM15_IRQn);
+		TIM15->CR1 |= TIM_CR1_CEN;
+	} else {
+		/* PA2 = TIM15_CH1 (AF0) */
+		GPIOA->AFR[0] &= ~(GPIO_AFRL_AFSEL2);
+
+		/* TIM15 counts PA2: external clock mode 1 from TI1FP1, update -> TRGO */
+		TIM15->CR1 &= ~TIM_CR1_CEN;
+		TIM15->CR1 |= TIM_CR1_ARPE; //a new gate length waits for the end of the running gate
+		TIM15->PSC = 0;
+		TIM15->ARR = edges - 1;
+		TIM15->CCMR1 = TIM_CCMR1_CC1S_0;
+		TIM15->CCER = 0;
+		TIM15->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_0 | TIM_SMCR_SMS;
+		TIM15->CR2 = TIM_CR2_MMS_1;
+		TIM15->EGR = TIM_EGR_UG;
+		TIM15->CR1 |= TIM_CR1_CEN;
+
+		/* TIM2 stays the free-running timebase: IC1 on TRC = ITR1 (TIM15 TRGO) */
+		TIM2->CCMR1 = (TIM2->CCMR1 & ~(TIM_CCMR1_CC1S | TIM_CCMR1_IC1PSC | TIM_CCMR1_IC1F)) | TIM_CCMR1_CC1S;
+		TIM2->SMCR = TIM_SMCR_TS_0;
+		TIM2->SR = (uint32_t)~(TIM_SR_CC1IF | TIM_SR_CC1OF);
+		TIM2->CCER |= TIM_CCER_CC1E;
+		TIM2->DIER |= TIM_DIER_CC1IE;
+	}
+}
+
+//function to switch between EXTI edge timing and TIM2 input capture on PA1/PA2
+void meas_set_mode(uint16_t mode){
+
+	ar_hw_stop();
+	ar_hw = 0;
+	TIM2->CR1 &= ~TIM_CR1_CEN; //stop the timer while it is reconfigured
+	TIM2->DIER &= ~(TIM_DIER_CC2IE | TIM_DIER_CC3IE | TIM_DIER_CC4IE);
+	COMP1->CSR &= ~(COMP_CSR_COMP1EN | COMP_CSR_COMP1OUTSEL); //PA1 back to a plain pin
+	TIM2->CCER = 0;
+	TIM2->CCMR1 = 0;
+	TIM2->CCMR2 = 0;
+	TIM2->SMCR = 0; //leave slave reset or external clock mode
+	TIM15->CR1 &= ~TIM_CR1_CEN;
+	TIM14->DIER &= ~(TIM_DIER_CC1IE); //stop the pulse counter readout
+
+	meas_mode = mode;
+
+	if (mode == MEAS_MODE_AUTORANGE) {
+		/* PA1 = TIM2_CH2, PA2 = TIM2_CH3 (AF2) */
+		GPIOA->MODER &= ~(GPIO_MODER_MODER1 | GPIO_MODER_MODER2);
+		GPIOA->MODER |= GPIO_MODER_MODER1_1 | GPIO_MODER_MODER2_1;
+		GPIOA->AFR[0] &= ~(GPIO_AFRL_AFSEL1 | GPIO_AFRL_AFSEL2);
+		GPIOA->AFR[0] |= (0x2 << GPIO_AFRL_AFSEL1_Pos) | (0x2 << GPIO_AFRL_AFSEL2_Pos);
+
+		/* IC2 mapped on TI2, IC3 mapped on TI3, rising edges, no filter */
+		TIM2->CCMR1 = (TIM2->CCMR1 & ~(TIM_CCMR1_CC2S | TIM_CCMR1_IC2PSC | TIM_CCMR1_IC2F)) | TIM_CCMR1_CC2S_0;
+		TIM2->CCMR2 = (TIM2->CCMR2 & ~(TIM_CCMR2_CC3S | TIM_CCMR2_IC3PSC | TIM_CCMR2_IC3F)) | TIM_CCMR2_CC3S_0;
+		TIM2->CCER &= ~(TIM_CCER_CC2P | TIM_CCER_CC2NP | TIM_CCER_CC3P | TIM_CCER_CC3NP);
+
+		ar_psc = 0;
+		ar_target = 1;
+		ar_armed = 0;
+		ar_ready = 0;
+
+		NVIC_SetPriority(TIM2_IRQn, IRQ_PRIO_EDGE); //TIM2 is now the edge timestamper
+
+		TIM2->CR1 &= ~TIM_CR1_OPM; //free-running: captures are differenced, the counter never stops
+		TIM2->CNT = 0;
+		TIM2->CR1 |= TIM_CR1_CEN;
+	} else if (mode == MEAS_MODE_COMP) {
+		/* PA1 analog: COMP1 non-inverting input. The comparator squares the signal with
+		 * hysteresis and its output goes to TIM2 IC4 inside the chip, so a slow or noisy
+		 * analog input still gives one capture per period and PA2 is not used. */
+		GPIOA->MODER |= GPIO_MODER_MODER1;
+		GPIOA->PUPDR &= ~(GPIO_PUPDR_PUPDR1);
+		comp_config(comp_threshold, comp_hysteresis);
+
+		/* IC4 mapped on TI4 (the comparator output), rising edges, no filter */
+		TIM2->CCMR2 = TIM_CCMR2_CC4S_0;
+		TIM2->CCER &= ~(TIM_CCER_CC4P | TIM_CCER_CC4NP);
+
+		ar_psc = 0;
+		ar_target = 1;
+		ar_armed = 0;
+		ar_ready = 0;
+
+		NVIC_SetPriority(TIM2_IRQn, IRQ_PRIO_EDGE); //TIM2 is now the edge timestamper
+
+		TIM2->CR1 &= ~TIM_CR1_OPM;
+		TIM2->CNT = 0;
+		TIM2->CR1 |= TIM_CR1_CEN;
+	} else if (mode == MEAS_MODE_PWM) {
+		/* PA1 = TIM2_CH2 (AF2), PA2 = TIM15_CH1 (AF0) */
+		GPIOA->MODER &= ~(GPIO_MODER_MODER1 | GPIO_MODER_MODER2);
+		GPIOA->MODER |= GPIO_MODER_MODER1_1 | GPIO_MODER_MODER2_1;
+		GPIOA->AFR[0] &= ~(GPIO_AFRL_AFSEL1 | GPIO_AFRL_AFSEL2);
+		GPIOA->AFR[0] |= (0x2 << GPIO_AFRL_AFSEL1_Pos);
+
+		NVIC_SetPriority(TIM2_IRQn, IRQ_PRIO_HOUSEKEEPING); //no capture interrupts in this mode
+
+		/* TIM2: IC2 = TI2 rising (period), IC1 = TI2 falling (high time), reset on TI2FP2 */
+		TIM2->CCMR1 = TIM_CCMR1_CC2S_0 | TIM_CCMR1_CC1S_1;
+		TIM2->CCER = TIM_CCER_CC1P | TIM_CCER_CC1E | TIM_CCER_CC2E;
+		TIM2->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_1 | TIM_SMCR_SMS_2;
+		TIM2->CR1 &= ~TIM_CR1_OPM;
+		TIM2->CR1 |= TIM_CR1_CEN;
+
+		/* TIM15: IC1 = TI1 rising (period), IC2 = TI1 falling (high time), reset on TI1FP1 */
+		RCC->APB2ENR |= RCC_APB2ENR_TIM15EN;
+		TIM15->PSC = PWM_TIM15_PRESCALER;
+		TIM15->ARR = 0xFFFF;
+		TIM15->CCMR1 = TIM_CCMR1_CC1S_0 | TIM_CCMR1_CC2S_1;
+		TIM15->CCER = TIM_CCER_CC2P | TIM_CCER_CC1E | TIM_CCER_CC2E;
+		TIM15->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_0 | TIM_SMCR_SMS_2;
+		TIM15->EGR = TIM_EGR_UG; //load the prescaler
+		TIM15->CR1 |= TIM_CR1_CEN;
+	} else if (MEAS_MODE_COUNTING(mode)) {
+		/* PA1 = TIM2_CH2 (AF2), PA2 = TIM15_CH1 (AF0): each input clocks its timer directly,
+		 * so a pulse costs no interrupt and only the periodic readout runs software */
+		GPIOA->MODER &= ~(GPIO_MODER_MODER1 | GPIO_MODER_MODER2);
+		GPIOA->MODER |= GPIO_MODER_MODER1_1 | GPIO_MODER_MODER2_1;
+		GPIOA->AFR[0] &= ~(GPIO_AFRL_AFSEL1 | GPIO_AFRL_AFSEL2);
+		GPIOA->AFR[0] |= (0x2 << GPIO_AFRL_AFSEL1_Pos);
+
+		NVIC_SetPriority(TIM2_IRQn, IRQ_PRIO_HOUSEKEEPING); //no capture interrupts in this mode
+
+		/* TIM2: external clock mode 1 from TI2FP2, rising edges, 32-bit count */
+		TIM2->CCMR1 = TIM_CCMR1_CC2S_0;
+		TIM2->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_1 | TIM_SMCR_SMS;
+		TIM2->CR1 &= ~TIM_CR1_OPM;
+		TIM2->CR1 |= TIM_CR1_CEN;
+
+		/* TIM15: external clock mode 1 from TI1FP1, rising edges, 16-bit count */
+		RCC->APB2ENR |= RCC_APB2ENR_TIM15EN;
+		TIM15->PSC = 0;
+		TIM15->ARR = 0xFFFF;
+		TIM15->CCMR1 = TIM_CCMR1_CC1S_0;
+		TIM15->CCER = 0;
+		TIM15->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_0 | TIM_SMCR_SMS;
+		TIM15->EGR = TIM_EGR_UG;
+		TIM15->CR1 |= TIM_CR1_CEN;
+
+		/* periodic readout on the millisecond clock */
+		TIM14->CCR1 = (TIM14->CNT + COUNT_READ_MS) & 0xFFFF;
+		TIM14->SR &= ~(TIM_SR_CC1IF);
+		TIM14->DIER |= TIM_DIER_CC1IE;
+	} else {
+		/* TIM2 started and stopped by the EXTI handlers. PA1/PA2 stay on TIM2_CH2/CH3
+		 * (EXTI still sees the pins in AF mode) so each edge is also latched in CCR2/CCR3
+		 * without an interrupt, which is what lat_record compares the software timestamp to. */
+		GPIOA->MODER &= ~(GPIO_MODER_MODER1 | GPIO_MODER_MODER2);
+		GPIOA->MODER |= GPIO_MODER_MODER1_1 | GPIO_MODER_MODER2_1;
+		GPIOA->AFR[0] &= ~(GPIO_AFRL_AFSEL1 | GPIO_AFRL_AFSEL2);
+		GPIOA->AFR[0] |= (0x2 << GPIO_AFRL_AFSEL1_Pos) | (0x2 << GPIO_AFRL_AFSEL2_Pos);
+		TIM2->CCMR1 = TIM_CCMR1_CC2S_0;
+		TIM2->CCMR2 = TIM_CCMR2_CC3S_0;
+		TIM2->CCER = TIM_CCER_CC2E | TIM_CCER_CC3E;
+
+		NVIC_SetPriority(TIM2_IRQn, IRQ_PRIO_HOUSEKEEPING); //overflow only, edges preempt it
+		TIM2->CR1 |= TIM_CR1_OPM;
+		edge_count = 0;
+	}
+
+	meas_route_input();
+	lat_reset(); //worst case and lost captures of the previous mode no longer apply
+}
+
+//function to enable only the edge source of the input_line being measured
+void meas_route_input(void){
+
+	if (meas_mode == MEAS_MODE_AUTORANGE) {
+		EXTI->IMR &= ~(EXTI_IMR_IM1 | EXTI_IMR_IM2); //edges come from the timer, not EXTI
+
+		TIM2->DIER &= ~(TIM_DIER_CC2IE | TIM_DIER_CC3IE);
+		TIM2->CCER &= ~(TIM_CCER_CC2E | TIM_CCER_CC3E); //also resets the capture prescaler
+		ar_hw_stop();
+		ar_armed = 0;
+
+		if (ar_hw != 0) {
+			ar_hw_start();
+		} else if (input_line == 1) {
+			TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_IC2PSC) | (ar_psc << TIM_CCMR1_IC2PSC_Pos);
+			TIM2->SR = (uint32_t)~(TIM_SR_CC2IF | TIM_SR_CC2OF | TIM_SR_CC3OF | TIM_SR_CC4OF); //EDGE mode leaves OF set
+			TIM2->CCER |= TIM_CCER_CC2E;
+			TIM2->DIER |= TIM_DIER_CC2IE;
+		} else {
+			TIM2->CCMR2 = (TIM2->CCMR2 & ~TIM_CCMR2_IC3PSC) | (ar_psc << TIM_CCMR2_IC3PSC_Pos);
+			TIM2->SR = (uint32_t)~(TIM_SR_CC3IF | TIM_SR_CC2OF | TIM_SR_CC3OF | TIM_SR_CC4OF);
+			TIM2->CCER |= TIM_CCER_CC3E;
+			TIM2->DIER |= TIM_DIER_CC3IE;
+		}
+	} else if (meas_mode == MEAS_MODE_COMP) {
+		EXTI->IMR &= ~(EXTI_IMR_IM1 | EXTI_IMR_IM2);
+
+		//COMP1 only sees PA1, so the capture stays on IC4 whichever line is selected
+		TIM2->DIER &= ~(TIM_DIER_CC4IE);
+		TIM2->CCER &= ~(TIM_CCER_CC4E); //also resets the capture prescaler
+		ar_armed = 0;
+
+		TIM2->CCMR2 = (TIM2->CCMR2 & ~TIM_CCMR2_IC4PSC) | (ar_psc << TIM_CCMR2_IC4PSC_Pos);
+		TIM2->SR = (uint32_t)~(TIM_SR_CC4IF | TIM_SR_CC2OF | TIM_SR_CC3OF | TIM_SR_CC4OF);
+		TIM2->CCER |= TIM_CCER_CC4E;
+		TIM2->DIER |= TIM_DIER_CC4IE;
+	} else if (meas_mode == MEAS_MODE_PWM) {
+		//both timers run, meas_update reads the one belonging to input_line
+		EXTI->IMR &= ~(EXTI_IMR_IM1 | EXTI_IMR_IM2);
+	} else if (MEAS_MODE_COUNTING(meas_mode)) {
+		//both timers count, cnt_read takes the one belonging to input_line
+		EXTI->IMR &= ~(EXTI_IMR_IM1 | EXTI_IMR_IM2);
+		cnt_reset(); //a different sensor starts a new total
+	} else {
+		EXTI->IMR |= EXTI_IMR_IM1;
+		if (input_line == 2) {
+			EXTI->IMR |= EXTI_IMR_IM2;
+		} else {
+			EXTI->IMR &= ~(EXTI_IMR_IM2);
+		}
+	}
+}
+
+//function to pick the capture prescaler and gate length for the frequency just measured.
+//The prescaler keeps the capture interrupt rate under AR_MAX_CAPTURE_RATE, and the gate is
+//made long enough to span AR_TARGET_COUNTS ticks so +-1 count stays under AR_TARGET_PPM.
+//Past the largest prescaler (AUTORANGE only, COMP1 cannot clock a timer) the edges are
+//counted in hardware and the gate length is in edges instead of captures.
+static void meas_autorange(uint32_t freq){
+
+	uint16_t psc = 0;
+	uint32_t target = 1;
+	uint16_t hw = ar_hw;
+
+	if (log_state == LOG_IDLE || log_state == LOG_DONE) {
+		if (meas_mode == MEAS_MODE_AUTORANGE && freq > AR_HW_ENTER_RATE) {
+			hw = 1;
+		} else if (freq < AR_HW_EXIT_RATE) {
+			hw = 0;
+		}
+	}
+
+	if (hw != 0) {
+		psc = AR_PSC_MAX;
+		target = (uint32_t)(((uint64_t)(AR_TARGET_COUNTS << meas_avg_shift) * freq) / timer_clock) + 1;
+		if (target > AR_HW_MAX_EDGES) {
+			target = AR_HW_MAX_EDGES;
+		}
+	} else if (freq != 0) {
+		while (psc < AR_PSC_MAX && (freq >> psc) > AR_MAX_CAPTURE_RATE) {
+			psc++;
+		}
+
+		uint32_t ticks_per_capture = (uint32_t)(((uint64_t)timer_clock << psc) / freq);
+		if (ticks_per_capture == 0) {
+			ticks_per_capture = 1;
+		}
+
+		target = (AR_TARGET_COUNTS << meas_avg_shift) / ticks_per_capture + 1;
+		if (target > AR_MAX_INTERVALS) {
+			target = AR_MAX_INTERVALS;
+		}
+	}
+
+	if (hw != ar_hw) {
+		//counter and timebase swap roles, restart with the new gate
+		NVIC_DisableIRQ(TIM2_IRQn);
+		NVIC_DisableIRQ(TIM15_IRQn);
+		ar_hw = hw;
+		ar_target = target;
+		ar_psc = psc;
+		meas_route_input(); //re-enables TIM15_IRQn if it is the timebase
+		NVIC_EnableIRQ(TIM2_IRQn);
+		return;
+	}
+
+	ar_target = target; //takes effect on the gate currently open (the one after it in hardware)
+
+	if (psc != ar_psc && (log_state == LOG_IDLE || log_state == LOG_DONE)) {
+		//changing the prescaler invalidates the open gate, so restart it (never mid-capture,
+		//so every logged period covers the same number of edges)
+		NVIC_DisableIRQ(TIM2_IRQn);
+		ar_psc = psc;
+		meas_route_input();
+		NVIC_EnableIRQ(TIM2_IRQn);
+	}
+}
+
+//function to convert the latest raw measurement into Freq, meas_time_us and meas_ppm
+void meas_update(void){
+
+	if (meas_mode == MEAS_MODE_EDGE) {
+		uint32_t count = period_count;
+		if (count != 0) {
+			meas_time_us = (uint32_t)(((uint64_t)count * 1000000) / timer_clock);
+			meas_stamp = sync_local_now();
+			meas_ppm = 1000000 / count;
+		}
+		return;
+	}
+
+	if (MEAS_MODE_COUNTING(meas_mode)) {
+		if (cnt_ready == 0) {
+			return;
+		}
+		cnt_ready = 0;
+
+		uint32_t pulses = cnt_pulses;
+		Freq = (uint32_t)(((uint64_t)pulses * 1000) / cnt_gate_ms);
+		cnt_per_min = (uint32_t)(((uint64_t)pulses * 60000) / cnt_gate_ms);
+		cnt_rpm10 = (uint32_t)(((uint64_t)pulses * 600000) / ((uint32_t)cnt_gate_ms * cnt_ppr));
+		meas_time_us = (uint32_t)cnt_gate_ms * 1000;
+		meas_stamp = sync_local_now();
+		meas_ppm = (pulses != 0) ? 1000000 / pulses : 0;
+		fv_output(Freq); //no bottom half in this mode either, one value per rate gate
+		pi_feed(Freq, cnt_gate_ms);
+		return;
+	}
+
+	if (meas_mode == MEAS_MODE_PWM) {
+		uint32_t period, high, clk;
+
+		//the capture flag says a new period has completed since the last read (reading CCR clears it)
+		if (input_line == 1) {
+			if ((TIM2->SR & TIM_SR_CC2IF) == 0) {
+				return;
+			}
+			period = TIM2->CCR2;
+			high = TIM2->CCR1;
+			clk = timer_clock;
+		} else {
+			if ((TIM15->SR & TIM_SR_CC1IF) == 0) {
+				return;
+			}
+			period = TIM15->CCR1;
+			high = TIM15->CCR2;
+			clk = timer_clock / (PWM_TIM15_PRESCALER + 1);
+		}
+
+		if (pwm_skip != 0) {
+			pwm_skip = 0;
+			return;
+		}
+		if (period == 0 || high > period) {
+			return;
+		}
+
+		Freq = (clk + period / 2) / period;
+		Duty = (uint32_t)(((uint64_t)high * 1000 + period / 2) / period);
+		pwm_high_ns = (uint32_t)(((uint64_t)high * 1000000000) / clk);
+		pwm_low_ns = (uint32_t)(((uint64_t)(period - high) * 1000000000) / clk);
+		meas_time_us = (uint32_t)(((uint64_t)period * 1000000) / clk);
+		meas_stamp = sync_local_now();
+		meas_ppm = 1000000 / period;
+		fv_output(Freq); //no bottom half in this mode, the hardware measures every period
+		pi_feed(Freq, MAIN_LOOP_MS);
+		return;
+	}
+
+	if (ar_ready == 0) {
+		return;
+	}
+
+	NVIC_DisableIRQ(TIM2_IRQn); //take span and edges from the same gate
+	uint32_t span = ar_span;
+	uint32_t edges = ar_edges;
+	ar_ready = 0;
+	NVIC_EnableIRQ(TIM2_IRQn);
+
+	if (span == 0) {
+		return;
+	}
+
+	//reciprocal counting: many periods over one span interpolate below a single 48 MHz tick
+	Freq = (uint32_t)(((uint64_t)edges * timer_clock + span / 2) / span);
+	meas_time_us = (uint32_t)(((uint64_t)span * 1000000) / timer_clock);
+	meas_stamp = sync_local_now();
+	meas_ppm = 1000000 / span;
+
+	if (ar_psc == AR_PSC_MAX) {
+		//no per-capture bottom half at the top of the range, the outputs follow each gate
+		fv_output(Freq);
+		pi_feed(Freq, meas_time_us / 1000);
+	}
+
+	meas_autorange(Freq);
+}
+
+//function to read the pulse counter of the selected input, every COUNT_READ_MS from TIM14.
+//Only the difference to the previous readout is used, so the counters are never reset.
+void cnt_read(void){
+
+	uint32_t delta;
+
+	if (input_line == 1) {
+		uint32_t now = TIM2->CNT;
+		delta = now - cnt_last;
+		cnt_last = now;
+	} else {
+		uint32_t now = TIM15->CNT;
+		delta = (now - cnt_last) & 0xFFFF; //16-bit counter
+		cnt_last = now;
+	}
+
+	cnt_total += delta;
+	cnt_gate_pulses += delta;
+
+	if (++cnt_gate_reads >= cnt_gate_ms / COUNT_READ_MS) {
+		cnt_pulses = cnt_gate_pulses;
+		cnt_gate_pulses = 0;
+		cnt_gate_reads = 0;
+		cnt_ready = 1;
+	}
+}
+
+//function to restart the running total and the rate gate from the current counter value
+void cnt_reset(void){
+
+	uint32_t primask = __get_PRIMASK(); //also called with interrupts already off (meas_route_input)
+
+	__disable_irq(); //keep the readout from running halfway through
+	cnt_last = (input_line == 1) ? TIM2->CNT : TIM15->CNT;
+	cnt_total = 0;
+	cnt_gate_pulses = 0;
+	cnt_gate_reads = 0;
+	cnt_ready = 0;
+	__set_PRIMASK(primask);
+}
+
+//function to select the COMP1 threshold (VREFINT fraction or DAC) and hysteresis. The output is
+//routed to TIM2 IC4 only while the comparator mode is selected.
+void comp_config(uint16_t threshold, uint16_t hysteresis){
+
+	comp_threshold = threshold;
+	comp_hysteresis = hysteresis;
+
+	if (meas_mode != MEAS_MODE_COMP) {
+		return; //applied when the mode is entered
+	}
+
+	/* COMP1 lives on the SYSCFG clock; high-speed mode, non-inverted output */
+	RCC->APB2ENR |= RCC_APB2ENR_SYSCFGCOMPEN;
+	COMP1->CSR = (COMP1->CSR & ~(COMP_CSR_COMP1INSEL | COMP_CSR_COMP1HYST | COMP_CSR_COMP1MODE | COMP_CSR_COMP1POL))
+			| (threshold << COMP_CSR_COMP1INSEL_Pos) | (hysteresis << COMP_CSR_COMP1HYST_Pos)
+			| COMP_CSR_COMP1OUTSEL_2 //100: TIM2 IC4
+			| COMP_CSR_COMP1EN;
+}
+
+//
+// Sync pulse train: one pulse on PA7 every TIM17 wrap of the master (SYNC_PERIOD_US), so pulse n
+// marks master time n * SYNC_PERIOD_US. The pulse width carries a time code: a mark, then the
+// mark's pulse index in SYNC_FRAME_BITS 0/1 pulses, so a slave that starts late still learns
+// the absolute index. The rising edge is the timing reference.
+//
+
+//function to configure PA7 and TIM17 channel 1 for a sync role
+void sync_set_role(uint16_t role){
+
+	__disable_irq(); //the TIM17 handler reads the role
+
+	TIM17->DIER &= ~(TIM_DIER_CC1IE);
+	TIM17->CCER = 0;
+	TIM17->CCMR1 = 0;
+	TIM17->BDTR = 0;
+
+	GPIOA->MODER &= ~(GPIO_MODER_MODER7);
+	GPIOA->AFR[0] &= ~(GPIO_AFRL_AFSEL7);
+
+	if (role == SYNC_MASTER) {
+		/* PA7 = TIM17_CH1 (AF5) output: PWM mode 1, high for the first CCR1 us of each wrap */
+		GPIOA->MODER |= GPIO_MODER_MODER7_1;
+		GPIOA->AFR[0] |= (0x5 << GPIO_AFRL_AFSEL7_Pos);
+		TIM17->CCR1 = SYNC_WIDTH_MARK;
+		TIM17->CCMR1 = TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1PE;
+		TIM17->CCER = TIM_CCER_CC1E;
+		TIM17->BDTR = TIM_BDTR_MOE; //TIM17 has a break input, the output needs MOE
+	} else if (role == SYNC_SLAVE) {
+		/* PA7 = TIM17_CH1 (AF5) input capture on TI1, rising edge first */
+		GPIOA->MODER |= GPIO_MODER_MODER7_1;
+		GPIOA->AFR[0] |= (0x5 << GPIO_AFRL_AFSEL7_Pos);
+		TIM17->CCMR1 = TIM_CCMR1_CC1S_0;
+		TIM17->CCER = TIM_CCER_CC1E;
+		TIM17->SR &= ~(TIM_SR_CC1IF | TIM_SR_CC1OF);
+		TIM17->DIER |= TIM_DIER_CC1IE;
+	}
+
+	sync_role = role;
+	sync_locked = 0;
+	sync_have_prev = 0;
+	sync_have_anchor = 0;
+	sync_frame_pos = 0xFFFF;
+	sync_rate = SYNC_RATE_ONE;
+
+	__enable_irq();
+}
+
+//function to load the width of the master's next pulse, called on every wrap
+void sync_master_next(void){
+
+	uint32_t next = sync_local_hi + 1; //index of the pulse the preloaded CCR1 will shape
+	uint32_t pos = next % (SYNC_FRAME_BITS + 1);
+
+	if (pos == 0) {
+		TIM17->CCR1 = SYNC_WIDTH_MARK;
+	} else {
+		uint32_t mark = next - pos;
+		TIM17->CCR1 = ((mark >> (SYNC_FRAME_BITS - pos)) & 1) ? SYNC_WIDTH_1 : SYNC_WIDTH_0;
+	}
+}
+
+//function to handle one decoded slave pulse: track the master's pulse index and fit the clock
+static void sync_pulse(uint64_t rise, uint16_t symbol){
+
+	uint32_t n = 1;
+
+	//pulses elapsed since the previous one, from the local time, so missed pulses are bridged
+	if (sync_have_prev != 0) {
+		n = (uint32_t)((rise - sync_prev_local + SYNC_PERIOD_US / 2) / SYNC_PERIOD_US);
+		if (n == 0) {
+			return; //spurious edge between two pulses
+		}
+		sync_index += n;
+	}
+	sync_prev_local = rise;
+	sync_have_prev = 1;
+
+	if (n != 1) {
+		sync_frame_pos = 0xFFFF; //a bit of the current time code was lost
+	}
+
+	if (symbol == 2) {
+		sync_frame_pos = 0;
+		sync_frame_bits = 0;
+	} else if (sync_frame_pos < SYNC_FRAME_BITS) {
+		sync_frame_bits = (sync_frame_bits << 1) | symbol;
+		if (++sync_frame_pos == SYNC_FRAME_BITS) {
+			uint32_t decoded = sync_frame_bits + SYNC_FRAME_BITS; //index of this pulse
+			if (sync_locked == 0 || decoded != sync_index) {
+				sync_index = decoded;
+				sync_have_anchor = 0; //(re)locked: start a new fit
+				sync_locked = 1;
+			}
+		}
+	}
+
+	if (sync_locked == 0) {
+		return;
+	}
+
+	uint64_t master = (uint64_t)sync_index * SYNC_PERIOD_US;
+
+	if (sync_have_anchor != 0) {
+		uint64_t local_span = rise - sync_anchor_local;
+		uint64_t master_span = master - sync_anchor_master;
+		if (local_span != 0) {
+			uint32_t rate = (uint32_t)((master_span << 24) / local_span);
+			sync_rate += (int32_t)(rate - sync_rate) >> SYNC_RATE_SHIFT; //drift
+		}
+	}
+	sync_anchor_local = rise; //offset: the last pulse pins the two timebases together
+	sync_anchor_master = master;
+	sync_have_anchor = 1;
+}
+
+//function to take one sync capture on the slave, alternating between rising and falling edges
+void sync_edge(uint64_t stamp){
+
+	if ((TIM17->CCER & TIM_CCER_CC1P) == 0) {
+		sync_rise = stamp;
+		TIM17->CCER |= TIM_CCER_CC1P; //the falling edge next
+		return;
+	}
+	TIM17->CCER &= ~(TIM_CCER_CC1P);
+
+	uint32_t width = (uint32_t)(stamp - sync_rise);
+	if (width < SYNC_WIDTH_MIN || width > SYNC_WIDTH_MAX) {
+		return; //glitch, or an edge was missed and this is not the pulse's own falling edge
+	}
+
+	if (width < (SYNC_WIDTH_0 + SYNC_WIDTH_1) / 2) {
+		sync_pulse(sync_rise, 0);
+	} else if (width < (SYNC_WIDTH_1 + SYNC_WIDTH_MARK) / 2) {
+		sync_pulse(sync_rise, 1);
+	} else {
+		sync_pulse(sync_rise, 2); //frame mark
+	}
+}
+
+//function to read the local timebase: TIM17 extended by its wraps, in us
+uint64_t sync_local_now(void){
+
+	uint32_t hi, lo;
+
+	do {
+		hi = sync_local_hi;
+		lo = TIM17->CNT;
+	} while (hi != sync_local_hi);
+
+	//a wrap not yet counted because the caller runs at or above the TIM17 priority
+	if ((TIM17->SR & TIM_SR_UIF) != 0 && lo < 0x8000) {
+		hi++;
+	}
+
+	return ((uint64_t)hi << 16) | lo;
+}
+
+//function to convert a local timestamp to the common (master) timebase, in us
+uint64_t sync_to_common(uint64_t local){
+
+	if (sync_role != SYNC_SLAVE || sync_locked == 0) {
+		return local; //the master's own timebase is the common one
+	}
+
+	__disable_irq(); //anchor and rate from the same pulse
+	uint64_t anchor_local = sync_anchor_local;
+	uint64_t anchor_master = sync_anchor_master;
+	uint32_t rate = sync_rate;
+	__enable_irq();
+
+	int64_t since = (int64_t)(local - anchor_local);
+	return anchor_master + (uint64_t)((since * (int64_t)rate) >> 24);
+}
+
+//function to convert, filter and accumulate one raw count, run from PendSV (never in an edge ISR)
+void meas_process(uint32_t count, uint16_t channel){
+
+	if (channel != input_line || count == 0) {
+		return; //left over from before the input was switched
+	}
+
+	if (cal_active != 0) {
+		period_count = count; //cal_run only needs the raw periods
+		period_ready = 1;
+		return;
+	}
+
+	log_period(count);
+
+	uint32_t per_edge = MEAS_MODE_CAPTURE(meas_mode) ? (count >> ar_psc) : count;
+	if (stat_n == 0 || per_edge < stat_min) {
+		stat_min = per_edge;
+	}
+	if (per_edge > stat_max) {
+		stat_max = per_edge;
+	}
+	stat_sum += per_edge;
+	stat_n++;
+
+	if (dac_source == DAC_OUT_SERVO) {
+		pi_ticks = per_edge; //picked up at the fixed control rate by TIM16_IRQHandler
+		pi_stale_limit = PI_STALE_UPDATES;
+		pi_fresh = PI_IN_TICKS;
+	} else if (dac_source != DAC_OUT_POT) {
+		fv_output(timer_clock / per_edge); //unfiltered, so the output lags by a single period
+	}
+
+	if (meas_mode != MEAS_MODE_EDGE) {
+		return; //the capture modes compute Freq over a whole gate in meas_update
+	}
+
+	period_count = count;
+	period_ready = 1;
+
+	if (edge_filtered == 0 || meas_avg_shift == 0) {
+		edge_filtered = count;
+	} else {
+		edge_filtered += (int32_t)(count - edge_filtered) >> meas_avg_shift;
+	}
+
+	//	- Calculate signal frequency using the calibrated timer clock.
+	Freq = timer_clock / edge_filtered; //update frequency value
+	meas_stamp = sync_local_now();
+}
+
+//function to clear the period statistics
+void stats_reset(void){
+
+	uint32_t primask = __get_PRIMASK(); //may be called with interrupts already off
+
+	__disable_irq(); //PendSV cannot be masked on its own
+	stat_min = 0;
+	stat_max = 0;
+	stat_sum = 0;
+	stat_n = 0;
+	__set_PRIMASK(primask);
+}
+
+//function to account one measured edge-to-timestamp delay, called from the edge ISRs
+void lat_record(uint32_t ticks){
+
+	if (cal_active != 0) {
+		return; //TIM2 is not latching the edges while cal_run measures the reference
+	}
+	if (ticks > lat_worst) {
+		lat_worst = ticks;
+	}
+	lat_samples++;
+}
+
+//function to start the latency instrumentation over, the budget applies per measurement mode
+void lat_reset(void){
+
+	uint32_t primask = __get_PRIMASK(); //meas_set_mode runs with interrupts off when MODE changes it
+
+	__disable_irq();
+	lat_worst = 0;
+	lat_samples = 0;
+	lat_missed = 0;
+	__set_PRIMASK(primask);
+	lat_fail = 0;
+}
+
+//function to check the latency instrumentation against the budget. Feed the maximum input
+//rate while this runs: the worst case seen must stay under LAT_BUDGET_NS and no capture may be lost.
+void lat_check(void){
+
+	uint32_t budget = (uint32_t)(((uint64_t)LAT_BUDGET_NS * timer_clock) / 1000000000);
+
+	if (lat_fail == 0 && (lat_worst > budget || lat_missed != 0)) {
+		lat_fail = 1;
+		trace_printf("latency budget exceeded: worst %u ticks (budget %u) over %u edges, %u captures lost\n",
+				lat_worst, budget, lat_samples, lat_missed);
+	}
+}
+
+//function to write one word into the capture ring and close the post-trigger window
+static void log_put(uint16_t word){
+
+	if (log_state == LOG_DONE) {
+		return; //the window closed part-way through a multi-word record
+	}
+
+	log_arena[log_head] = word;
+	log_head = (log_head + 1) & (LOG_WORDS - 1);
+
+	if (log_count < LOG_WORDS) {
+		log_count++;
+	}
+
+	if (log_state == LOG_TRIGGERED && --log_post_left == 0) {
+		log_state = LOG_DONE; //arena is frozen from here on
+	}
+}
+
+//function to mark the trigger point and start counting down the post-trigger window
+static void log_fire(void){
+
+	log_trig_pos = log_head;
+	log_post_left = log_post;
+	log_state = (log_post != 0) ? LOG_TRIGGERED : LOG_DONE;
+}
+
+//function to start a capture: the ring keeps the last pre words, then records post more after the trigger
+void log_arm(uint16_t trigger, uint32_t threshold, uint16_t pre, uint16_t post){
+
+	log_state = LOG_IDLE; //stop the ISRs from writing while the state is reset
+
+	if (post > LOG_WORDS - 1) {
+		post = LOG_WORDS - 1;
+	}
+	if (pre > LOG_WORDS - post) {
+		pre = LOG_WORDS - post;
+	}
+
+	//every logged period covers the same number of edges for the whole capture
+	log_edges = MEAS_MODE_CAPTURE(meas_mode) ? (1 << ar_psc) : 1;
+
+	log_trigger = trigger;
+	log_threshold = threshold;
+	if ((trigger == LOG_TRIG_FREQ_ABOVE || trigger == LOG_TRIG_FREQ_BELOW) && threshold != 0) {
+		log_threshold = (uint32_t)(((uint64_t)timer_clock * log_edges) / threshold); //Hz -> ticks per logged period
+	}
+
+	log_pre = pre;
+	log_post = post;
+	log_head = 0;
+	log_count = 0;
+	log_since_key = LOG_KEY_INTERVAL; //first period goes out as an absolute record
+	log_last_period = 0;
+	log_last_res = Res;
+	log_t0 = sync_to_common(sync_local_now());
+
+	log_state = LOG_ARMED;
+}
+
+//function to record one raw period, called from interrupt context.
+//Periods are stored as 14-bit deltas, with an absolute record at least every LOG_KEY_INTERVAL
+//so a decoder can resynchronise wherever the ring wrapped. Each absolute record also carries
+//the common time it was logged at (within the bottom-half delay of the edge), so a host can
+//line the capture up with other boards; the deltas in between follow from the periods.
+void log_period(uint32_t ticks){
+
+	if (log_state != LOG_ARMED && log_state != LOG_TRIGGERED) {
+		return;
+	}
+
+	if (ticks > LOG_ABS_MAX) {
+		ticks = LOG_ABS_MAX;
+	}
+
+	int32_t delta = (int32_t)(ticks - log_last_period);
+
+	if (log_since_key >= LOG_KEY_INTERVAL || delta > LOG_DELTA_MAX || delta < -LOG_DELTA_MAX - 1) {
+		uint32_t time = (uint32_t)(sync_to_common(sync_local_now()) - log_t0) & LOG_TIME_MASK;
+
+		log_put(LOG_TAG_ABS_HI | (uint16_t)((ticks >> 14) & 0x3FFF));
+		log_put(LOG_TAG_ABS_LO | (uint16_t)(ticks & 0x3FFF));
+		log_put(LOG_TAG_ABS_LO | (uint16_t)(time >> 14));
+		log_put(LOG_TAG_ABS_LO | (uint16_t)(time & 0x3FFF));
+		log_since_key = 0;
+	} else {
+		log_put(LOG_TAG_DELTA | (uint16_t)((uint32_t)delta & 0x3FFF));
+		log_since_key++;
+	}
+	log_last_period = ticks;
+
+	if (log_state == LOG_ARMED && log_count >= log_pre) {
+		if (log_trigger == LOG_TRIG_NONE
+				|| (log_trigger == LOG_TRIG_FREQ_ABOVE && ticks < log_threshold)
+				|| (log_trigger == LOG_TRIG_FREQ_BELOW && ticks > log_threshold)) {
+			log_fire();
+		}
+	}
+}
+
+//function to record one PA5 sample from the main loop
+void log_adc(uint32_t raw){
+
+	if (log_state != LOG_ARMED && log_state != LOG_TRIGGERED) {
+		return;
+	}
+
+	//the edge ISRs write into the same ring
+	__disable_irq();
+	log_put(LOG_TAG_ADC | (uint16_t)(raw & 0x0FFF));
+	__enable_irq();
+
+	if (log_state == LOG_ARMED && log_trigger == LOG_TRIG_RES_STEP && log_count >= log_pre) {
+		unsigned int step = (Res > log_last_res) ? Res - log_last_res : log_last_res - Res;
+		if (step >= log_threshold) {
+			__disable_irq();
+			log_fire();
+			__enable_irq();
+		}
+	}
+	log_last_res = Res;
+}
+
+//function to decode the next record of a finished capture, returns 0 once the ring is exhausted.
+//Deltas before the first absolute record cannot be resolved and are skipped.
+static int log_next(uint16_t *pos, uint16_t *left, uint32_t *period, uint16_t *synced, log_record_t *out){
+
+	while (*left != 0) {
+		uint16_t word = log_arena[*pos];
+		*pos = (*pos + 1) & (LOG_WORDS - 1);
+		(*left)--;
+
+		out->trigger = (*pos == log_trig_pos) ? 1 : 0;
+		out->timed = 0;
+
+		switch (word & LOG_TAG_MASK) {
+		case LOG_TAG_ADC:
+			out->tag = LOG_TAG_ADC;
+			out->value = word & 0x0FFF;
+			return 1;
+		case LOG_TAG_ABS_HI:
+			if (*left != 0 && (log_arena[*pos] & LOG_TAG_MASK) == LOG_TAG_ABS_LO) {
+				*period = ((uint32_t)(word & 0x3FFF) << 14) | (log_arena[*pos] & 0x3FFF);
+				*pos = (*pos + 1) & (LOG_WORDS - 1);
+				(*left)--;
+				*synced = 1;
+
+				//the time stamp, unless the window closed before it was written
+				uint16_t next = (*pos + 1) & (LOG_WORDS - 1);
+				if (*left >= 2 && (log_arena[*pos] & LOG_TAG_MASK) == LOG_TAG_ABS_LO
+						&& (log_arena[next] & LOG_TAG_MASK) == LOG_TAG_ABS_LO) {
+					out->time = ((uint32_t)(log_arena[*pos] & 0x3FFF) << 14) | (log_arena[next] & 0x3FFF);
+					out->timed = 1;
+					*pos = (next + 1) & (LOG_WORDS - 1);
+					*left -= 2;
+				}
+				out->trigger = (*pos == log_trig_pos) ? 1 : 0;
+				out->tag = LOG_TAG_DELTA;
+				out->value = *period;
+				return 1;
+			}
+			break;
+		case LOG_TAG_DELTA:
+			if (*synced != 0) {
+				int32_t delta = (int32_t)((uint32_t)word << 18) >> 18; //sign-extend 14 bits
+				*period += delta;
+				out->tag = LOG_TAG_DELTA;
+				out->value = *period;
+				return 1;
+			}
+			break;
+		default:
+			break; //orphaned low half of an absolute record
+		}
+	}
+
+	return 0;
+}
+
+//function to start printing a finished capture: the header now, the records from log_dump_step
+void log_dump_start(void){
+
+	log_dump_left = log_count;
+	log_dump_pos = (log_count < LOG_WORDS) ? 0 : log_head;
+	log_dump_period = 0;
+	log_dump_synced = 0;
+	log_dump_n = 0;
+	log_dump_time = 0;
+	log_dump_busy = 1;
+
+	trace_printf("capture: %u words, %u edges per period, clock %u Hz, armed at %u.%06u s common time\n",
+			log_count, log_edges, timer_clock, (uint32_t)(log_t0 / 1000000), (uint32_t)(log_t0 % 1000000));
+}
+
+//function to print the next LOG_DUMP_RECORDS records of the capture, one per line ('*' marks the
+//trigger). Each line is a semihosting call, so the dump is spread over main loop passes like the
+//OLED replay. Stops early if the logger is re-armed under it.
+void log_dump_step(void){
+
+	log_record_t rec;
+
+	if (log_dump_busy == 0) {
+		return;
+	}
+	if (log_state == LOG_ARMED || log_state == LOG_TRIGGERED) {
+		trace_printf("capture: dump cut short after %u records, logger re-armed\n", log_dump_n);
+		log_dump_busy = 0;
+		return;
+	}
+
+	for (uint16_t i = 0; i < LOG_DUMP_RECORDS; i++) {
+		if (!log_next(&log_dump_pos, &log_dump_left, &log_dump_period, &log_dump_synced, &rec)) {
+			log_dump_busy = 0;
+			return;
+		}
+		if (rec.timed != 0) {
+			log_dump_time += (rec.time - log_dump_time) & LOG_TIME_MASK;
+			trace_printf("%u%c %c %u T=+%u\n", log_dump_n++, rec.trigger ? '*' : ' ', 'P', rec.value, log_dump_time);
+		} else {
+			trace_printf("%u%c %c %u\n", log_dump_n++, rec.trigger ? '*' : ' ', (rec.tag == LOG_TAG_ADC) ? 'A' : 'P', rec.value);
+		}
+	}
+}
+
+//function to rewind the OLED replay, returns -1 if there is no finished capture to show
+int log_replay_start(void){
+
+	if (log_state == LOG_ARMED || log_state == LOG_TRIGGERED || log_count == 0) {
+		return -1;
+	}
+
+	log_replay_left = log_count;
+	log_replay_pos = (log_count < LOG_WORDS) ? 0 : log_head;
+	log_replay_period = 0;
+	log_replay_synced = 0;
+	log_replay_n = 0;
+	return 0;
+}
+
+//function to show the next record of the replay on the OLED (pages 0 and 7), called once per
+//main loop pass so each record stays up for MAIN_LOOP_MS and commands are still answered.
+//Goes back to VIEW_MAIN after the last record, or if the logger is re-armed under it.
+void log_replay_step(void){
+
+	log_record_t rec;
+
+	if (log_state == LOG_ARMED || log_state == LOG_TRIGGERED
+			|| !log_next(&log_replay_pos, &log_replay_left, &log_replay_period, &log_replay_synced, &rec)) {
+		oled_view = VIEW_MAIN;
+		oled_Begin_Frame(); //blank frame, refresh_OLED only draws its own pages
+		oled_End_Frame();
+		return;
+	}
+
+	oled_Set_Cursor(0);
+	oled_Write_String("Rec");
+	oled_Write_Uint(log_replay_n++, 5);
+	oled_Write_Char(rec.trigger ? '*' : ' ');
+	oled_Clear_To_End();
+
+	oled_Set_Cursor(7);
+	if (rec.tag == LOG_TAG_ADC) {
+		oled_Write_String("ADC: ");
+		oled_Write_Uint(rec.value, 5);
+	} else {
+		oled_Write_String("F: ");
+		oled_Write_SI((uint32_t)(((uint64_t)timer_clock * log_edges) / (rec.value ? rec.value : 1)), "Hz");
+	}
+	oled_Clear_To_End();
+}
+
+//
+// log2(1 + i/16) in Q16, the frequency-to-voltage log mapping interpolates between these
+//
+static const uint32_t fv_log2_table[17] =
+{
+    0, 5732, 11136, 16248, 21098, 25711, 30109, 34312, 38336,
+    42196, 45904, 49472, 52911, 56229, 59434, 62534, 65536
+};
+
+//function to select what drives the DAC and precompute the span, returns 0 for an invalid span.
+//The scale is worked out here once so fv_output needs no division.
+int fv_config(uint16_t source, uint32_t lo, uint32_t hi){
+
+	uint32_t origin = 0;
+	uint32_t scale = 0;
+
+	if (source == DAC_OUT_FREQ_LIN) {
+		if (hi <= lo) {
+			return 0;
+		}
+		origin = lo;
+		scale = (uint32_t)(((uint64_t)DAC_FULL_SCALE << 16) / (hi - lo));
+	} else if (source == DAC_OUT_FREQ_LOG) {
+		if (lo == 0 || hi <= lo) {
+			return 0;
+		}
+		origin = fv_log2(lo);
+		if (fv_log2(hi) <= origin) {
+			return 0;
+		}
+		scale = (uint32_t)(((uint64_t)DAC_FULL_SCALE << 16) / (fv_log2(hi) - origin));
+	} else if (source == DAC_OUT_SERVO) {
+		if (hi <= lo) {
+			return 0;
+		}
+	} else if (source != DAC_OUT_POT) {
+		return 0;
+	}
+
+	__disable_irq(); //the bottom half reads all of these together
+	dac_source = source;
+	fv_lo = lo;
+	fv_hi = hi;
+	fv_origin = origin;
+	fv_scale = scale;
+	if (source == DAC_OUT_SERVO) {
+		pi_integ = (int32_t)(DAC->DHR12R1 << 16); //bumpless start from the current output
+		pi_fresh = 0;
+		pi_stale = 0;
+		TIM16->CNT = 0;
+		TIM16->CR1 |= TIM_CR1_CEN;
+	} else {
+		TIM16->CR1 &= ~TIM_CR1_CEN;
+	}
+	__enable_irq();
+
+	return 1;
+}
+
+//function to compute log2(x) in Q16 for x >= 1. The M0 has no CLZ, so the integer part
+//comes from a 5-step normalisation and the fraction from the 16-segment table.
+uint32_t fv_log2(uint32_t x){
+
+	uint32_t e = 31;
+
+	if (x == 0) {
+		return 0;
+	}
+	if ((x & 0xFFFF0000) == 0) { x <<= 16; e -= 16; }
+	if ((x & 0xFF000000) == 0) { x <<= 8; e -= 8; }
+	if ((x & 0xF0000000) == 0) { x <<= 4; e -= 4; }
+	if ((x & 0xC0000000) == 0) { x <<= 2; e -= 2; }
+	if ((x & 0x80000000) == 0) { x <<= 1; e -= 1; }
+
+	uint32_t i = (x >> 27) & 0xF; //4 bits below the leading one pick the segment
+	uint32_t frac = (x >> 15) & 0xFFF; //the next 12 bits interpolate within it
+
+	return (e << 16) + fv_log2_table[i] + (((fv_log2_table[i + 1] - fv_log2_table[i]) * frac) >> 12);
+}
+
+//function to drive the DAC from a frequency, called from the measurement bottom half
+void fv_output(uint32_t freq){
+
+	uint32_t x;
+	uint32_t code = 0;
+
+	if (dac_source != DAC_OUT_FREQ_LIN && dac_source != DAC_OUT_FREQ_LOG) {
+		return;
+	}
+
+	x = (dac_source == DAC_OUT_FREQ_LOG) ? fv_log2(freq) : freq;
+
+	if (freq != 0 && x > fv_origin) {
+		code = (uint32_t)(((uint64_t)(x - fv_origin) * fv_scale) >> 16);
+		if (code > DAC_FULL_SCALE) {
+			code = DAC_FULL_SCALE;
+		}
+	}
+
+	DAC->DHR12R1 = code;
+}
+
+//function to hand the servo a frequency from a mode without a per-period bottom half. every_ms
+//is how often a new value arrives, the input only counts as stopped after that much longer.
+void pi_feed(uint32_t freq, uint32_t every_ms){
+
+	if (dac_source != DAC_OUT_SERVO) {
+		return;
+	}
+
+	__disable_irq(); //TIM16_IRQHandler takes all three together
+	pi_freq = freq;
+	pi_stale_limit = (uint16_t)(PI_STALE_UPDATES + (every_ms * PI_RATE_HZ) / 1000);
+	pi_fresh = PI_IN_HZ;
+	__enable_irq();
+}
+
+//
+// Remote command protocol: one command per line (CR and/or LF), case-insensitive,
+// arguments separated by spaces. Every line gets exactly one reply line, "OK ..." or "ERR ...".
+//
+//   READ                          OK MODE=<m> CH=<n> F=<Hz> R=<ohm> DUTY=<0.1%> GATE=<us> PPM=<ppm>
+//                                    DAC=<code> SET=<servo setpoint Hz> T=<common-timebase us>
+//                                    TEMP=<die C> VDDA=<mV>
+//   CH 1|2                        select PA1 or PA2 (what the PA0 button does)
+//   MODE EDGE|AUTO|PWM|RPM|TOTAL|RATE|COMP
+//                                 select the measurement mode
+//   COMP [1|2|3|4|DAC] [hyst 0-3] OK THR=<1-4|DAC> HYST=<n>, or set the COMP mode threshold
+//                                 (quarters of VREFINT, or the DAC output) and hysteresis
+//   COUNT [RESET | PPR <n> | GATE <ms>]
+//                                 OK N=<total> RATE=<per min> RPM=<0.1 rpm> (counting modes)
+//   AVG <0-8>                     averaging: 2^n edge-mode filter and 2^n longer auto-range gates
+//   CAP [NONE|ABOVE|BELOW|STEP] [threshold] [pre] [post]
+//                                 arm the logger (the capture is dumped on the trace output)
+//   CAP?                          OK STATE=<log_state> WORDS=<n>
+//   STATS [RESET]                 OK N=<n> FMIN=<Hz> FMAX=<Hz> FAVG=<Hz> DROP=<n> LOST=<n>
+//   CAL                           OK GAIN=<Q16> OFFSET=<ohm> PPM=<ppm> CLK=<Hz>
+//   CAL POT LO|HI <ohms> | CAL POT RESET
+//                                 two-point potentiometer calibration: set the pot to a known low
+//                                 resistance, LO, then a known high one, HI (stored in flash)
+//   DAC POT | DAC LIN|LOG|SERVO <lo Hz> <hi Hz>
+//                                 drive PA4 from the potentiometer, the measured frequency,
+//                                 or the PI servo (setpoint = potentiometer position across the span)
+//   PI <kp> <ki>                  servo gains, Q16 DAC codes per Hz of error
+//   SYNC [OFF|MASTER|SLAVE]       OK ROLE=<r> LOCK=<0|1> PPM=<drift> OFS=<us>, or pick the sync role
+//   ADC [EVENT|POLL]              OK EVENT=<0|1> AWD=<watchdog interrupts>, or pick how PA5 is read
+//   REC [EDGE|ADC|ALL|OFF]        OK FLAGS=<rec_flags> DROP=<n>, or start/stop streaming raw records
+//                                 (REC OFF replies OK DROP=<n> and ends the stream with a REC_DROP trailer)
+//   CLK [AUTO|8|24|48]            OK MHZ=<n> AUTO=<0|1>, or pin the system clock
+//   VIEW MAIN | VIEW FFT [rate Hz] | VIEW REPLAY
+//                                 OLED readout, PA5 spectrum, or step through the last capture
+//                                 (one record per MAIN_LOOP_MS, then back to MAIN)
+//
+
+//function to split the next space-separated token off a command line, NULL when there is none
+static char *cmd_token(char **cursor){
+
+	char *p = *cursor;
+
+	while (*p == ' ') {
+		p++;
+	}
+	if (*p == '\0') {
+		*cursor = p;
+		return NULL;
+	}
+
+	char *token = p;
+	while (*p != ' ' && *p != '\0') {
+		p++;
+	}
+	if (*p == ' ') {
+		*p++ = '\0';
+	}
+	*cursor = p;
+
+	return token;
+}
+
+//function to parse a decimal argument (up to 9 digits), returns 0 if the token is missing or not a number
+static int cmd_number(const char *token, uint32_t *value){
+
+	uint32_t v = 0;
+
+	if (token == NULL || *token == '\0') {
+		return 0;
+	}
+	while (*token != '\0') {
+		if (*token < '0' || *token > '9' || v >= 100000000) {
+			return 0;
+		}
+		v = v * 10 + (uint32_t)(*token++ - '0');
+	}
+
+	*value = v;
+	return 1;
+}
+
+//function to collect received bytes into lines and execute each complete one.
+//Only the DMA write position is read here, so a partial line simply waits for the next call.
+void cmd_poll(void){
+
+	uint16_t head = (CMD_RX_LEN - DMA1_Channel3->CNDTR) & (CMD_RX_LEN - 1);
+
+	while (cmd_rx_tail != head) {
+		char c = (char)cmd_rx_ring[cmd_rx_tail];
+		cmd_rx_tail = (cmd_rx_tail + 1) & (CMD_RX_LEN - 1);
+
+		if (c == '\r' || c == '\n') {
+			if (cmd_line_long != 0) {
+				cmd_Write_String("ERR line too long");
+				cmd_Send();
+			} else if (cmd_line_len != 0) {
+				cmd_line[cmd_line_len] = '\0';
+				cmd_execute(cmd_line);
+			}
+			cmd_line_len = 0;
+			cmd_line_long = 0;
+		} else if (cmd_line_len < CMD_LINE_LEN - 1) {
+			if (c >= 'a' && c <= 'z') {
+				c -= 'a' - 'A';
+			}
+			cmd_line[cmd_line_len++] = c;
+		} else {
+			cmd_line_long = 1;
+		}
+	}
+}
+
+//function to run one command line and send its reply
+void cmd_execute(char *line){
+
+	char *cursor = line;
+
+	clk_activity = 1; //someone is talking to the unit, keep it responsive
+
+	char *cmd = cmd_token(&cursor);
+	char *arg = cmd_token(&cursor);
+	uint32_t value;
+
+	if (cmd == NULL) {
+		cmd_Write_String("ERR empty line");
+	} else if (strcmp(cmd, "READ") == 0) {
+		cmd_Write_String("OK MODE=");
+		cmd_Write_Uint(meas_mode);
+		cmd_Write_String(" CH=");
+		cmd_Write_Uint(input_line);
+		cmd_Write_String(" F=");
+		cmd_Write_Uint(Freq);
+		cmd_Write_String(" R=");
+		cmd_Write_Uint(Res);
+		cmd_Write_String(" DUTY=");
+		cmd_Write_Uint(Duty);
+		cmd_Write_String(" GATE=");
+		cmd_Write_Uint(meas_time_us);
+		cmd_Write_String(" PPM=");
+		cmd_Write_Uint(meas_ppm);
+		cmd_Write_String(" DAC=");
+		cmd_Write_Uint(DAC->DHR12R1);
+		cmd_Write_String(" SET=");
+		cmd_Write_Uint(pi_setpoint);
+		cmd_Write_String(" T=");
+		cmd_Write_Uint64(sync_to_common(meas_stamp));
+		cmd_Write_String(" TEMP=");
+		cmd_Write_Int(Temp);
+		cmd_Write_String(" VDDA=");
+		cmd_Write_Uint(VDDA_mV);
+	} else if (strcmp(cmd, "CH") == 0) {
+		if (!cmd_number(arg, &value) || value < 1 || value > 2) {
+			cmd_Write_String("ERR CH 1|2");
+		} else {
+			__disable_irq(); //the button handler switches lines too
+			input_line = (uint16_t)value;
+			meas_route_input();
+			__enable_irq();
+			cmd_Write_String("OK");
+		}
+	} else if (strcmp(cmd, "MODE") == 0) {
+		uint16_t mode;
+		if (arg != NULL && strcmp(arg, "EDGE") == 0) {
+			mode = MEAS_MODE_EDGE;
+		} else if (arg != NULL && strcmp(arg, "AUTO") == 0) {
+			mode = MEAS_MODE_AUTORANGE;
+		} else if (arg != NULL && strcmp(arg, "PWM") == 0) {
+			mode = MEAS_MODE_PWM;
+		} else if (arg != NULL && strcmp(arg, "RPM") == 0) {
+			mode = MEAS_MODE_RPM;
+		} else if (arg != NULL && strcmp(arg, "TOTAL") == 0) {
+			mode = MEAS_MODE_TOTAL;
+		} else if (arg != NULL && strcmp(arg, "RATE") == 0) {
+			mode = MEAS_MODE_RATE;
+		} else if (arg != NULL && strcmp(arg, "COMP") == 0) {
+			mode = MEAS_MODE_COMP;
+		} else {
+			cmd_Write_String("ERR MODE EDGE|AUTO|PWM|RPM|TOTAL|RATE|COMP");
+			cmd_Send();
+			return;
+		}
+
+		if (meas_mode == MEAS_MODE_PWM && mode != MEAS_MODE_PWM) {
+			oled_Set_Cursor(0); //only the PWM page layout uses pages 0 and 7
+			oled_Clear_To_End();
+			oled_Set_Cursor(7);
+			oled_Clear_To_End();
+		}
+		__disable_irq(); //no capture may land while TIM2 is reconfigured
+		meas_set_mode(mode);
+		__enable_irq();
+		rec_header();
+		Freq = 0;
+		cmd_Write_String("OK");
+	} else if (strcmp(cmd, "AVG") == 0) {
+		if (!cmd_number(arg, &value) || value > MEAS_AVG_SHIFT_MAX) {
+			cmd_Write_String("ERR AVG 0-8");
+		} else {
+			meas_avg_shift = (uint16_t)value;
+			cmd_Write_String("OK");
+		}
+	} else if (strcmp(cmd, "CAP?") == 0) {
+		cmd_Write_String("OK STATE=");
+		cmd_Write_Uint(log_state);
+		cmd_Write_String(" WORDS=");
+		cmd_Write_Uint(log_count);
+	} else if (strcmp(cmd, "CAP") == 0) {
+		uint16_t trigger = LOG_TRIG_NONE;
+		uint32_t threshold = 0;
+		uint32_t pre = LOG_WORDS / 2;
+		uint32_t post = LOG_WORDS / 2;
+
+		if (arg != NULL) {
+			if (strcmp(arg, "ABOVE") == 0) {
+				trigger = LOG_TRIG_FREQ_ABOVE;
+			} else if (strcmp(arg, "BELOW") == 0) {
+				trigger = LOG_TRIG_FREQ_BELOW;
+			} else if (strcmp(arg, "STEP") == 0) {
+				trigger = LOG_TRIG_RES_STEP;
+			} else if (strcmp(arg, "NONE") != 0) {
+				cmd_Write_String("ERR CAP NONE|ABOVE|BELOW|STEP");
+				cmd_Send();
+				return;
+			}
+		}
+		//missing numbers keep their defaults
+		arg = cmd_token(&cursor);
+		if (arg != NULL && cmd_number(arg, &threshold)) {
+			arg = cmd_token(&cursor);
+			if (arg != NULL && cmd_number(arg, &pre)) {
+				cmd_number(cmd_token(&cursor), &post);
+			}
+		}
+
+		log_arm(trigger, threshold, (uint16_t)(pre < LOG_WORDS ? pre : LOG_WORDS),
+				(uint16_t)(post < LOG_WORDS ? post : LOG_WORDS));
+		cmd_Write_String("OK");
+	} else if (strcmp(cmd, "STATS") == 0) {
+		if (arg != NULL && strcmp(arg, "RESET") == 0) {
+			stats_reset();
+			cmd_Write_String("OK");
+		} else {
+			__disable_irq(); //take all statistics from the same instant
+			uint32_t n = stat_n;
+			uint32_t shortest = stat_min;
+			uint32_t longest = stat_max;
+			uint64_t sum = stat_sum;
+			__enable_irq();
+
+			cmd_Write_String("OK N=");
+			cmd_Write_Uint(n);
+			cmd_Write_String(" FMIN=");
+			cmd_Write_Uint(longest != 0 ? timer_clock / longest : 0);
+			cmd_Write_String(" FMAX=");
+			cmd_Write_Uint(shortest != 0 ? timer_clock / shortest : 0);
+			cmd_Write_String(" FAVG=");
+			cmd_Write_Uint(sum != 0 ? (uint32_t)(((uint64_t)timer_clock * n) / sum) : 0);
+			cmd_Write_String(" DROP=");
+			cmd_Write_Uint(edge_dropped);
+			cmd_Write_String(" LOST=");
+			cmd_Write_Uint(lat_missed);
+		}
+	} else if (strcmp(cmd, "CAL") == 0 && arg != NULL) {
+		char *point = cmd_token(&cursor);
+
+		if (strcmp(arg, "POT") != 0 || point == NULL) {
+			cmd_Write_String("ERR CAL POT LO|HI <ohms> | CAL POT RESET");
+		} else if (strcmp(point, "RESET") == 0) {
+			cal.pot_gain = CAL_GAIN_ONE;
+			cal.pot_offset = 0;
+			cal_pot_have_lo = 0;
+			cmd_Write_String(cal_save() == 0 ? "OK" : "ERR flash");
+		} else if (!cmd_number(cmd_token(&cursor), &value)) {
+			cmd_Write_String("ERR CAL POT LO|HI <ohms>");
+		} else if (strcmp(point, "LO") == 0) {
+			cal_pot_raw_lo = POT_val;
+			cal_pot_ohms_lo = value;
+			cal_pot_have_lo = 1;
+			cmd_Write_String("OK RAW=");
+			cmd_Write_Uint(cal_pot_raw_lo);
+		} else if (strcmp(point, "HI") != 0) {
+			cmd_Write_String("ERR CAL POT LO|HI <ohms>");
+		} else if (cal_pot_have_lo == 0) {
+			cmd_Write_String("ERR CAL POT LO first");
+		} else if (cal_pot_two_point(cal_pot_raw_lo, cal_pot_ohms_lo, POT_val, value) != 0) {
+			cmd_Write_String("ERR points not increasing");
+		} else {
+			//the flash erase stalls the CPU for a page erase time, edges meanwhile are timed late
+			cal_pot_have_lo = 0;
+			cmd_Write_String(cal_save() == 0 ? "OK GAIN=" : "ERR flash GAIN=");
+			cmd_Write_Uint(cal.pot_gain);
+			cmd_Write_String(" OFFSET=");
+			cmd_Write_Int(cal.pot_offset);
+		}
+	} else if (strcmp(cmd, "CAL") == 0) {
+		cmd_Write_String("OK GAIN=");
+		cmd_Write_Uint(cal.pot_gain);
+		cmd_Write_String(" OFFSET=");
+		cmd_Write_Int(cal.pot_offset);
+		cmd_Write_String(" PPM=");
+		cmd_Write_Int(cal.clk_ppm);
+		cmd_Write_String(" CLK=");
+		cmd_Write_Uint(timer_clock);
+	} else if (strcmp(cmd, "DAC") == 0) {
+		uint16_t source = 0xFFFF;
+		uint32_t lo = fv_lo;
+		uint32_t hi = fv_hi;
+
+		if (arg != NULL && strcmp(arg, "POT") == 0) {
+			source = DAC_OUT_POT;
+		} else if (arg != NULL && strcmp(arg, "LIN") == 0) {
+			source = DAC_OUT_FREQ_LIN;
+		} else if (arg != NULL && strcmp(arg, "LOG") == 0) {
+			source = DAC_OUT_FREQ_LOG;
+		} else if (arg != NULL && strcmp(arg, "SERVO") == 0) {
+			source = DAC_OUT_SERVO;
+		}
+		//a missing span keeps the current one
+		if (cmd_number(cmd_token(&cursor), &lo)) {
+			cmd_number(cmd_token(&cursor), &hi);
+		}
+
+		if (fv_config(source, lo, hi)) {
+			cmd_Write_String("OK");
+		} else {
+			cmd_Write_String("ERR DAC POT|LIN|LOG|SERVO <lo> <hi>");
+		}
+	} else if (strcmp(cmd, "COUNT") == 0) {
+		if (arg == NULL) {
+			__disable_irq();
+			uint64_t total = cnt_total;
+			__enable_irq();
+
+			cmd_Write_String("OK N=");
+			cmd_Write_Uint64(total);
+			cmd_Write_String(" RATE=");
+			cmd_Write_Uint(cnt_per_min);
+			cmd_Write_String(" RPM=");
+			cmd_Write_Uint(cnt_rpm10);
+		} else if (strcmp(arg, "RESET") == 0) {
+			cnt_reset();
+			cmd_Write_String("OK");
+		} else if (strcmp(arg, "PPR") == 0 && cmd_number(cmd_token(&cursor), &value)
+				&& value >= 1 && value <= 0xFFFF) {
+			cnt_ppr = (uint16_t)value;
+			cmd_Write_String("OK");
+		} else if (strcmp(arg, "GATE") == 0 && cmd_number(cmd_token(&cursor), &value)
+				&& value >= COUNT_READ_MS && value <= 60000) {
+			__disable_irq(); //restart the gate at the new length
+			cnt_gate_ms = (uint16_t)(value - value % COUNT_READ_MS);
+			cnt_gate_pulses = 0;
+			cnt_gate_reads = 0;
+			__enable_irq();
+			cmd_Write_String("OK");
+		} else {
+			cmd_Write_String("ERR COUNT [RESET|PPR n|GATE ms]");
+		}
+	} else if (strcmp(cmd, "COMP") == 0) {
+		uint16_t threshold = comp_threshold;
+		uint32_t hysteresis = comp_hysteresis;
+		uint16_t ok = 1;
+		char *hyst_arg = cmd_token(&cursor);
+
+		if (arg != NULL) {
+			if (strcmp(arg, "DAC") == 0) {
+				threshold = COMP_THR_DAC;
+			} else if (cmd_number(arg, &value) && value >= 1 && value <= 4) {
+				threshold = (uint16_t)(value - 1); //n quarters of VREFINT
+			} else {
+				ok = 0;
+			}
+		}
+		if (hyst_arg != NULL && (!cmd_number(hyst_arg, &hysteresis) || hysteresis > 3)) {
+			ok = 0;
+		}
+
+		if (ok == 0) {
+			cmd_Write_String("ERR COMP [1|2|3|4|DAC] [0-3]");
+		} else {
+			__disable_irq(); //meas_set_mode writes the same register
+			comp_config(threshold, (uint16_t)hysteresis);
+			__enable_irq();
+			cmd_Write_String("OK THR=");
+			if (comp_threshold == COMP_THR_DAC) {
+				cmd_Write_String("DAC");
+			} else {
+				cmd_Write_Uint(comp_threshold + 1);
+			}
+			cmd_Write_String(" HYST=");
+			cmd_Write_Uint(comp_hysteresis);
+		}
+	} else if (strcmp(cmd, "ADC") == 0) {
+		if (arg == NULL) {
+			cmd_Write_String("OK EVENT=");
+			cmd_Write_Uint(adc_event);
+			cmd_Write_String(" AWD=");
+			cmd_Write_Uint(adc_awd_events);
+		} else if (strcmp(arg, "EVENT") == 0) {
+			adc_event = 1;
+			adc_awd_hit = 1; //take a reading now, which arms the window
+			cmd_Write_String("OK");
+		} else if (strcmp(arg, "POLL") == 0) {
+			adc_event = 0;
+			ADC1->IER &= ~(ADC_IER_AWDIE);
+			cmd_Write_String("OK");
+		} else {
+			cmd_Write_String("ERR ADC [EVENT|POLL]");
+		}
+	} else if (strcmp(cmd, "REC") == 0) {
+		if (arg == NULL) {
+			cmd_Write_String("OK FLAGS=");
+			cmd_Write_Uint(rec_flags);
+			cmd_Write_String(" DROP=");
+			cmd_Write_Uint(rec_dropped);
+		} else if (strcmp(arg, "EDGE") == 0 || strcmp(arg, "ADC") == 0 || strcmp(arg, "ALL") == 0) {
+			if (strcmp(arg, "EDGE") == 0) {
+				rec_flags = REC_EDGES;
+			} else if (strcmp(arg, "ADC") == 0) {
+				rec_flags = REC_ADC_PASSES;
+			} else {
+				rec_flags = REC_EDGES | REC_ADC_PASSES;
+			}
+			__disable_irq(); //the edge ISRs count drops too
+			rec_dropped = 0; //each recording reports its own losses
+			__enable_irq();
+			rec_dropped_sent = 0;
+			rec_closing = 0;
+			rec_header();
+			cmd_Write_String("OK");
+		} else if (strcmp(arg, "OFF") == 0) {
+			rec_flags = 0; //what is still queued goes out, then the trailer
+			rec_closing = 1;
+			cmd_Write_String("OK DROP=");
+			cmd_Write_Uint(rec_dropped);
+		} else {
+			cmd_Write_String("ERR REC [EDGE|ADC|ALL|OFF]");
+		}
+	} else if (strcmp(cmd, "SYNC") == 0) {
+		if (arg == NULL) {
+			uint64_t local = sync_local_now();
+			int64_t offset = (int64_t)(sync_to_common(local) - local);
+			int32_t ppm = (int32_t)(((int64_t)sync_rate - SYNC_RATE_ONE) * 1000000 / SYNC_RATE_ONE);
+
+			cmd_Write_String("OK ROLE=");
+			cmd_Write_Uint(sync_role);
+			cmd_Write_String(" LOCK=");
+			cmd_Write_Uint(sync_locked);
+			cmd_Write_String(" PPM=");
+			cmd_Write_Int(ppm);
+			cmd_Write_String(" OFS=");
+			cmd_Write_Int((offset > 2000000000 || offset < -2000000000) ? 0 : (int32_t)offset);
+		} else if (strcmp(arg, "OFF") == 0) {
+			sync_set_role(SYNC_OFF);
+			cmd_Write_String("OK");
+		} else if (strcmp(arg, "MASTER") == 0) {
+			sync_set_role(SYNC_MASTER);
+			cmd_Write_String("OK");
+		} else if (strcmp(arg, "SLAVE") == 0) {
+			sync_set_role(SYNC_SLAVE);
+			cmd_Write_String("OK");
+		} else {
+			cmd_Write_String("ERR SYNC [OFF|MASTER|SLAVE]");
+		}
+	} else if (strcmp(cmd, "CLK") == 0) {
+		if (arg == NULL) {
+			cmd_Write_String("OK MHZ=");
+			cmd_Write_Uint(SystemCoreClock / 1000000);
+			cmd_Write_String(" AUTO=");
+			cmd_Write_Uint(clk_auto);
+		} else if (strcmp(arg, "AUTO") == 0) {
+			clk_auto = 1;
+			cmd_Write_String("OK");
+		} else if (cmd_number(arg, &value) && (value == 8 || value == 24 || value == 48) && fft_state == 0) {
+			clk_auto = 0;
+			cmd_Write_String("OK");
+			cmd_Send(); //reply at the current baud rate, before it is re-derived
+			while (DMA1_Channel2->CNDTR != 0 || (USART1->ISR & USART_ISR_TC) == 0){};
+			clk_set((value == 48) ? CLK_LEVEL_48MHZ : (value == 24) ? CLK_LEVEL_24MHZ : CLK_LEVEL_8MHZ);
+			return;
+		} else {
+			cmd_Write_String("ERR CLK [AUTO|8|24|48]");
+		}
+	} else if (strcmp(cmd, "VIEW") == 0) {
+		if (arg != NULL && strcmp(arg, "MAIN") == 0) {
+			if (oled_view != VIEW_MAIN) {
+				oled_view = VIEW_MAIN;
+				oled_Begin_Frame(); //blank frame, refresh_OLED only draws its own pages
+				oled_End_Frame();
+			}
+			cmd_Write_String("OK");
+		} else if (arg != NULL && strcmp(arg, "FFT") == 0) {
+			uint32_t rate = fft_rate;
+			cmd_number(cmd_token(&cursor), &rate);
+			if (rate < 100 || rate > FFT_RATE_MAX) {
+				cmd_Write_String("ERR rate 100-40000");
+			} else {
+				fft_rate = rate; //takes effect with the next capture
+				oled_view = VIEW_SPECTRUM;
+				cmd_Write_String("OK");
+			}
+		} else if (arg != NULL && strcmp(arg, "REPLAY") == 0) {
+			if (log_replay_start() != 0) {
+				cmd_Write_String("ERR no finished capture");
+			} else {
+				oled_view = VIEW_REPLAY;
+				oled_Begin_Frame(); //blank frame, the replay only draws pages 0 and 7
+				oled_End_Frame();
+				cmd_Write_String("OK WORDS=");
+				cmd_Write_Uint(log_count);
+			}
+		} else {
+			cmd_Write_String("ERR VIEW MAIN|FFT [rate]|REPLAY");
+		}
+	} else if (strcmp(cmd, "PI") == 0) {
+		uint32_t kp, ki;
+		if (!cmd_number(arg, &kp) || !cmd_number(cmd_token(&cursor), &ki)) {
+			cmd_Write_String("ERR PI <kp> <ki>");
+		} else {
+			__disable_irq(); //the controller reads both gains in one step
+			pi_kp = kp;
+			pi_ki = ki;
+			__enable_irq();
+			cmd_Write_String("OK");
+		}
+	} else {
+		cmd_Write_String("ERR unknown command");
+	}
+
+	cmd_Send();
+}
+
+//Function to append a zero-terminated string to the reply, truncating at CMD_TX_LEN
+void cmd_Write_String(const char *s){
+
+	while (*s != '\0' && cmd_tx_len < CMD_TX_LEN - 2) {
+		cmd_tx[cmd_tx_buf][cmd_tx_len++] = *s++;
+	}
+}
+
+//Function to append one character to the reply
+void cmd_Write_Char(unsigned char c){
+
+	if (cmd_tx_len < CMD_TX_LEN - 2) {
+		cmd_tx[cmd_tx_buf][cmd_tx_len++] = (char)c;
+	}
+}
+
+//Function to append an unsigned decimal to the reply
+void cmd_Write_Uint(uint32_t value){
+
+	fmt_uint(cmd_Write_Char, value, 0);
+}
+
+//Function to append a 64-bit unsigned decimal to the reply
+void cmd_Write_Uint64(uint64_t value){
+
+	fmt_uint64(cmd_Write_Char, value);
+}
+
+//Function to append a signed decimal to the reply
+void cmd_Write_Int(int32_t value){
+
+	if (value < 0) {
+		cmd_Write_String("-");
+		cmd_Write_Uint((uint32_t)0 - (uint32_t)value);
+	} else {
+		cmd_Write_Uint((uint32_t)value);
+	}
+}
+
+//Function to terminate the assembled reply and start its transfer. Only waits if the
+//previous reply is still going out, which takes at most CMD_TX_LEN characters.
+void cmd_Send(void){
+
+	cmd_tx[cmd_tx_buf][cmd_tx_len++] = '\r';
+	cmd_tx[cmd_tx_buf][cmd_tx_len++] = '\n';
+
+	while (DMA1_Channel2->CNDTR != 0){}; //previous reply still being transmitted
+
+	DMA1_Channel2->CCR &= ~DMA_CCR_EN;
+	DMA1_Channel2->CMAR = (uint32_t)cmd_tx[cmd_tx_buf];
+	DMA1_Channel2->CNDTR = cmd_tx_len;
+	DMA1_Channel2->CCR |= DMA_CCR_EN;
+
+	cmd_tx_buf ^= 1; //assemble the next reply in the other buffer
+	cmd_tx_len = 0;
+}
+
+//
+// Trace recorder: raw edge timestamps and ADC_reader inputs streamed on USART1 as fixed
+// REC_SIZE-byte records, between (never inside) the text reply lines, so a host can store
+// them as a replay corpus. Each record starts with REC_SYNC; a REC_HEADER gives the mode and
+// the timer clock the following counts are in. The time field is the low 32 bits of the
+// common (sync master) timebase in us when the record was queued, so it wraps every 71 min.
+// rec_put stores the local TIM17 time, cheap enough for the edge ISRs; rec_flush converts it
+// to common time in the main loop just before the record goes out.
+//
+// At CMD_BAUD one record takes 1.04 ms on the wire, so the stream is complete up to about
+// 960 records per second (edges in EDGE mode, captures in AUTO/COMP, plus one REC_ADC per
+// main loop pass). Beyond that the ring fills, records are dropped and counted, and a REC_DROP
+// carries the running total. REC OFF always ends the stream with a REC_DROP trailer (aux = 1),
+// so a recording can be trusted if it ends in a trailer whose value is 0.
+//
+// This is the on-target half of the replay corpus only: the tree has no host build, so the
+// harness that feeds recorded files back through the edge handlers and ADC_reader is not here.
+//
+
+//function to queue one record, from the edge ISRs or the main loop. A full ring drops the record
+//and counts it, except a REC_DROP, which rec_flush simply retries.
+int rec_put(uint16_t type, uint16_t aux, uint32_t value){
+
+	int queued = 0;
+
+	uint32_t local = (uint32_t)sync_local_now();
+	uint32_t primask = __get_PRIMASK(); //the main loop must not be preempted half-way
+	__disable_irq();
+
+	uint16_t head = rec_head;
+	uint16_t next = head + REC_SIZE;
+	if (next >= REC_LEN) {
+		next = 0;
+	}
+
+	if (next == rec_tail) {
+		if (type != REC_DROP) {
+			rec_dropped++;
+		}
+		queued = -1;
+	} else {
+		uint8_t *r = &rec_ring[head];
+		r[0] = REC_SYNC;
+		r[1] = (uint8_t)type;
+		r[2] = (uint8_t)aux;
+		r[3] = (uint8_t)(aux >> 8);
+		r[4] = (uint8_t)value;
+		r[5] = (uint8_t)(value >> 8);
+		r[6] = (uint8_t)(value >> 16);
+		r[7] = (uint8_t)(value >> 24);
+		r[8] = (uint8_t)local;
+		r[9] = (uint8_t)(local >> 8);
+		r[10] = (uint8_t)(local >> 16);
+		r[11] = (uint8_t)(local >> 24);
+		rec_head = next;
+	}
+
+	__set_PRIMASK(primask);
+	return queued;
+}
+
+//function to record the mode and timer clock the following records are in
+void rec_header(void){
+
+	if (rec_flags != 0) {
+		rec_put(REC_HEADER, meas_mode, timer_clock);
+	}
+}
+
+//function to send queued records whenever the transmit DMA is idle (replies share it).
+//The ring is read in place, up to its end; what wraps goes out in the next transfer.
+void rec_flush(void){
+
+	if (DMA1_Channel2->CNDTR != 0) {
+		return; //a reply or the previous chunk is still going out
+	}
+
+	//the last chunk has been sent (cmd_Send also waits for it), so its bytes are free again
+	rec_tail = rec_tail + rec_inflight;
+	if (rec_tail >= REC_LEN) {
+		rec_tail = 0;
+	}
+	rec_inflight = 0;
+
+	//running total, so a REC_DROP that has to wait for room loses nothing
+	uint32_t dropped = rec_dropped;
+	if ((dropped != rec_dropped_sent || rec_closing != 0) && rec_put(REC_DROP, rec_closing, dropped) == 0) {
+		rec_dropped_sent = dropped;
+		rec_closing = 0;
+	}
+
+	uint16_t head = rec_head;
+	if (head == rec_tail) {
+		return;
+	}
+
+	uint16_t len = (head > rec_tail) ? head - rec_tail : REC_LEN - rec_tail;
+
+	//local to common time, in place: rec_put only ever writes past rec_head
+	uint64_t now = sync_local_now();
+	for (uint16_t i = rec_tail; i < rec_tail + len; i += REC_SIZE) {
+		uint8_t *t = &rec_ring[i + 8];
+		uint32_t stamp = t[0] | ((uint32_t)t[1] << 8) | ((uint32_t)t[2] << 16) | ((uint32_t)t[3] << 24);
+		uint32_t common = (uint32_t)sync_to_common(now - (uint32_t)((uint32_t)now - stamp));
+		t[0] = (uint8_t)common;
+		t[1] = (uint8_t)(common >> 8);
+		t[2] = (uint8_t)(common >> 16);
+		t[3] = (uint8_t)(common >> 24);
+	}
+
+	DMA1_Channel2->CCR &= ~DMA_CCR_EN;
+	DMA1_Channel2->CMAR = (uint32_t)&rec_ring[rec_tail];
+	DMA1_Channel2->CNDTR = len;
+	DMA1_Channel2->CCR |= DMA_CCR_EN;
+
+	rec_inflight = len;
+}
+
+//function to read input values from potentiometer and set to output of DAC
+void ADC_reader(){
+
+	uint32_t pot_sum = 0;
+	uint32_t temp_sum = 0;
+	uint32_t vref_sum = 0;
+
+	if (fft_state == 0 && (++adc_recal_timer >= ADC_RECAL_INTERVAL || adc_recal_state != 0)) {
+		ADC_recal_step();
+	}
+
+	//event mode: while PA5 stays inside the watchdog window there is nothing new to compute
+	if (adc_event != 0 && adc_awd_hit == 0 && adc_awd_idle < ADC_AWD_REFRESH) {
+		adc_awd_idle++;
+		return;
+	}
+	adc_awd_hit = 0;
+	adc_awd_idle = 0;
+
+	//the DMA keeps the ring full in the background, so there is nothing to wait for here
+	for (uint16_t i = 0; i < ADC_OVERSAMPLE * ADC_SEQ_LEN; i += ADC_SEQ_LEN) {
+		pot_sum += adc_samples[i + ADC_SEQ_POT];
+		temp_sum += adc_samples[i + ADC_SEQ_TEMP];
+		vref_sum += adc_samples[i + ADC_SEQ_VREF];
+	}
+
+	if (vref_sum == 0) {
+		adc_awd_hit = 1; //first scan not complete yet, read again on the next pass
+		return;
+	}
+
+	if (adc_event != 0) {
+		ADC_awd_centre(pot_sum / ADC_OVERSAMPLE); //the value accepted now is the new window centre
+	}
+
+	if ((rec_flags & REC_ADC_PASSES) != 0) {
+		rec_put(REC_ADC, (uint16_t)vref_sum, (temp_sum << 16) | pot_sum); //sums of ADC_OVERSAMPLE 12-bit scans fit 16 bits
+	}
+
+	if (dac_source == DAC_OUT_POT) {
+		DAC->DHR12R1 = pot_sum / ADC_OVERSAMPLE; //write the averaged ADC value to the DAC
+	}
+
     //We will want the potentiometer parameters to print to the screen, this processes and populated those variables
 
-	POT_val = (ADC1->DR & ADC_DR_DATA);//read out the group conversion data to global variable ( & ADC_DR_DATA)
+	VDDA_mV = (VDDA_NOMINAL * FACTORY_VREFINT_CAL * ADC_OVERSAMPLE) / vref_sum;
+
+	POT_val = ADC_compensate(pot_sum / ADC_OVERSAMPLE, vref_sum / ADC_OVERSAMPLE);
+
+	//temperature sensor slope from the two factory points, both taken at 3.3V
+	int32_t ts = (int32_t)ADC_compensate(temp_sum / ADC_OVERSAMPLE, vref_sum / ADC_OVERSAMPLE);
+	Temp = ((ts - FACTORY_TS_CAL1) * (110 - 30)) / (FACTORY_TS_CAL2 - FACTORY_TS_CAL1) + 30;
+
+	//position (resistance value), corrected by the per-unit gain and offset
+	int32_t ohms = (int32_t)(((POT_val * POT_FULL_SCALE) / ADC_FULL_SCALE * cal.pot_gain) >> 16) + cal.pot_offset;
+	Res = (ohms > 0) ? (unsigned int)ohms : 0;
+
+	//servo setpoint: the potentiometer position across the configured span
+	pi_setpoint = fv_lo + (uint32_t)(((uint64_t)POT_val * (fv_hi - fv_lo)) / ADC_FULL_SCALE);
+
+	log_adc(pot_sum / ADC_OVERSAMPLE); //raw (uncompensated) sample, as driven onto the DAC
+
+}
+
+//function to put the analog watchdog window around the last accepted PA5 reading and re-arm it
+void ADC_awd_centre(uint32_t raw){
+
+	uint32_t low = (raw > ADC_AWD_WINDOW) ? raw - ADC_AWD_WINDOW : 0;
+	uint32_t high = (raw + ADC_AWD_WINDOW < ADC_FULL_SCALE) ? raw + ADC_AWD_WINDOW : ADC_FULL_SCALE;
+
+	ADC1->TR = (high << ADC_TR_HT_Pos) | low;
+	ADC1->ISR = ADC_ISR_AWD; //drop a flag raised against the old window
+	ADC1->IER |= ADC_IER_AWDIE;
+}
+
+//function to rescale a raw reading taken at the measured supply to what it would read at 3.3V
+uint32_t ADC_compensate(uint32_t raw, uint32_t vref_raw){
+
+	//VDDA / 3.3V = VREFINT_CAL / vref_raw, so the ratio cancels the supply out of the reading
+	uint32_t scaled = (raw * FACTORY_VREFINT_CAL) / vref_raw;
+
+	return (scaled > ADC_FULL_SCALE) ? ADC_FULL_SCALE : scaled;
+}
+
+//function to recalibrate the ADC in the background, one step per call so the main loop never blocks.
+//The DMA ring and the DAC simply hold their last values while the ADC is offline. ADSTP can land
+//mid-sequence, so the ring is realigned to channel 5 before the scan restarts.
+void ADC_recal_step(){
+
+	switch (adc_recal_state) {
+	case 0: //stop the ongoing conversions
+		ADC1->CR |= ADC_CR_ADSTP;
+		adc_recal_state = 1;
+		break;
+	case 1: //disable the ADC once the stop has taken effect
+		if ((ADC1->CR & ADC_CR_ADSTP) == 0) {
+			ADC1->CFGR1 &= ~ADC_CFGR1_DMAEN; //keep the calibration factor out of the DMA ring
+			ADC1->CR |= ADC_CR_ADDIS;
+			adc_recal_state = 2;
+		}
+		break;
+	case 2: //calibrate once the ADC is off
+		if ((ADC1->CR & ADC_CR_ADEN) == 0) {
+			ADC1->CR |= ADC_CR_ADCAL;
+			adc_recal_state = 3;
+		}
+		break;
+	case 3: //re-enable after calibration
+		if ((ADC1->CR & ADC_CR_ADCAL) == 0) {
+			ADC1->CFGR1 |= ADC_CFGR1_DMAEN;
+			ADC1->ISR = ADC_ISR_ADRDY; //clear the ready flag left over from the last enable
+			ADC1->CR |= ADC_CR_ADEN;
+			adc_recal_state = 4;
+		}
+		break;
+	default: //restart the scan sequence once ready
+		if ((ADC1->ISR & ADC_ISR_ADRDY) != 0) {
+			DMA1_Channel1->CCR &= ~DMA_CCR_EN;
+			DMA1_Channel1->CMAR = (uint32_t)adc_samples;
+			DMA1_Channel1->CNDTR = ADC_OVERSAMPLE * ADC_SEQ_LEN;
+			DMA1_Channel1->CCR |= DMA_CCR_EN;
+
+			ADC1->ISR = ADC_ISR_OVR;
+			ADC1->CR |= ADC_CR_ADSTART;
+			adc_recal_state = 0;
+			adc_recal_timer = 0;
+		}
+		break;
+	}
+}
+
+//
+// sin(2*pi*k/FFT_LEN) in Q15 for the first quarter wave, the FFT twiddles and the
+// Hann window are both read from it through fft_sin
+//
+static const int16_t fft_sin_table[FFT_LEN / 4 + 1] =
+{
+    0, 804, 1608, 2411, 3212, 4011, 4808, 5602, 6393,
+    7180, 7962, 8740, 9512, 10279, 11039, 11793, 12540, 13279,
+    14010, 14733, 15447, 16151, 16846, 17531, 18205, 18868, 19520,
+    20160, 20788, 21403, 22006, 22595, 23170, 23732, 24279, 24812,
+    25330, 25833, 26320, 26791, 27246, 27684, 28106, 28511, 28899,
+    29269, 29622, 29957, 30274, 30572, 30853, 31114, 31357, 31581,
+    31786, 31972, 32138, 32286, 32413, 32522, 32610, 32679, 32729,
+    32758, 32767
+};
+
+//function to look up sin(2*pi*k/FFT_LEN) in Q15 for any k, using the quarter-wave symmetry
+static int32_t fft_sin(uint32_t k){
+
+	k &= FFT_LEN - 1;
+
+	if (k <= FFT_LEN / 4) {
+		return fft_sin_table[k];
+	}
+	if (k <= FFT_LEN / 2) {
+		return fft_sin_table[FFT_LEN / 2 - k];
+	}
+	if (k <= 3 * FFT_LEN / 4) {
+		return -fft_sin_table[k - FFT_LEN / 2];
+	}
+	return -fft_sin_table[FFT_LEN - k];
+}
+
+//function to transform the FFT_LEN raw samples in fft_re into a spectrum, in place.
+//Radix-2 decimation in time in Q15. Every stage halves its outputs, so nothing can
+//overflow and the result is the DFT divided by FFT_LEN. The M0 multiplies in one cycle
+//but has no multiply-accumulate, so each butterfly is four plain multiplies.
+void fft_run(void){
+
+	int32_t sum = 0;
+	uint32_t i, j;
+
+	//remove the DC level and apply a Hann window, 12-bit samples become Q15
+	for (i = 0; i < FFT_LEN; i++) {
+		sum += (uint16_t)fft_re[i];
+	}
+	int32_t mean = sum >> FFT_LOG2_LEN;
+
+	for (i = 0; i < FFT_LEN; i++) {
+		int32_t x = ((int32_t)(uint16_t)fft_re[i] - mean) << 3;
+		int32_t w = (32767 - fft_sin(i + FFT_LEN / 4)) >> 1; //(1 - cos) / 2
+		fft_re[i] = (int16_t)((x * w) >> 15);
+		fft_im[i] = 0;
+	}
+
+	//bit-reversed reordering
+	for (i = 1, j = 0; i < FFT_LEN; i++) {
+		uint32_t bit = FFT_LEN >> 1;
+		while ((j & bit) != 0) {
+			j ^= bit;
+			bit >>= 1;
+		}
+		j |= bit;
+		if (i < j) {
+			int16_t t = fft_re[i];
+			fft_re[i] = fft_re[j];
+			fft_re[j] = t;
+		}
+	}
+
+	for (uint32_t len = 2; len <= FFT_LEN; len <<= 1) {
+		uint32_t half = len >> 1;
+		uint32_t step = FFT_LEN / len;
+
+		for (uint32_t k = 0; k < half; k++) {
+			int32_t wr = fft_sin(k * step + FFT_LEN / 4); //cos
+			int32_t wi = -fft_sin(k * step);
+
+			for (uint32_t a = k; a < FFT_LEN; a += len) {
+				uint32_t b = a + half;
+				int32_t tr = (fft_re[b] * wr - fft_im[b] * wi) >> 15;
+				int32_t ti = (fft_re[b] * wi + fft_im[b] * wr) >> 15;
+
+				fft_re[b] = (int16_t)((fft_re[a] - tr) >> 1);
+				fft_im[b] = (int16_t)((fft_im[a] - ti) >> 1);
+				fft_re[a] = (int16_t)((fft_re[a] + tr) >> 1);
+				fft_im[a] = (int16_t)((fft_im[a] + ti) >> 1);
+			}
+		}
+	}
+}
+
+//function to approximate the magnitude of bin k without a square root (max + 3/8 min, within 7%)
+uint32_t fft_mag(uint16_t k){
+
+	uint32_t re = (fft_re[k] < 0) ? -fft_re[k] : fft_re[k];
+	uint32_t im = (fft_im[k] < 0) ? -fft_im[k] : fft_im[k];
+
+	return (re > im) ? re + ((im * 3) >> 3) : im + ((re * 3) >> 3);
+}
+
+//function to advance the spectrum capture by as many steps as are ready, never blocking.
+//The PA5/temperature/VREFINT scan is suspended while TIM1 triggers FFT_LEN single PA5
+//conversions into fft_re, then restored; Res and the DAC hold their last values meanwhile.
+void fft_step(void){
+
+	for (;;) {
+		switch (fft_state) {
+		case 0: //stop the background scan (after any recalibration has finished)
+			if (oled_view != VIEW_SPECTRUM || adc_recal_state != 0) {
+				return;
+			}
+			ADC1->CR |= ADC_CR_ADSTP;
+			fft_state = 1;
+			break;
+		case 1: //retarget ADC and DMA at PA5 only, one conversion per TIM1 update
+			if ((ADC1->CR & ADC_CR_ADSTP) != 0) {
+				return;
+			}
+			ADC1->CHSELR = ADC_CHSELR_CHSEL5;
+			ADC1->CFGR1 &= ~(ADC_CFGR1_CONT | ADC_CFGR1_DMACFG | ADC_CFGR1_EXTSEL | ADC_CFGR1_EXTEN);
+			ADC1->CFGR1 |= ADC_CFGR1_EXTEN_0; //rising edge of TIM1_TRGO (EXTSEL = 0)
+
+			DMA1_Channel1->CCR &= ~DMA_CCR_EN;
+			DMA1->IFCR = DMA_IFCR_CGIF1;
+			DMA1_Channel1->CMAR = (uint32_t)fft_re;
+			DMA1_Channel1->CNDTR = FFT_LEN;
+			DMA1_Channel1->CCR = DMA_CCR_MINC | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0;
+			DMA1_Channel1->CCR |= DMA_CCR_EN;
+
+			ADC1->ISR = ADC_ISR_OVR; //an overrun left by the stop would block the DMA requests
+			ADC1->CR |= ADC_CR_ADSTART; //armed, converts on each trigger
+
+			TIM1->ARR = 1000000 / fft_rate - 1;
+			TIM1->CNT = 0;
+			TIM1->EGR = TIM_EGR_UG;
+			TIM1->CR1 |= TIM_CR1_CEN;
+			fft_state = 2;
+			break;
+		case 2: //wait for the last sample, then stop the trigger and the ADC
+			if ((DMA1->ISR & DMA_ISR_TCIF1) == 0) {
+				return;
+			}
+			TIM1->CR1 &= ~TIM_CR1_CEN;
+			ADC1->CR |= ADC_CR_ADSTP;
+			fft_state = 3;
+			break;
+		default: //restore the circular scan, then transform and draw
+			if ((ADC1->CR & ADC_CR_ADSTP) != 0) {
+				return;
+			}
+			ADC1->CHSELR = ADC_CHSELR_CHSEL5 | ADC_CHSELR_CHSEL16 | ADC_CHSELR_CHSEL17;
+			ADC1->CFGR1 &= ~(ADC_CFGR1_EXTSEL | ADC_CFGR1_EXTEN);
+			ADC1->CFGR1 |= ADC_CFGR1_CONT | ADC_CFGR1_DMACFG;
+
+			DMA1_Channel1->CCR &= ~DMA_CCR_EN;
+			DMA1_Channel1->CMAR = (uint32_t)adc_samples;
+			DMA1_Channel1->CNDTR = ADC_OVERSAMPLE * ADC_SEQ_LEN;
+			DMA1_Channel1->CCR = DMA_CCR_MINC | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_0 | DMA_CCR_CIRC;
+			DMA1_Channel1->CCR |= DMA_CCR_EN;
+
+			ADC1->ISR = ADC_ISR_OVR; //triggers after the last transfer may have overrun
+			ADC1->CR |= ADC_CR_ADSTART;
+			fft_state = 0;
+
+			fft_run();
+			if (oled_view == VIEW_SPECTRUM) {
+				fft_draw();
+			}
+			return;
+		}
+	}
+}
+
+//function to draw the spectrum as FFT_LEN/2 one-pixel bars (pages 1-7, 5 pixels per octave)
+//under a heading with the sample rate and the peak frequency
+void fft_draw(void){
+
+	uint32_t peak = 0;
+	uint16_t peak_bin = 0;
+
+	oled_Begin_Frame();
 
-	Res = ((((float)POT_val)/((float)(0xFFF)))*5000); //position (resistance value)
+	for (uint16_t k = 1; k < FFT_LEN / 2; k++) { //bin 0 is the removed DC level
+		uint32_t mag = fft_mag(k);
+		if (mag > peak) {
+			peak = mag;
+			peak_bin = k;
+		}
+
+		uint32_t height = (fv_log2(mag + 1) * FFT_PX_PER_OCTAVE) >> 16;
+		if (height > 56) {
+			height = 56;
+		}
+
+		//fill from the bottom of page 7 upwards, bit 7 is the lowest row of a page
+		for (uint16_t page = 7; page >= 1 && height != 0; page--) {
+			uint32_t rows = (height > 8) ? 8 : height;
+			oled_fb[page][k] = (unsigned char)(0xFF << (8 - rows));
+			height -= rows;
+		}
+	}
 
-    DAC->DHR12R1 = ADC1->DR; //write the ADC value to the DAC
+	oled_Set_Cursor(0);
+	oled_Write_String("Pk ");
+	oled_Write_SI((uint32_t)(((uint64_t)peak_bin * fft_rate) >> FFT_LOG2_LEN), "Hz");
 
+	oled_End_Frame();
 }
 
 //function to create a delay between commands
@@ -862,6 +4108,20 @@ void oled_Write_Data( unsigned char data )
 	GPIOB->BSRR = GPIO_BSRR_BS_6;
 }
 
+//Function to write several data bytes while CS# stays low
+void oled_Write_Data_Block( const unsigned char *data, uint16_t length )
+{
+	GPIOB->BSRR = GPIO_BSRR_BS_6; // make PB6 = CS# = 1
+	GPIOB->BSRR = GPIO_BSRR_BS_7; // make PB7 = D/C# = 1
+	GPIOB->BSRR = GPIO_BSRR_BR_6; // make PB6 = CS# = 0
+
+	while ((SPI1->SR & SPI_SR_TXE) == 0){}; //wait until transmit buffer empty flag is set
+	HAL_SPI_Transmit( &SPI_Handle, (uint8_t *)data, length, HAL_MAX_DELAY );
+	while ((SPI1->SR & SPI_SR_TXE) == 0){};
+
+	GPIOB->BSRR = GPIO_BSRR_BS_6; // make PB6 = CS# = 1
+}
+
 //Function called to write to OLED
 void oled_Write( unsigned char Value )
 {
@@ -899,27 +4159,171 @@ void oled_config( void )
     }
 
 
-    /* Fill LED Display data memory (GDDRAM) with zeros:
-       - for each PAGE = 0, 1, ..., 7
-           set starting SEG = 0
-           call oled_Write_Data( 0x00 ) 128 times
-    */
-    unsigned char page = 0xB0;
-    oled_Write_Cmd(0x02);
-    oled_Write_Cmd(0x10);
+    /* Fill LED Display data memory (GDDRAM) with zeros: a blank frame, one bulk transfer per page */
+    oled_Begin_Frame();
+    oled_End_Frame();
 
-    for(int i = 0; i <= 7; i++){
-    	oled_Write_Cmd(page);//select the page
-    	oled_Write_Cmd(0x02); //select first segment
-    	oled_Write_Cmd(0x10); //select first segment
+}
 
-    	for(int j = 0; j <=127; j++){
-    		oled_Write_Data(0x00); //write 8-bit value to the display (clearing it)
-    	}
+//Function to compute a CRC-32 (Ethernet polynomial) over a block of words
+uint32_t cal_crc(const uint32_t *data, uint32_t words)
+{
+	RCC->AHBENR |= RCC_AHBENR_CRCEN; //Enable the CRC calculation unit
 
-    	page++; //increment to next page
-    }
+	CRC->CR = CRC_CR_RESET; //reload the initial value 0xFFFFFFFF
+
+	for (uint32_t i = 0; i < words; i++) {
+		CRC->DR = data[i];
+	}
+
+	return CRC->DR;
+}
+
+//Function to derive the corrected timer clock from SystemCoreClock and the stored ppm error
+void cal_apply(void)
+{
+	int64_t correction = ((int64_t)SystemCoreClock * cal.clk_ppm) / 1000000;
+
+	timer_clock = (uint32_t)((int64_t)SystemCoreClock + correction);
+}
+
+//Function to load the calibration record from flash, falling back to defaults if it is missing or corrupt
+void cal_load(void)
+{
+	const cal_record_t *stored = (const cal_record_t *)CAL_FLASH_ADDR;
+	uint32_t words = (sizeof(cal_record_t) / 4) - 1; //everything but the crc field
+
+	if (stored->magic == CAL_MAGIC && stored->version == CAL_VERSION
+			&& stored->crc == cal_crc((const uint32_t *)stored, words)
+			&& stored->clk_ppm <= CAL_PPM_LIMIT && stored->clk_ppm >= -CAL_PPM_LIMIT) {
+		cal = *stored;
+	} else {
+		//erased page (all 0xFF), old layout or damaged record: run uncalibrated
+		cal.magic = CAL_MAGIC;
+		cal.version = CAL_VERSION;
+		cal.pot_gain = CAL_GAIN_ONE;
+		cal.pot_offset = 0;
+		cal.clk_ppm = 0;
+	}
+
+	cal_apply();
+}
+
+//Function to wait for the flash controller and report (then clear) any programming error
+static int cal_flash_wait(void)
+{
+	while ((FLASH->SR & FLASH_SR_BSY) != 0){}; //wait until the current operation has finished
+
+	if ((FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)) != 0) {
+		FLASH->SR = FLASH_SR_PGERR | FLASH_SR_WRPRTERR; //error flags are cleared by writing 1
+		return -1;
+	}
+
+	FLASH->SR = FLASH_SR_EOP; //clear end of operation flag
+	return 0;
+}
+
+//Function to erase the calibration page and program the current record, returns 0 on success
+int cal_save(void)
+{
+	uint32_t words = (sizeof(cal_record_t) / 4) - 1;
+	const uint16_t *src = (const uint16_t *)&cal;
+	volatile uint16_t *dst = (volatile uint16_t *)CAL_FLASH_ADDR;
+	int status = 0;
+
+	cal.magic = CAL_MAGIC;
+	cal.version = CAL_VERSION;
+	cal.crc = cal_crc((const uint32_t *)&cal, words);
+
+	/* Unlock the flash control register */
+	if ((FLASH->CR & FLASH_CR_LOCK) != 0) {
+		FLASH->KEYR = FLASH_KEY1;
+		FLASH->KEYR = FLASH_KEY2;
+	}
+
+	/* Erase the last page */
+	FLASH->CR |= FLASH_CR_PER;
+	FLASH->AR = CAL_FLASH_ADDR;
+	FLASH->CR |= FLASH_CR_STRT;
+	status = cal_flash_wait();
+	FLASH->CR &= ~FLASH_CR_PER;
+
+	/* Program the record one half-word at a time */
+	if (status == 0) {
+		FLASH->CR |= FLASH_CR_PG;
+		for (uint32_t i = 0; i < sizeof(cal_record_t) / 2 && status == 0; i++) {
+			dst[i] = src[i];
+			status = cal_flash_wait();
+		}
+		FLASH->CR &= ~FLASH_CR_PG;
+	}
+
+	FLASH->CR |= FLASH_CR_LOCK; //lock the flash again
+
+	/* Read back through the same path used at boot */
+	if (status == 0 && ((const cal_record_t *)CAL_FLASH_ADDR)->crc != cal.crc) {
+		status = -1;
+	}
+
+	return status;
+}
+
+//Function to compute the potentiometer gain/offset from two known (POT_val, ohms) points,
+//returns 0 on success and -1 (old values kept) if the points do not describe an increasing line
+int cal_pot_two_point(uint32_t raw_lo, uint32_t ohms_lo, uint32_t raw_hi, uint32_t ohms_hi)
+{
+	uint32_t nominal_lo = (raw_lo * POT_FULL_SCALE) / ADC_FULL_SCALE;
+	uint32_t nominal_hi = (raw_hi * POT_FULL_SCALE) / ADC_FULL_SCALE;
+
+	if (nominal_hi <= nominal_lo || ohms_hi <= ohms_lo) {
+		return -1;
+	}
+
+	cal.pot_gain = ((ohms_hi - ohms_lo) << 16) / (nominal_hi - nominal_lo);
+	cal.pot_offset = (int32_t)ohms_lo - (int32_t)((nominal_lo * cal.pot_gain) >> 16);
+	return 0;
+}
+
+//Function to measure the CAL_REF_FREQ reference on PA2 and store the resulting clock correction
+void cal_run(void)
+{
+	uint64_t total = 0;
+	uint16_t saved_line = input_line;
+	uint32_t timeout = CAL_REF_TIMEOUT;
+
+	/* Measure the reference on PA2 with the regular edge ISR. The capture path is not set up
+	 * yet, so the latency check and the statistics would only see bogus values: keep them out. */
+	cal_active = 1;
+	input_line = 2;
+	EXTI->IMR |= EXTI_IMR_IM2;
+
+	for (uint16_t i = 0; i < CAL_REF_PERIODS && timeout != 0; i++) {
+		period_ready = 0;
+		timeout = CAL_REF_TIMEOUT;
+		while (period_ready == 0 && timeout != 0) { //wait for the next complete period
+			wait(1);
+			timeout--;
+		}
+		total += period_count;
+	}
+
+	input_line = saved_line;
+	if (input_line == 1) {
+		EXTI->IMR &= ~(EXTI_IMR_IM2);
+	}
+	cal_active = 0;
+
+	/* A fast clock counts more ticks per reference period than nominal */
+	uint64_t expected = ((uint64_t)SystemCoreClock * CAL_REF_PERIODS) / CAL_REF_FREQ;
+	int64_t ppm = (((int64_t)total - (int64_t)expected) * 1000000) / (int64_t)expected;
+
+	if (timeout == 0 || ppm > CAL_PPM_LIMIT || ppm < -CAL_PPM_LIMIT) {
+		return; //reference missing or wrong frequency, keep the stored record
+	}
 
+	cal.clk_ppm = (int32_t)ppm;
+	cal_apply();
+	cal_save();
 }
 
 #pragma GCC diagnostic pop
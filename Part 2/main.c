@@ -47,52 +47,45 @@
 /* Maximum possible setting for overflow */
 #define myTIM2_PERIOD ((uint32_t)0xFFFFFFFF)
 
-void myGPIOA_Init(void);
-void myTIM2_Init(void);
-void myEXTI_Init(void);
-
-
-// Declare/initialize your global variables here...
-// NOTE: You'll need at least one global variable
-uint16_t edge_count = 0;
-// (say, timerTriggered = 0 or 1) to indicate
-// whether TIM2 has started counting or not.
+/* Deferred trace: records queued by the ISRs, printed from the main loop */
+#define TRACE_LEN (32) //records in the ring (power of two)
+#define TRACE_OVERFLOW (0) //TIM2 overflowed, no argument
+#define TRACE_PERIOD (1) //one measured period, argument = raw TIM2 count
 
-
-/*** Call this function to boost the STM32F0xx clock to 48 MHz ***/
-
-void SystemClock48MHz( void )
-{
-//
-// Disable the PLL
-//
-    RCC->CR &= ~(RCC_CR_PLLON);
-//
-// Wait for the PLL to unlock
-//
-    while (( RCC->CR & RCC_CR_PLLRDY ) != 0 );
-//
-// Configure the PLL for 48-MHz system clock
-//
-    RCC->CFGR = 0x00280000;
-//
-// Enable the PLL
-//
-    RCC->CR |= RCC_CR_PLLON;
-//
-// Wait for the PLL to lock
-//
-    while (( RCC->CR & RCC_CR_PLLRDY ) != RCC_CR_PLLRDY );
-//
-// Switch the processor to the PLL clock source
-//
-    RCC->CFGR = ( RCC->CFGR & (~RCC_CFGR_SW_Msk)) | RCC_CFGR_SW_PLL;
-//
-// Update the system with the new clock frequency
-//
-    SystemCoreClockUpdate();
-
-}
+void myGPIOA_Init(void);
+void trace_flush(void);
+static void trace_push(uint16_t id, uint32_t arg);
+
+
+// One deferred trace record: a format ID and its raw argument, formatted later by trace_flush.
+// Both producers (EXTI2_3 and TIM2) run at priority 0 and cannot preempt each other,
+// so the ring needs no locking: the ISRs only move trace_head, the main loop only trace_tail.
+typedef struct {
+	uint16_t id;
+	uint32_t arg;
+} trace_record_t;
+
+trace_record_t trace_ring[TRACE_LEN];
+volatile uint16_t trace_head = 0; //written only by the ISRs
+volatile uint16_t trace_tail = 0; //written only by the main loop
+volatile uint32_t trace_dropped = 0; //records lost because the ring was full
+uint32_t trace_dropped_seen = 0; //trace_dropped at the last report
+
+
+/* Measurement core: one channel on PA2, timed by TIM2, periods queued on the trace ring */
+#define MEAS_CHANNELS(X) X(1)
+#define MEAS_CH1_PIN (2)
+#define MEAS_TIM TIM2
+#define MEAS_TIM_CLKEN RCC_APB1ENR_TIM2EN
+#define MEAS_TIM_IRQn TIM2_IRQn
+#define MEAS_TIM_PRIO (0)
+#define MEAS_EDGE_PRIO (0)
+#define MEAS_PRESCALER myTIM2_PRESCALER
+#define MEAS_PERIOD myTIM2_PERIOD
+#define MEAS_SINK(count, n) trace_push(TRACE_PERIOD, (count))
+
+/* SystemClock48MHz, the TIM2/EXTI set-up and the edge handler body */
+#include "../Common/meas_core.h"
 
 /*****************************************************************/
 
@@ -107,12 +100,13 @@ main(int argc, char* argv[])
 	trace_printf("System clock: %u Hz\n", SystemCoreClock);
 
 	myGPIOA_Init();		/* Initialize I/O port PA */
-	myTIM2_Init();		/* Initialize timer TIM2 */
-	myEXTI_Init();		/* Initialize EXTI */
+	meas_timer_init();	/* Initialize timer TIM2 */
+	meas_exti_init();	/* Initialize EXTI */
 
 	while (1)
 	{
-		// Nothing is going on here...
+		// Print whatever the ISRs have recorded since the last pass
+		trace_flush();
 	}
 	return 0;
 
@@ -135,63 +129,49 @@ void myGPIOA_Init()
 }
 
 
-void myTIM2_Init()
+/* Queue one trace record, called from the ISRs instead of trace_printf */
+static void trace_push(uint16_t id, uint32_t arg)
 {
-	/* Enable clock for TIM2 peripheral */
-	// Relevant register: RCC->APB1ENR
-	RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+	uint16_t next = (trace_head + 1) & (TRACE_LEN - 1);
 
-	/* Configure TIM2: buffer auto-reload, count up, stop on overflow,
-	 * enable update events, interrupt on overflow only */
-	// Relevant register: TIM2->CR1
-	TIM2->CR1 = 0x008C;
-
-	/* Set clock prescaler value */
-	TIM2->PSC = myTIM2_PRESCALER;
-	/* Set auto-reloaded delay */
-	TIM2->ARR = myTIM2_PERIOD;
-
-	/* Update timer registers */
-	// Relevant register: TIM2->EGR
-	TIM2->EGR = 0x0001;
-
-	/* Assign TIM2 interrupt priority = 0 in NVIC */
-	// Relevant register: NVIC->IP[3], or use NVIC_SetPriority
-	NVIC_SetPriority(TIM2_IRQn, 0);
-
-	/* Enable TIM2 interrupts in NVIC */
-	// Relevant register: NVIC->ISER[0], or use NVIC_EnableIRQ
-	NVIC_EnableIRQ(TIM2_IRQn);
-
-	/* Enable update interrupt generation */
-	// Relevant register: TIM2->DIER
-	TIM2->DIER |= TIM_DIER_UIE;
+	if (next == trace_tail)
+	{
+		trace_dropped++; //ring full: keep the older records
+		return;
+	}
 
+	trace_ring[trace_head].id = id;
+	trace_ring[trace_head].arg = arg;
+	trace_head = next;
 }
 
 
-void myEXTI_Init()
+/* Format and print the queued records in order, and report any that were dropped */
+void trace_flush(void)
 {
-	/* Map EXTI2 line to PA2 */
-	// Relevant register: SYSCFG->EXTICR[0]
-	SYSCFG->EXTICR[0] |= SYSCFG_EXTICR1_EXTI2_PA ; //Now connect PA2 (0x00) to EXTI2 (bits 8-11 of EXTICR)
-
-
-	/* EXTI2 line interrupts: set rising-edge trigger */
-	// Relevant register: EXTI->RTSR
-	EXTI->RTSR |= EXTI_RTSR_TR2;
-
-	/* Unmask interrupts from EXTI2 line */
-	// Relevant register: EXTI->IMR
-	EXTI->IMR |= EXTI_IMR_IM2;
+	while (trace_tail != trace_head)
+	{
+		trace_record_t rec = trace_ring[trace_tail];
+		trace_tail = (trace_tail + 1) & (TRACE_LEN - 1);
 
-	/* Assign EXTI2 interrupt priority = 0 in NVIC */
-	// Relevant register: NVIC->IP[2], or use NVIC_SetPriority
-	NVIC_SetPriority(EXTI2_3_IRQn, 0); //Make sure EXTI2 is priority 0
+		if (rec.id == TRACE_OVERFLOW)
+		{
+			trace_printf("\n*** Overflow! ***\n");
+		}
+		else if (rec.id == TRACE_PERIOD && rec.arg != 0)
+		{
+			//	- Calculate signal period and frequency (integer math, no float).
+			trace_printf("Signal Period: %u us\n", (unsigned int)(((uint64_t)rec.arg * 1000000) / SystemCoreClock));
+			trace_printf("Signal Frequency: %u Hz\n", (unsigned int)(SystemCoreClock / rec.arg));
+		}
+	}
 
-	/* Enable EXTI2 interrupts in NVIC */
-	// Relevant register: NVIC->ISER[0], or use NVIC_EnableIRQ
-	NVIC_EnableIRQ(EXTI2_3_IRQn); //enable EXTI2 interrupt line
+	uint32_t dropped = trace_dropped;
+	if (dropped != trace_dropped_seen)
+	{
+		trace_printf("*** %u trace records dropped ***\n", (unsigned int)(dropped - trace_dropped_seen));
+		trace_dropped_seen = dropped;
+	}
 }
 
 
@@ -201,7 +181,7 @@ void TIM2_IRQHandler()
 	/* Check if update interrupt flag is indeed set */
 	if ((TIM2->SR & TIM_SR_UIF) != 0)
 	{
-		trace_printf("\n*** Overflow! ***\n");
+		trace_push(TRACE_OVERFLOW, 0);
 
 		/* Clear update interrupt flag */
 		// Relevant register: TIM2->SR
@@ -217,48 +197,10 @@ void TIM2_IRQHandler()
 /* This handler is declared in system/src/cmsis/vectors_stm32f051x8.c */
 void EXTI2_3_IRQHandler()
 {
-	// Declare/initialize your local variables here...
-	/* Check if EXTI2 interrupt pending flag is indeed set */
-	if ((EXTI->PR & EXTI_PR_PR2) != 0)
-
-	{
-
-		//
-		// 1. If this is the first edge:
-
-		if (edge_count == 0) {
-			  //	- Clear count register (TIM2->CNT).
-			TIM2->CNT &= 0b00000000;
-			//	- Start timer (TIM2->CR1).
-			TIM2->CR1 |= TIM_CR1_CEN;
-			edge_count = 1;
-
-		} else {
-
-			//	- Stop timer (TIM2->CR1).
-			TIM2->CR1 &= ~TIM_CR1_CEN;
-			//	- Read out count register (TIM2->CNT).
-			float recording = (float)(TIM2->CNT) / (float)SystemCoreClock;
-			//	- Calculate signal period and frequency.
-
-			//	- Print calculated values to the console.
-			trace_printf("Signal Period: %u us\n", (unsigned int)(recording * 1e6));
-			trace_printf("Signal Frequency: %u Hz\n", (unsigned int)((1)/(recording)));
-			//	  NOTE: Function trace_printf does not work
-			//	  with floating-point numbers: you must use
-			//	  "unsigned int" type to print your signal
-			//	  period and frequency.
-			edge_count = 0;
-
-		}
-
-		//
-		// 2. Clear EXTI2 interrupt pending flag (EXTI->PR).
-		// NOTE: A pending register (PR) bit is cleared
-		// by writing 1 to it.
-		//
-		EXTI->PR |= EXTI_PR_PR2;
-	}
+	//	PA2: the period count is queued, the main loop calculates and prints
+	//	period and frequency, since printing here takes milliseconds
+	//	and the following edges would be missed.
+	MEAS_EDGE(1);
 }
 
 
@@ -0,0 +1,28 @@
+// ----------------------------------------------------------------------------
+// Minimal checks for the host tests: a failed CHECK prints where and why, and check_done
+// turns the count into the exit status make sees.
+// ----------------------------------------------------------------------------
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdio.h>
+
+static int check_failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		check_failures++; \
+		printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while (0)
+
+static inline int check_done(const char *name)
+{
+	printf("%s: %s\n", name, (check_failures == 0) ? "ok" : "FAILED");
+	return check_failures != 0;
+}
+
+#endif // CHECK_H_
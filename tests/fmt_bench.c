@@ -0,0 +1,122 @@
+// ----------------------------------------------------------------------------
+// Host benchmark of fmt.c against snprintf, both feeding the same glyph renderer
+// (8 font bytes copied into a frame buffer per character, like oled_Write_Char in a frame).
+// The host has a hardware divider, which snprintf uses for every digit; the Cortex-M0 does
+// not (each division is a library call), so the host ratio understates the gain on the board.
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../Main Project/fmt.h"
+
+#define CALLS (2000000)
+
+static unsigned char font[128][8];
+static unsigned char fb[16 * 8];
+static unsigned column = 0;
+
+static void glyph(unsigned char c)
+{
+	memcpy(&fb[(column++ & 15) * 8], font[c & 127], 8);
+}
+
+static void glyph_string(const char *s)
+{
+	while (*s != '\0') {
+		glyph((unsigned char)*s++);
+	}
+}
+
+static uint32_t values[4096];
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void snprintf_uint(uint32_t v)
+{
+	char text[16];
+	snprintf(text, sizeof(text), "%5u", v);
+	glyph_string(text);
+}
+
+static void render_only(uint32_t v)
+{
+	static const char text[5] = { '1', '2', '3', '4', '5' };
+	for (int i = 0; i < 5; i++) {
+		glyph((unsigned char)text[(v + i) % 5]);
+	}
+}
+
+static void fmt_uint5(uint32_t v)
+{
+	fmt_uint(glyph, v, 5);
+}
+
+static void snprintf_si(uint32_t v)
+{
+	char text[24];
+	if (v < 1000) {
+		snprintf(text, sizeof(text), "%5u Hz", v);
+	} else if (v < 1000000) {
+		snprintf(text, sizeof(text), "%5.*f kHz", (v < 10000) ? 3 : (v < 100000) ? 2 : 1, (v / 1000.0));
+	} else {
+		snprintf(text, sizeof(text), "%5.*f MHz", (v < 10000000) ? 3 : (v < 100000000) ? 2 : 1, (v / 1e6));
+	}
+	glyph_string(text);
+}
+
+static void fmt_si_hz(uint32_t v)
+{
+	fmt_si(glyph, v, "Hz");
+}
+
+/* best of 5 runs, per call */
+static double bench(void (*fn)(uint32_t))
+{
+	double best = 1e30;
+
+	for (int run = 0; run < 5; run++) {
+		double t0 = now_ns();
+		for (int i = 0; i < CALLS; i++) {
+			fn(values[i & 4095]);
+		}
+		double t = (now_ns() - t0) / CALLS;
+		best = (t < best) ? t : best;
+	}
+	return best;
+}
+
+int main(void)
+{
+	uint32_t x = 1;
+
+	for (int i = 0; i < 4096; i++) {
+		x = x * 1664525u + 1013904223u;
+		values[i] = x % 100000; //the range the %5u fields show
+	}
+	for (int c = 0; c < 128; c++) {
+		memset(font[c], c, 8);
+	}
+
+	double base = bench(render_only);
+	double s_uint = bench(snprintf_uint) - base, f_uint = bench(fmt_uint5) - base;
+	for (int i = 0; i < 4096; i++) {
+		x = x * 1664525u + 1013904223u;
+		values[i] = x >> (x & 15); //Hz from a few to a few GHz
+	}
+	double s_si = bench(snprintf_si) - 1.8 * base, f_si = bench(fmt_si_hz) - 1.8 * base;
+
+	/* the renderer's own cost (per 5 glyphs, 9 for an SI field) is taken out of both columns */
+	printf("renderer: %.1f ns per 5 glyphs\n", base);
+	printf("%-22s %10s %10s %8s\n", "formatting only", "snprintf", "fmt", "speedup");
+	printf("%-22s %8.1f ns %8.1f ns %7.1fx\n", "%5u", s_uint, f_uint, s_uint / f_uint);
+	printf("%-22s %8.1f ns %8.1f ns %7.1fx\n", "SI (Hz/kHz/MHz)", s_si, f_si, s_si / f_si);
+	printf("(column %u)\n", column & 15); //keeps the renderer from being optimised away
+	return 0;
+}
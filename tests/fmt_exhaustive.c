@@ -0,0 +1,101 @@
+// ----------------------------------------------------------------------------
+// fmt_uint and fmt_si for every 32-bit value (make exhaustive, about 40 minutes on one core). The
+// reference is a decimal odometer stepped alongside the value, so it is independent of
+// fmt.c and costs almost nothing per value.
+//
+//   fmt_exhaustive [first [last]]
+// ----------------------------------------------------------------------------
+
+#include <stdlib.h>
+
+#include "check.h"
+#include "fmt_ref.h"
+
+static char dig[10]; //decimal digits of the current value, most significant first
+static int len = 1;
+
+static void odometer_set(uint32_t v)
+{
+	char text[16];
+
+	len = snprintf(text, sizeof(text), "%u", v);
+	memcpy(dig, text, (size_t)len);
+}
+
+static void odometer_step(void)
+{
+	int i = len - 1;
+
+	while (i >= 0 && dig[i] == '9') {
+		dig[i--] = '0';
+	}
+	if (i >= 0) {
+		dig[i]++;
+	} else {
+		memmove(&dig[1], dig, (size_t)len);
+		dig[0] = '1';
+		len++;
+	}
+}
+
+static size_t ref_si(char *ref, uint32_t v)
+{
+	size_t n = 0;
+
+	if (v < 1000) {
+		memset(ref, ' ', (size_t)(5 - len));
+		memcpy(&ref[5 - len], dig, (size_t)len);
+		memcpy(&ref[5], " Hz", 3);
+		return 8;
+	}
+	int point = len - ((len > 6) ? 6 : 3);
+	int shown = (point < 4) ? 4 : 5;
+	memcpy(ref, dig, (size_t)point);
+	n = (size_t)point;
+	ref[n++] = '.';
+	memcpy(&ref[n], &dig[point], (size_t)(shown - point));
+	n += (size_t)(shown - point);
+	ref[n++] = ' ';
+	ref[n++] = (len > 6) ? 'M' : 'k';
+	ref[n++] = 'H';
+	ref[n++] = 'z';
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t first = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 0;
+	uint32_t last = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : UINT32_MAX;
+	char ref[32];
+	uint64_t bad = 0;
+
+	odometer_set(first);
+	for (uint64_t v = first; v <= last; v++, odometer_step()) {
+		memset(ref, ' ', (size_t)(10 - len));
+		memcpy(&ref[10 - len], dig, (size_t)len);
+		out_len = 0;
+		fmt_uint(out_put, (uint32_t)v, 10);
+		if (out_len != 10 || memcmp(out, ref, 10) != 0) {
+			if (bad++ < 10) {
+				CHECK(0, "%llu: '%.*s'", (unsigned long long)v, (int)out_len, out);
+			}
+		}
+
+		size_t n = ref_si(ref, (uint32_t)v);
+		out_len = 0;
+		fmt_si(out_put, (uint32_t)v, "Hz");
+		if (out_len != n || memcmp(out, ref, n) != 0) {
+			if (bad++ < 10) {
+				CHECK(0, "SI %llu: '%.*s', expected '%.*s'", (unsigned long long)v, (int)out_len, out, (int)n, ref);
+			}
+		}
+
+		if ((v & 0x0FFFFFFF) == 0x0FFFFFFF) {
+			printf("  %08llx\n", (unsigned long long)v);
+			fflush(stdout);
+		}
+	}
+
+	printf("%llu values, %llu mismatches\n", (unsigned long long)(last - first) + 1, (unsigned long long)bad);
+	return check_done("fmt exhaustive");
+}
@@ -0,0 +1,54 @@
+// ----------------------------------------------------------------------------
+// Shared by the fmt.c tests: a sink that collects the characters, and snprintf
+// references for fmt_digits and fmt_si.
+// ----------------------------------------------------------------------------
+
+#ifndef FMT_REF_H_
+#define FMT_REF_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../Main Project/fmt.h"
+
+static char out[64];
+static size_t out_len = 0;
+
+static void out_put(unsigned char c)
+{
+	if (out_len < sizeof(out) - 1) {
+		out[out_len++] = (char)c;
+	}
+}
+
+static inline void fmt_ref_digits(char *ref, uint32_t v, unsigned width, unsigned dec)
+{
+	char text[24];
+	uint32_t scale = 1;
+
+	for (unsigned i = 0; i < dec; i++) {
+		scale *= 10;
+	}
+	if (dec == 0) {
+		snprintf(text, sizeof(text), "%u", v);
+	} else {
+		snprintf(text, sizeof(text), "%u.%0*u", v / scale, (int)dec, v % scale);
+	}
+	snprintf(ref, 32, "%*s", (int)width, text);
+}
+
+static inline void fmt_ref_si(char *ref, uint32_t v, const char *unit)
+{
+	char text[16];
+
+	if (v < 1000) {
+		snprintf(ref, 32, "%5u %s", v, unit);
+		return;
+	}
+	int len = snprintf(text, sizeof(text), "%u", v);
+	int point = len - ((len > 6) ? 6 : 3);
+	int shown = (point < 4) ? 4 : 5;
+	snprintf(ref, 32, "%.*s.%.*s %c%s", point, text, shown - point, &text[point], (len > 6) ? 'M' : 'k', unit);
+}
+
+#endif // FMT_REF_H_
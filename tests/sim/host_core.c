@@ -0,0 +1,906 @@
+// ----------------------------------------------------------------------------
+// Host simulator core: the trapped peripheral window, simulated time and events,
+// the NVIC, the firmware main loop as a coroutine, and the CMSIS/trace entry points.
+// ----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "host_int.h"
+
+#define HOST_ENTRY_CYCLES (16) //exception entry (stacking) on a Cortex-M0
+#define HOST_EXIT_CYCLES (16) //exception return (unstacking)
+#define HOST_SPIN_READS (16) //identical reads in a row that count as a polling loop
+#define HOST_SPIN_REGS (8) //registers one polling loop may read
+#define HOST_AT_LEN (256)
+#define HOST_EXC (16 + 32)
+#define HOST_TF (0x100UL)
+
+host_time_t host_now = 0;
+uint64_t host_cycles = 0;
+uint32_t host_reg[HOST_PERIPHS][HOST_WORDS];
+int host_upc = 6; //HSI, 8 MHz, out of reset
+int host_isr_depth = 0;
+int host_access_cycles = 2;
+int host_call_cycles = 6;
+uint32_t SystemCoreClock = 8000000;
+
+static double host_ppm = 0;
+static double host_offset_s = 0;
+
+/* NVIC, by exception number (IRQn + 16) */
+static void (*host_vector[HOST_EXC])(void);
+static uint8_t host_prio[HOST_EXC];
+static uint8_t host_enabled[HOST_EXC];
+static uint8_t host_swpend[HOST_EXC];
+static uint8_t host_active[HOST_EXC];
+static int host_primask = 0;
+static uint64_t host_off_start; //host_cycles when PRIMASK was last set
+static void *host_off_from;
+uint64_t host_irq_off_max = 0;
+void *host_irq_off_where = NULL;
+static host_irq_stat_t host_stats[HOST_EXC];
+
+typedef struct {
+	int exc;
+	int prio;
+	uint64_t child_cycles;
+	uint64_t child_instr;
+	uint64_t instr;
+} host_frame_t;
+
+static host_frame_t host_stack[HOST_EXC];
+static void host_spin_reset(void);
+static int host_counting = 0;
+static uint64_t host_instr_total = 0;
+
+/* Pending single-stepped access */
+static struct {
+	int active;
+	int flash;
+	int write;
+	int p;
+	unsigned w;
+	uintptr_t addr;
+	uint32_t value;
+	uint16_t old;
+} host_acc;
+
+/* Polling-loop detection */
+static uint32_t host_last_read[HOST_PERIPHS][HOST_WORDS];
+static int host_spin = 0;
+static struct {
+	int p;
+	unsigned w;
+} host_spin_set[HOST_SPIN_REGS];
+static int host_spin_n = 0;
+static int host_grace = -1; //peripheral whose next access goes ahead of a pending interrupt
+
+/* Events */
+static host_time_t host_next = 0;
+static int host_dirty = 1;
+static struct {
+	host_time_t t;
+	void (*fn)(void *);
+	void *arg;
+} host_at_q[HOST_AT_LEN];
+static int host_at_n = 0;
+
+/* Firmware main loop as a coroutine */
+static ucontext_t host_test_ctx, host_main_ctx;
+static char host_main_stack[1 << 20] __attribute__((aligned(16)));
+static int (*host_main_fn)(int, char **);
+static int host_main_state = 0; //0 = not started, 1 = running, 2 = returned
+static int host_in_main = 0;
+static host_time_t host_pause_at = HOST_NEVER;
+
+/* Trace output */
+static char host_trace_buf[1 << 20];
+static size_t host_trace_len = 0;
+int host_trace_echo = 0;
+host_time_t host_trace_cost = HOST_MS(1);
+
+extern char __start_host_sim_text[], __stop_host_sim_text[];
+
+/* Interrupt handlers of whichever application is linked in */
+#define HOST_HANDLERS(X) \
+	X(PendSV_Handler, PendSV_IRQn) \
+	X(EXTI0_1_IRQHandler, EXTI0_1_IRQn) \
+	X(EXTI2_3_IRQHandler, EXTI2_3_IRQn) \
+	X(EXTI4_15_IRQHandler, EXTI4_15_IRQn) \
+	X(DMA1_Channel1_IRQHandler, DMA1_Channel1_IRQn) \
+	X(ADC1_COMP_IRQHandler, ADC1_COMP_IRQn) \
+	X(TIM2_IRQHandler, TIM2_IRQn) \
+	X(TIM3_IRQHandler, TIM3_IRQn) \
+	X(TIM14_IRQHandler, TIM14_IRQn) \
+	X(TIM15_IRQHandler, TIM15_IRQn) \
+	X(TIM16_IRQHandler, TIM16_IRQn) \
+	X(TIM17_IRQHandler, TIM17_IRQn) \
+	X(USART1_IRQHandler, USART1_IRQn)
+
+#define HOST_WEAK(fn, irqn) extern void fn(void) __attribute__((weak));
+HOST_HANDLERS(HOST_WEAK)
+
+/* Trace flag: simulator code runs with it clear, so only firmware instructions are counted */
+static inline __attribute__((always_inline, no_instrument_function)) uint64_t host_tf_save(void)
+{
+	uint64_t flags;
+	__asm__ volatile("pushfq\n\tpopq %0" : "=r"(flags));
+	if ((flags & HOST_TF) != 0) {
+		__asm__ volatile("pushfq\n\tandq $~0x100, (%%rsp)\n\tpopfq" ::: "memory", "cc");
+	}
+	return flags & HOST_TF;
+}
+
+static inline __attribute__((always_inline, no_instrument_function)) void host_tf_restore(uint64_t tf)
+{
+	if (tf != 0) {
+		__asm__ volatile("pushfq\n\torq $0x100, (%%rsp)\n\tpopfq" ::: "memory", "cc");
+	}
+}
+
+void SIM host_fatal(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "host: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	abort();
+}
+
+/* ---- time and events ---- */
+
+void SIM host_resched(void)
+{
+	host_dirty = 1;
+}
+
+static host_time_t SIM host_next_event(void)
+{
+	if (host_dirty) {
+		host_time_t t = host_dev_next();
+		if (host_at_n != 0 && host_at_q[0].t < t) {
+			t = host_at_q[0].t;
+		}
+		host_next = t;
+		host_dirty = 0;
+	}
+	return host_next;
+}
+
+static void SIM host_run_events(host_time_t t)
+{
+	host_dev_run(t);
+	while (host_at_n != 0 && host_at_q[0].t <= t) {
+		void (*fn)(void *) = host_at_q[0].fn;
+		void *arg = host_at_q[0].arg;
+		memmove(&host_at_q[0], &host_at_q[1], (size_t)(--host_at_n) * sizeof(host_at_q[0]));
+		fn(arg);
+	}
+	host_dirty = 1;
+}
+
+void SIM host_advance(host_time_t t)
+{
+	while (host_next_event() <= t) {
+		if (host_next > host_now) {
+			host_now = host_next;
+		}
+		host_run_events(host_now);
+	}
+	if (t > host_now) {
+		host_now = t;
+	}
+}
+
+static void SIM host_charge(uint64_t cycles)
+{
+	host_cycles += cycles;
+	host_advance(host_now + (host_time_t)cycles * host_upc);
+}
+
+void SIM host_stall(host_time_t units)
+{
+	host_cycles += (uint64_t)(units / host_upc);
+	host_advance(host_now + units);
+}
+
+void SIM host_set_upc(int upc)
+{
+	if (upc != host_upc) {
+		host_dev_clock_change(upc);
+		host_upc = upc;
+		host_dirty = 1;
+	}
+}
+
+void SIM host_at(host_time_t t, void (*fn)(void *), void *arg)
+{
+	int i = host_at_n;
+
+	if (host_at_n == HOST_AT_LEN) {
+		host_fatal("host_at queue full");
+	}
+	while (i > 0 && host_at_q[i - 1].t > t) {
+		host_at_q[i] = host_at_q[i - 1];
+		i--;
+	}
+	host_at_q[i].t = t;
+	host_at_q[i].fn = fn;
+	host_at_q[i].arg = arg;
+	host_at_n++;
+	host_dirty = 1;
+}
+
+void SIM host_set_ppm(double ppm)
+{
+	host_ppm = ppm;
+}
+
+void SIM host_set_true_offset(double seconds)
+{
+	host_offset_s = seconds;
+}
+
+double SIM host_true_s(host_time_t t)
+{
+	return host_offset_s + (double)t / (48e6 * (1 + host_ppm * 1e-6));
+}
+
+host_time_t SIM host_board_time(double true_s)
+{
+	double units = (true_s - host_offset_s) * 48e6 * (1 + host_ppm * 1e-6);
+	host_time_t t = (host_time_t)units;
+	return (units > (double)t) ? t + 1 : t;
+}
+
+uint32_t SIM host_sysclk(void)
+{
+	return (uint32_t)(48000000 / host_upc);
+}
+
+/* ---- NVIC ---- */
+
+static void SIM host_take(int exc)
+{
+	host_frame_t *f = &host_stack[host_isr_depth++];
+	uint64_t start = host_cycles;
+	uint64_t tf = 0;
+
+	host_swpend[exc] = 0;
+	host_active[exc] = 1;
+	f->exc = exc;
+	f->prio = host_prio[exc];
+	f->child_cycles = 0;
+	f->child_instr = 0;
+	f->instr = 0;
+	host_spin_reset();
+
+	host_charge(HOST_ENTRY_CYCLES);
+	if (host_counting) {
+		__asm__ volatile("pushfq\n\torq $0x100, (%%rsp)\n\tpopfq" ::: "memory", "cc");
+	}
+	host_vector[exc]();
+	__asm__ volatile("pushfq\n\tpopq %0" : "=r"(tf));
+	if ((tf & HOST_TF) != 0) {
+		__asm__ volatile("pushfq\n\tandq $~0x100, (%%rsp)\n\tpopfq" ::: "memory", "cc");
+	}
+	host_charge(HOST_EXIT_CYCLES);
+
+	host_active[exc] = 0;
+	host_isr_depth--;
+
+	uint64_t total = host_cycles - start;
+	uint64_t own = total - f->child_cycles;
+	uint64_t instr = f->instr;
+	host_irq_stat_t *s = &host_stats[exc];
+	s->count++;
+	s->cycles += own;
+	if (own > s->max_cycles) {
+		s->max_cycles = own;
+	}
+	s->instr += instr;
+	if (instr > s->max_instr) {
+		s->max_instr = instr;
+	}
+	if (host_isr_depth != 0) {
+		host_stack[host_isr_depth - 1].child_cycles += total;
+	}
+}
+
+static int SIM host_pending(int exc)
+{
+	if (host_vector[exc] == NULL || host_active[exc]) {
+		return 0;
+	}
+	if (exc < 16) {
+		return host_swpend[exc];
+	}
+	return host_enabled[exc] && (host_swpend[exc] || host_dev_line(exc - 16));
+}
+
+/* Highest-priority exception that would preempt now, -1 if none */
+static int SIM host_best(void)
+{
+	int current = (host_isr_depth != 0) ? host_stack[host_isr_depth - 1].prio : 256;
+	int best = -1;
+
+	if (host_primask != 0) {
+		return -1;
+	}
+	for (int exc = 14; exc < HOST_EXC; exc++) {
+		if (host_prio[exc] < current && host_pending(exc)) {
+			best = exc;
+			current = host_prio[exc];
+		}
+	}
+	return best;
+}
+
+static void SIM host_dispatch(void)
+{
+	int exc;
+
+	while ((exc = host_best()) >= 0) {
+		host_take(exc);
+	}
+}
+
+static void SIM host_pause_check(void)
+{
+	if (host_in_main && host_isr_depth == 0 && host_now >= host_pause_at) {
+		host_in_main = 0;
+		swapcontext(&host_main_ctx, &host_test_ctx);
+		host_in_main = 1;
+	}
+}
+
+void SIM host_pend(int irqn)
+{
+	host_swpend[irqn + 16] = 1;
+}
+
+host_irq_stat_t * SIM host_irq(int irqn)
+{
+	return &host_stats[irqn + 16];
+}
+
+void SIM host_irq_reset(void)
+{
+	memset(host_stats, 0, sizeof(host_stats));
+	host_irq_off_max = 0;
+	host_irq_off_where = NULL;
+}
+
+void SIM host_count_instructions(int on)
+{
+	host_counting = on;
+}
+
+/* Longest stretch with interrupts masked, from the call that masked them */
+static void SIM host_primask_write(int on, void *from)
+{
+	if (on && !host_primask) {
+		host_off_start = host_cycles;
+		host_off_from = from;
+	} else if (!on && host_primask && host_cycles - host_off_start > host_irq_off_max) {
+		host_irq_off_max = host_cycles - host_off_start;
+		host_irq_off_where = host_off_from;
+	}
+	host_primask = on;
+}
+
+void SIM __disable_irq(void)
+{
+	host_primask_write(1, __builtin_return_address(0));
+	if (host_counting && host_isr_depth == 0) {
+		__asm__ volatile("pushfq\n\torq $0x100, (%%rsp)\n\tpopfq" ::: "memory", "cc"); //count the critical section
+	}
+}
+
+void SIM __enable_irq(void)
+{
+	uint64_t tf = host_tf_save();
+	host_primask_write(0, NULL);
+	host_dispatch();
+	host_tf_restore((host_isr_depth != 0) ? tf : 0);
+}
+
+uint32_t SIM __get_PRIMASK(void)
+{
+	return (uint32_t)host_primask;
+}
+
+void SIM __set_PRIMASK(uint32_t primask)
+{
+	uint64_t tf = host_tf_save();
+	host_primask_write((int)(primask & 1), __builtin_return_address(0));
+	host_dispatch();
+	if (host_isr_depth == 0) {
+		tf = (host_counting && host_primask) ? HOST_TF : 0;
+	}
+	host_tf_restore(tf);
+}
+
+void SIM NVIC_EnableIRQ(IRQn_Type irq)
+{
+	uint64_t tf = host_tf_save();
+	host_enabled[irq + 16] = 1;
+	host_dispatch();
+	host_tf_restore(tf);
+}
+
+void SIM NVIC_DisableIRQ(IRQn_Type irq)
+{
+	host_enabled[irq + 16] = 0;
+}
+
+void SIM NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+	host_prio[irq + 16] = (uint8_t)(priority & 3);
+}
+
+uint32_t SIM NVIC_GetPriority(IRQn_Type irq)
+{
+	return host_prio[irq + 16];
+}
+
+uint32_t SIM NVIC_GetEnableIRQ(IRQn_Type irq)
+{
+	return (uint32_t)host_enabled[irq + 16];
+}
+
+void SIM NVIC_SetPendingIRQ(IRQn_Type irq)
+{
+	uint64_t tf = host_tf_save();
+	host_swpend[irq + 16] = 1;
+	host_dispatch();
+	host_tf_restore(tf);
+}
+
+void SIM NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+	host_swpend[irq + 16] = 0;
+}
+
+void SIM SystemCoreClockUpdate(void)
+{
+	SystemCoreClock = host_sysclk();
+}
+
+/* ---- the peripheral window ---- */
+
+void * SIM host_io(int periph)
+{
+	uint64_t tf = host_tf_save();
+	if (periph != host_grace) {
+		host_dispatch();
+	}
+	host_grace = -1;
+	host_pause_check();
+	host_tf_restore(tf);
+	return (void *)(HOST_WINDOW + (uintptr_t)periph * HOST_PAGE);
+}
+
+void SIM __cyg_profile_func_enter(void *fn, void *site)
+{
+	uint64_t tf = host_tf_save();
+	(void)fn;
+	(void)site;
+	host_charge((uint64_t)host_call_cycles);
+	host_dispatch();
+	host_pause_check();
+	host_tf_restore(tf);
+}
+
+void SIM __cyg_profile_func_exit(void *fn, void *site)
+{
+	(void)fn;
+	(void)site;
+}
+
+/* Polling loop: the same reads over and over. Run the events that follow until one of the
+ * polled registers changes, an interrupt is due or the test wants control back. */
+static void SIM host_spin_skip(void)
+{
+	host_time_t limit = (host_in_main && host_isr_depth == 0) ? host_pause_at : HOST_NEVER;
+	host_time_t change;
+
+	for (int i = 0; i < host_spin_n; i++) {
+		if (host_dev_volatile(host_spin_set[i].p, host_spin_set[i].w, &change) && change < limit) {
+			limit = change;
+		}
+	}
+
+	for (;;) {
+		host_time_t next = host_next_event();
+		if (next >= limit) {
+			if (limit != HOST_NEVER && limit > host_now) {
+				host_stall(limit - host_now);
+			}
+			return;
+		}
+		if (next > host_now) {
+			host_stall(next - host_now);
+		} else {
+			host_advance(host_now);
+		}
+		for (int i = 0; i < host_spin_n; i++) {
+			int p = host_spin_set[i].p;
+			unsigned w = host_spin_set[i].w;
+			if (host_dev_read(p, w) != host_last_read[p][w]) {
+				host_grace = p; //the polling read lands before the interrupt the change may raise
+				return;
+			}
+		}
+		if (host_best() >= 0) {
+			return;
+		}
+	}
+}
+
+static void SIM host_spin_reset(void)
+{
+	host_spin = 0;
+	host_spin_n = 0;
+}
+
+static void SIM host_spin_track(int p, unsigned w, uint32_t v)
+{
+	int i;
+
+	if (v != host_last_read[p][w]) {
+		host_last_read[p][w] = v;
+		host_spin_reset();
+		return;
+	}
+	for (i = 0; i < host_spin_n; i++) {
+		if (host_spin_set[i].p == p && host_spin_set[i].w == w) {
+			break;
+		}
+	}
+	if (i == host_spin_n) {
+		if (host_spin_n == HOST_SPIN_REGS) {
+			host_spin_reset(); //too many registers for a simple polling loop
+			return;
+		}
+		host_spin_set[host_spin_n].p = p;
+		host_spin_set[host_spin_n].w = w;
+		host_spin_n++;
+	}
+	if (++host_spin < HOST_SPIN_READS) {
+		return;
+	}
+	host_spin_skip();
+	host_spin_reset();
+}
+
+static void SIM host_segv(int sig, siginfo_t *si, void *ctx)
+{
+	ucontext_t *uc = (ucontext_t *)ctx;
+	uintptr_t a = (uintptr_t)si->si_addr;
+	int write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+
+	if (host_acc.active) {
+		host_fatal("nested fault at %p", si->si_addr);
+	}
+
+	if (a >= HOST_WINDOW && a < HOST_WINDOW + HOST_PERIPHS * HOST_PAGE) {
+		uintptr_t page = a & ~(HOST_PAGE - 1);
+		int p = (int)((page - HOST_WINDOW) / HOST_PAGE);
+		unsigned w = (unsigned)((a - page) / 4);
+
+		if (w >= HOST_WORDS) {
+			host_fatal("access past peripheral %d at offset 0x%x", p, (unsigned)(a - page));
+		}
+		host_charge((uint64_t)host_access_cycles);
+
+		uint32_t v = host_dev_read(p, w);
+		mprotect((void *)page, HOST_PAGE, PROT_READ | PROT_WRITE);
+		*(volatile uint32_t *)(page + w * 4) = v;
+
+		host_acc.flash = 0;
+		host_acc.p = p;
+		host_acc.w = w;
+		host_acc.value = v;
+	} else if (a >= HOST_FLASH_BASE && a < HOST_FLASH_BASE + HOST_FLASH_SIZE && write) {
+		mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE);
+		host_acc.flash = 1;
+		host_acc.old = *(volatile uint16_t *)(a & ~(uintptr_t)1);
+	} else {
+		signal(sig, SIG_DFL);
+		fprintf(stderr, "host: fault at %p (rip %llx)\n", si->si_addr,
+				(unsigned long long)uc->uc_mcontext.gregs[REG_RIP]);
+		return;
+	}
+
+	host_acc.active = 1;
+	host_acc.write = write;
+	host_acc.addr = a;
+	uc->uc_mcontext.gregs[REG_EFL] |= HOST_TF;
+}
+
+static void SIM host_trap(int sig, siginfo_t *si, void *ctx)
+{
+	ucontext_t *uc = (ucontext_t *)ctx;
+	uintptr_t rip = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+	int stepped = host_acc.active;
+	(void)sig;
+	(void)si;
+
+	if (host_acc.active) {
+		host_acc.active = 0;
+		if (host_acc.flash == 0) {
+			uintptr_t page = host_acc.addr & ~(HOST_PAGE - 1);
+			uint32_t v = *(volatile uint32_t *)(page + host_acc.w * 4);
+			mprotect((void *)page, HOST_PAGE, PROT_NONE);
+			if (host_acc.write) {
+				host_spin_reset();
+				host_dev_write(host_acc.p, host_acc.w, v);
+				host_last_read[host_acc.p][host_acc.w] = ~host_dev_read(host_acc.p, host_acc.w);
+			} else {
+				host_dev_read_done(host_acc.p, host_acc.w);
+				host_spin_track(host_acc.p, host_acc.w, host_acc.value);
+			}
+		} else {
+			volatile uint16_t *cell = (volatile uint16_t *)(host_acc.addr & ~(uintptr_t)1);
+			uint16_t v = *cell;
+			if (!host_flash_program((uintptr_t)cell, host_acc.old, v)) {
+				*cell = host_acc.old;
+			}
+			mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ);
+		}
+		host_resched();
+	}
+
+	/* handlers, and the main loop while it has interrupts masked */
+	int counted = host_counting && (host_isr_depth != 0 || host_primask);
+
+	if (counted && (rip < (uintptr_t)__start_host_sim_text || rip >= (uintptr_t)__stop_host_sim_text)) {
+		if (host_isr_depth != 0) {
+			host_stack[host_isr_depth - 1].instr++;
+		}
+		host_instr_total++;
+		host_charge(1);
+	} else if (!stepped && !counted) {
+		uc->uc_mcontext.gregs[REG_EFL] &= ~HOST_TF; //stray single step
+	}
+
+	if (!counted) {
+		uc->uc_mcontext.gregs[REG_EFL] &= ~HOST_TF;
+	}
+}
+
+static void SIM host_map(uintptr_t base, size_t len, int prot, int flags)
+{
+	void *p = mmap((void *)base, len, prot, flags | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (p != (void *)base) {
+		host_fatal("cannot map 0x%lx: %s", (unsigned long)base, strerror(errno));
+	}
+}
+
+static void SIM host_alarm(int sig)
+{
+	(void)sig;
+	static const char msg[] = "host: simulation timed out\n";
+	if (write(2, msg, sizeof(msg) - 1) < 0) {
+		_exit(124);
+	}
+	_exit(124);
+}
+
+void SIM host_init(void)
+{
+	static int mapped = 0;
+	struct sigaction sa;
+
+	if (!mapped) {
+		host_map(HOST_WINDOW, HOST_PERIPHS * HOST_PAGE, PROT_NONE, MAP_PRIVATE);
+		host_map(HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED);
+		memset((void *)HOST_FLASH_BASE, 0xFF, HOST_FLASH_SIZE);
+		mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ);
+		host_map(HOST_SYSMEM_BASE, 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE);
+		*(uint16_t *)(HOST_SYSMEM_BASE + 0x7B8) = 1750; //TS_CAL1, 30 C at 3.3 V
+		*(uint16_t *)(HOST_SYSMEM_BASE + 0x7BA) = 1526; //VREFINT_CAL at 3.3 V
+		*(uint16_t *)(HOST_SYSMEM_BASE + 0x7C2) = 1323; //TS_CAL2, 110 C at 3.3 V
+		mprotect((void *)HOST_SYSMEM_BASE, 0x1000, PROT_READ);
+		mapped = 1;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = host_segv;
+		sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigaction(SIGSEGV, &sa, NULL);
+		sa.sa_sigaction = host_trap;
+		sigaction(SIGTRAP, &sa, NULL);
+		signal(SIGALRM, host_alarm);
+		setvbuf(stdout, NULL, _IOLBF, 0);
+	}
+	alarm(600);
+
+	memset(host_reg, 0, sizeof(host_reg));
+	memset(host_prio, 0, sizeof(host_prio));
+	memset(host_enabled, 0, sizeof(host_enabled));
+	memset(host_swpend, 0, sizeof(host_swpend));
+	memset(host_active, 0, sizeof(host_active));
+	memset(host_stats, 0, sizeof(host_stats));
+	memset(host_last_read, 0xA5, sizeof(host_last_read));
+	host_now = 0;
+	host_cycles = 0;
+	host_upc = 6;
+	host_primask = 0;
+	host_isr_depth = 0;
+	host_spin_reset();
+	host_grace = -1;
+	host_at_n = 0;
+	host_main_state = 0;
+	host_trace_len = 0;
+	host_trace_buf[0] = '\0';
+	SystemCoreClock = 8000000;
+	host_dirty = 1;
+
+#define HOST_VEC(fn, irqn) host_vector[(irqn) + 16] = fn;
+	HOST_HANDLERS(HOST_VEC)
+	host_enabled[PendSV_IRQn + 16] = 1;
+
+	host_dev_reset();
+}
+
+/* ---- the firmware main loop ---- */
+
+static void SIM host_main_entry(void)
+{
+	host_main_fn(0, NULL);
+	host_main_state = 2;
+	host_in_main = 0;
+}
+
+void SIM host_main_start(int (*fn)(int, char **))
+{
+	host_main_fn = fn;
+	getcontext(&host_main_ctx);
+	host_main_ctx.uc_stack.ss_sp = host_main_stack;
+	host_main_ctx.uc_stack.ss_size = sizeof(host_main_stack);
+	host_main_ctx.uc_link = &host_test_ctx;
+	makecontext(&host_main_ctx, host_main_entry, 0);
+	host_main_state = 1;
+}
+
+int SIM host_main_done(void)
+{
+	return host_main_state == 2;
+}
+
+void SIM host_run_until(host_time_t t)
+{
+	if (host_main_state == 1) {
+		host_pause_at = t;
+		host_in_main = 1;
+		swapcontext(&host_test_ctx, &host_main_ctx);
+		host_in_main = 0;
+		host_pause_at = HOST_NEVER;
+		return;
+	}
+
+	//no main loop: the core sleeps between interrupts
+	host_dispatch();
+	while (host_now < t) {
+		host_time_t next = host_next_event();
+		if (next > t) {
+			next = t;
+		}
+		if (next > host_now) {
+			host_cycles += (uint64_t)((next - host_now) / host_upc);
+		}
+		host_advance(next);
+		host_dispatch();
+	}
+}
+
+void SIM host_run(host_time_t dt)
+{
+	host_run_until(host_now + dt);
+}
+
+void SIM host_busy(uint64_t cycles)
+{
+	host_time_t target = host_now + (host_time_t)cycles * host_upc;
+
+	host_cycles += cycles;
+	while (host_now < target) {
+		host_time_t next = host_next_event();
+		host_advance((next < target) ? next : target);
+		host_dispatch();
+	}
+}
+
+pid_t SIM host_fork(void)
+{
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid == 0) {
+		alarm(600);
+	}
+	return pid;
+}
+
+int SIM host_wait(pid_t pid)
+{
+	int status = 0;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		return -1;
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/* ---- trace output (diag/Trace.h) ---- */
+
+static void SIM host_trace_put(const char *s, size_t n)
+{
+	if (host_trace_len + n >= sizeof(host_trace_buf)) {
+		n = sizeof(host_trace_buf) - 1 - host_trace_len;
+	}
+	memcpy(&host_trace_buf[host_trace_len], s, n);
+	host_trace_len += n;
+	host_trace_buf[host_trace_len] = '\0';
+	if (host_trace_echo) {
+		fwrite(s, 1, n, stdout);
+	}
+}
+
+int SIM trace_printf(const char *format, ...)
+{
+	uint64_t tf = host_tf_save();
+	char line[512];
+	va_list ap;
+
+	va_start(ap, format);
+	int n = vsnprintf(line, sizeof(line), format, ap);
+	va_end(ap);
+	if (n > (int)sizeof(line) - 1) {
+		n = (int)sizeof(line) - 1;
+	}
+	host_trace_put(line, (size_t)n);
+	host_stall(host_trace_cost);
+	host_tf_restore(tf);
+	return n;
+}
+
+int SIM trace_puts(const char *s)
+{
+	uint64_t tf = host_tf_save();
+	host_trace_put(s, strlen(s));
+	host_trace_put("\n", 1);
+	host_stall(host_trace_cost);
+	host_tf_restore(tf);
+	return 1;
+}
+
+int SIM trace_putchar(int c)
+{
+	char ch = (char)c;
+	host_trace_put(&ch, 1);
+	return c;
+}
+
+const char * SIM host_trace(void)
+{
+	return host_trace_buf;
+}
+
+void SIM host_trace_clear(void)
+{
+	host_trace_len = 0;
+	host_trace_buf[0] = '\0';
+}
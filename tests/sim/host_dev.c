@@ -0,0 +1,1034 @@
+// ----------------------------------------------------------------------------
+// Host simulator: the remaining peripherals (GPIO, EXTI, RCC, FLASH, CRC, ADC, DMA,
+// USART1, SPI1 with the OLED behind it, DAC, SCB) and the register/event dispatch.
+// ----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* termios names its delay masks after the register CR1-CR3 fields */
+#undef CR1
+#undef CR2
+#undef CR3
+
+#include "host_int.h"
+
+#define HOST_PLL_LOCK HOST_US(100)
+#define HOST_FLASH_ERASE HOST_MS(20)
+#define HOST_FLASH_PROGRAM HOST_US(50)
+#define HOST_ADC_CAL HOST_US(6)
+#define HOST_ADC_RDY HOST_US(1)
+#define HOST_ADC_DIS HOST_US(1)
+#define HOST_ADC_STP (24)
+#define HOST_PTY_POLL HOST_US(100)
+#define HOST_RX_LEN (1 << 16)
+
+enum { EV_PLL, EV_ADC_CAL, EV_ADC_RDY, EV_ADC_DIS, EV_ADC_STP, EV_ADC_CONV, EV_UART_TX, EV_UART_RX, EV_PTY, EV_N };
+static host_time_t host_ev[EV_N];
+
+void (*host_dac_hook)(uint32_t code, host_time_t t) = NULL;
+void (*host_uart_hook)(uint8_t byte, host_time_t t) = NULL;
+
+/* ---- GPIO ---- */
+
+static uint32_t SIM host_idr(int port)
+{
+	uint32_t idr = 0;
+
+	for (int i = 0; i < 16; i++) {
+		if (host_pin_get(port * 16 + i)) {
+			idr |= 1u << i;
+		}
+	}
+	return idr;
+}
+
+/* ---- FLASH ---- */
+
+static int host_flash_keys = 0; //key sequence position, -1 once a wrong key locked it until reset
+static int host_fail_erase = 0;
+static int host_fail_program = -1;
+static int host_power_cut = -1;
+uint32_t host_flash_erases = 0, host_flash_programs = 0;
+
+uint8_t * SIM host_flash(uint32_t addr)
+{
+	return (uint8_t *)(uintptr_t)addr;
+}
+
+void SIM host_flash_erase_all(void)
+{
+	mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE);
+	memset((void *)HOST_FLASH_BASE, 0xFF, HOST_FLASH_SIZE);
+	mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ);
+}
+
+void SIM host_flash_poke(uint32_t addr, const void *data, size_t n)
+{
+	mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE);
+	memcpy((void *)(uintptr_t)addr, data, n);
+	mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ);
+}
+
+void SIM host_flash_fail_erase(int on)
+{
+	host_fail_erase = on;
+}
+
+void SIM host_flash_fail_program(int n)
+{
+	host_fail_program = n;
+}
+
+void SIM host_flash_power_cut(int n)
+{
+	host_power_cut = n;
+}
+
+static void SIM host_flash_erase(uint32_t addr)
+{
+	uintptr_t page = addr & ~(uintptr_t)0x3FF;
+
+	if (host_fail_erase) {
+		R(HOST_FLASH, FLASH_TypeDef, SR) |= FLASH_SR_WRPRTERR;
+		return;
+	}
+	if (host_power_cut == 0) {
+		_exit(HOST_EXIT_POWER_CUT);
+	}
+	if (page >= HOST_FLASH_BASE && page < HOST_FLASH_BASE + HOST_FLASH_SIZE) {
+		mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE);
+		memset((void *)page, 0xFF, 0x400);
+		mprotect((void *)HOST_FLASH_BASE, HOST_FLASH_SIZE, PROT_READ);
+	}
+	host_flash_erases++;
+	host_stall(HOST_FLASH_ERASE);
+	R(HOST_FLASH, FLASH_TypeDef, SR) |= FLASH_SR_EOP;
+}
+
+/* A half-word store into flash: 1 keeps it, 0 has the simulator put the old value back */
+int SIM host_flash_program(uintptr_t addr, uint16_t old, uint16_t value)
+{
+	if ((R(HOST_FLASH, FLASH_TypeDef, CR) & (FLASH_CR_PG | FLASH_CR_LOCK)) != FLASH_CR_PG) {
+		return 0;
+	}
+	if (host_power_cut >= 0 && host_power_cut-- == 0) {
+		*(volatile uint16_t *)addr = old; //the store has already landed in the shared page
+		_exit(HOST_EXIT_POWER_CUT);
+	}
+	if ((host_fail_program > 0 && --host_fail_program == 0) || (old != 0xFFFF && value != 0)) {
+		R(HOST_FLASH, FLASH_TypeDef, SR) |= FLASH_SR_PGERR;
+		return 0;
+	}
+	host_flash_programs++;
+	host_stall(HOST_FLASH_PROGRAM);
+	R(HOST_FLASH, FLASH_TypeDef, SR) |= FLASH_SR_EOP;
+	return 1;
+}
+
+static void SIM host_flash_write(unsigned w, uint32_t v)
+{
+	uint32_t *cr = &R(HOST_FLASH, FLASH_TypeDef, CR);
+
+	switch (w) {
+	case W(FLASH_TypeDef, KEYR):
+		if (host_flash_keys == 0 && v == FLASH_KEY1) {
+			host_flash_keys = 1;
+		} else if (host_flash_keys == 1 && v == FLASH_KEY2) {
+			host_flash_keys = 0;
+			*cr &= ~FLASH_CR_LOCK;
+		} else {
+			host_flash_keys = -1;
+		}
+		break;
+	case W(FLASH_TypeDef, SR):
+		R(HOST_FLASH, FLASH_TypeDef, SR) &= ~(v & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR | FLASH_SR_EOP));
+		break;
+	case W(FLASH_TypeDef, CR):
+		if ((*cr & FLASH_CR_LOCK) != 0) {
+			break;
+		}
+		*cr = v;
+		if ((v & (FLASH_CR_PER | FLASH_CR_STRT)) == (FLASH_CR_PER | FLASH_CR_STRT)) {
+			*cr &= ~FLASH_CR_STRT;
+			host_flash_erase(R(HOST_FLASH, FLASH_TypeDef, AR));
+		}
+		break;
+	case W(FLASH_TypeDef, AR):
+		if ((*cr & FLASH_CR_LOCK) == 0) {
+			host_reg[HOST_FLASH][w] = v;
+		}
+		break;
+	default:
+		host_reg[HOST_FLASH][w] = v;
+		break;
+	}
+}
+
+/* ---- CRC ---- */
+
+static uint32_t host_crc;
+
+static void SIM host_crc_word(uint32_t v)
+{
+	host_crc ^= v;
+	for (int i = 0; i < 32; i++) {
+		host_crc = ((host_crc & 0x80000000u) != 0) ? (host_crc << 1) ^ 0x04C11DB7u : host_crc << 1;
+	}
+}
+
+/* ---- RCC ---- */
+
+static void SIM host_rcc_switch(void)
+{
+	uint32_t *cfgr = &R(HOST_RCC, RCC_TypeDef, CFGR);
+	uint32_t sw = *cfgr & RCC_CFGR_SW_Msk;
+	uint32_t hz = 8000000;
+
+	if (sw == RCC_CFGR_SW_PLL) {
+		if ((R(HOST_RCC, RCC_TypeDef, CR) & RCC_CR_PLLRDY) == 0) {
+			return; //the switch waits for the PLL
+		}
+		hz = 4000000 * (((*cfgr & RCC_CFGR_PLLMUL) >> RCC_CFGR_PLLMUL_Pos) + 2);
+	}
+	*cfgr = (*cfgr & ~RCC_CFGR_SWS) | (sw << 2);
+	host_set_upc((int)(48000000 / hz));
+}
+
+static void SIM host_rcc_write(unsigned w, uint32_t v)
+{
+	if (w == W(RCC_TypeDef, CR)) {
+		uint32_t old = R(HOST_RCC, RCC_TypeDef, CR);
+		v = (v & ~RCC_CR_PLLRDY) | (old & RCC_CR_PLLRDY) | 0x2; //HSIRDY stays set
+		if ((v & RCC_CR_PLLON) != 0 && (old & RCC_CR_PLLON) == 0) {
+			host_ev[EV_PLL] = host_now + HOST_PLL_LOCK;
+		} else if ((v & RCC_CR_PLLON) == 0) {
+			v &= ~RCC_CR_PLLRDY;
+			host_ev[EV_PLL] = HOST_NEVER;
+		}
+		R(HOST_RCC, RCC_TypeDef, CR) = v;
+	} else if (w == W(RCC_TypeDef, CFGR)) {
+		R(HOST_RCC, RCC_TypeDef, CFGR) = (v & ~RCC_CFGR_SWS) | (R(HOST_RCC, RCC_TypeDef, CFGR) & RCC_CFGR_SWS);
+		host_rcc_switch();
+	} else {
+		host_reg[HOST_RCC][w] = v;
+	}
+}
+
+/* ---- DMA ---- */
+
+static struct {
+	uint32_t reload;
+	uint32_t idx;
+} host_dma[4];
+
+static int SIM host_dma_line(int ch)
+{
+	uint32_t isr = R(HOST_DMA1, DMA_TypeDef, ISR) >> (4 * (ch - 1));
+	uint32_t ccr = host_reg[HOST_DMA1_CH1 + ch - 1][W(DMA_Channel_TypeDef, CCR)];
+
+	return (isr & (ccr & 0xE)) != 0; //TCIE/HTIE/TEIE line up with TCIF/HTIF/TEIF
+}
+
+int SIM host_dma_request(int ch, uint32_t *value)
+{
+	int p = HOST_DMA1_CH1 + ch - 1;
+	uint32_t *ccr = &R(p, DMA_Channel_TypeDef, CCR);
+	uint32_t *cndtr = &R(p, DMA_Channel_TypeDef, CNDTR);
+
+	if ((*ccr & DMA_CCR_EN) == 0 || *cndtr == 0) {
+		return 0;
+	}
+
+	unsigned size = 1u << ((*ccr >> 10) & 3);
+	uintptr_t mem = (uintptr_t)R(p, DMA_Channel_TypeDef, CMAR)
+			+ (((*ccr & DMA_CCR_MINC) != 0) ? host_dma[ch].idx * size : 0);
+
+	if ((*ccr & DMA_CCR_DIR) != 0) {
+		*value = (size == 1) ? *(uint8_t *)mem : (size == 2) ? *(uint16_t *)mem : *(uint32_t *)mem;
+	} else if (size == 1) {
+		*(uint8_t *)mem = (uint8_t)*value;
+	} else if (size == 2) {
+		*(uint16_t *)mem = (uint16_t)*value;
+	} else {
+		*(uint32_t *)mem = *value;
+	}
+
+	host_dma[ch].idx++;
+	(*cndtr)--;
+
+	uint32_t flags = 0;
+	if (*cndtr == host_dma[ch].reload / 2) {
+		flags |= DMA_ISR_HTIF1;
+	}
+	if (*cndtr == 0) {
+		flags |= DMA_ISR_TCIF1;
+		if ((*ccr & DMA_CCR_CIRC) != 0) {
+			*cndtr = host_dma[ch].reload;
+			host_dma[ch].idx = 0;
+		}
+	}
+	if (flags != 0) {
+		R(HOST_DMA1, DMA_TypeDef, ISR) |= (flags | DMA_ISR_GIF1) << (4 * (ch - 1));
+	}
+	return 1;
+}
+
+static void SIM host_dma_write(int ch, unsigned w, uint32_t v)
+{
+	int p = HOST_DMA1_CH1 + ch - 1;
+	uint32_t *ccr = &R(p, DMA_Channel_TypeDef, CCR);
+
+	if (w == W(DMA_Channel_TypeDef, CCR)) {
+		uint32_t old = *ccr;
+		*ccr = v;
+		if ((v & DMA_CCR_EN) != 0 && (old & DMA_CCR_EN) == 0) {
+			host_dma[ch].reload = R(p, DMA_Channel_TypeDef, CNDTR);
+			host_dma[ch].idx = 0;
+			if (ch == 2) {
+				host_uart_kick();
+			}
+		}
+	} else if (w == W(DMA_Channel_TypeDef, CNDTR)) {
+		if ((*ccr & DMA_CCR_EN) == 0) {
+			host_reg[p][w] = v & 0xFFFF;
+		}
+	} else {
+		host_reg[p][w] = v;
+	}
+}
+
+/* ---- ADC ---- */
+
+static uint32_t host_adc_seq; //channels left in the current scan
+static int host_adc_ch = -1; //channel being converted
+static int host_adc_waiting = 0; //armed, waiting for a trigger
+
+static uint32_t SIM host_adc_code(double v)
+{
+	double code = v / host_vdda * 4095.0;
+	if (code < 0) {
+		return 0;
+	}
+	if (code > 4095) {
+		return 4095;
+	}
+	return (uint32_t)lround(code);
+}
+
+static uint32_t SIM host_adc_value(int ch, host_time_t t)
+{
+	switch (ch) {
+	case 16:
+		return host_adc_code(3.3 * (1750.0 - (host_temp_c - 30.0) * (1750.0 - 1323.0) / 80.0) / 4095.0);
+	case 17:
+		return host_adc_code(1526.0 * 3.3 / 4095.0);
+	default:
+		return host_adc_code(host_pin_volts(ch, t));
+	}
+}
+
+static host_time_t SIM host_adc_conv_time(void)
+{
+	static const double smp[8] = { 1.5, 7.5, 13.5, 28.5, 41.5, 55.5, 71.5, 239.5 };
+	return (host_time_t)llround((smp[R(HOST_ADC1, ADC_TypeDef, SMPR) & 7] + 12.5) * 48.0 / 14.0);
+}
+
+static void SIM host_adc_next_ch(host_time_t t)
+{
+	if (host_adc_seq == 0) {
+		host_adc_ch = -1;
+		host_ev[EV_ADC_CONV] = HOST_NEVER;
+		return;
+	}
+	host_adc_ch = __builtin_ctz(host_adc_seq);
+	host_adc_seq &= host_adc_seq - 1;
+	host_ev[EV_ADC_CONV] = t + host_adc_conv_time();
+}
+
+static void SIM host_adc_start_seq(host_time_t t)
+{
+	host_adc_waiting = 0;
+	host_adc_seq = R(HOST_ADC1, ADC_TypeDef, CHSELR) & 0x7FFFF;
+	host_adc_next_ch(t);
+}
+
+static void SIM host_adc_conv_done(host_time_t t)
+{
+	uint32_t *isr = &R(HOST_ADC1, ADC_TypeDef, ISR);
+	uint32_t cfgr = R(HOST_ADC1, ADC_TypeDef, CFGR1);
+	uint32_t v = host_adc_value(host_adc_ch, t);
+
+	if ((cfgr & ADC_CFGR1_AWDEN) != 0
+			&& ((cfgr & ADC_CFGR1_AWDSGL) == 0
+				|| (int)((cfgr & ADC_CFGR1_AWDCH) >> ADC_CFGR1_AWDCH_Pos) == host_adc_ch)) {
+		uint32_t tr = R(HOST_ADC1, ADC_TypeDef, TR);
+		if (v < (tr & ADC_TR_LT) || v > ((tr & ADC_TR_HT) >> ADC_TR_HT_Pos)) {
+			*isr |= ADC_ISR_AWD;
+		}
+	}
+
+	uint32_t dma_v = v;
+	if ((cfgr & ADC_CFGR1_DMAEN) != 0 && (*isr & ADC_ISR_OVR) == 0 && host_dma_request(1, &dma_v)) {
+		R(HOST_ADC1, ADC_TypeDef, DR) = v; //read by the DMA, EOC is cleared again
+	} else if ((*isr & ADC_ISR_EOC) != 0) {
+		*isr |= ADC_ISR_OVR; //OVRMOD = 0: the unread value is kept
+	} else {
+		R(HOST_ADC1, ADC_TypeDef, DR) = v;
+		*isr |= ADC_ISR_EOC;
+	}
+
+	host_adc_next_ch(t);
+	if (host_adc_ch >= 0) {
+		return;
+	}
+
+	*isr |= ADC_ISR_EOS;
+	if ((cfgr & ADC_CFGR1_CONT) != 0) {
+		host_adc_start_seq(t);
+	} else if ((cfgr & ADC_CFGR1_EXTEN) != 0) {
+		host_adc_waiting = 1;
+	} else {
+		R(HOST_ADC1, ADC_TypeDef, CR) &= ~ADC_CR_ADSTART;
+	}
+}
+
+void SIM host_adc_trigger(host_time_t t)
+{
+	uint32_t cfgr = R(HOST_ADC1, ADC_TypeDef, CFGR1);
+
+	if (host_adc_waiting && (cfgr & ADC_CFGR1_EXTEN) != 0 && (cfgr & ADC_CFGR1_EXTSEL) == 0) {
+		host_adc_start_seq(t);
+		host_resched();
+	}
+}
+
+static void SIM host_adc_write(unsigned w, uint32_t v)
+{
+	uint32_t *cr = &R(HOST_ADC1, ADC_TypeDef, CR);
+
+	switch (w) {
+	case W(ADC_TypeDef, ISR):
+		R(HOST_ADC1, ADC_TypeDef, ISR) &= ~v;
+		break;
+	case W(ADC_TypeDef, CR):
+		if ((v & ADC_CR_ADCAL) != 0 && (*cr & ADC_CR_ADEN) == 0) {
+			*cr |= ADC_CR_ADCAL;
+			host_ev[EV_ADC_CAL] = host_now + HOST_ADC_CAL;
+		}
+		if ((v & ADC_CR_ADEN) != 0 && (*cr & (ADC_CR_ADEN | ADC_CR_ADCAL)) == 0) {
+			*cr |= ADC_CR_ADEN;
+			host_ev[EV_ADC_RDY] = host_now + HOST_ADC_RDY;
+		}
+		if ((v & ADC_CR_ADDIS) != 0 && (*cr & ADC_CR_ADEN) != 0 && (*cr & ADC_CR_ADSTART) == 0) {
+			*cr |= ADC_CR_ADDIS;
+			host_ev[EV_ADC_DIS] = host_now + HOST_ADC_DIS;
+		}
+		if ((v & ADC_CR_ADSTART) != 0 && (*cr & ADC_CR_ADEN) != 0 && (*cr & ADC_CR_ADSTART) == 0
+				&& (R(HOST_ADC1, ADC_TypeDef, ISR) & ADC_ISR_ADRDY) != 0) {
+			*cr |= ADC_CR_ADSTART;
+			if ((R(HOST_ADC1, ADC_TypeDef, CFGR1) & ADC_CFGR1_EXTEN) != 0) {
+				host_adc_waiting = 1;
+			} else {
+				host_adc_start_seq(host_now);
+			}
+		}
+		if ((v & ADC_CR_ADSTP) != 0 && (*cr & ADC_CR_ADSTART) != 0) {
+			*cr |= ADC_CR_ADSTP;
+			host_ev[EV_ADC_STP] = host_now + HOST_ADC_STP;
+		}
+		break;
+	default:
+		host_reg[HOST_ADC1][w] = v;
+		break;
+	}
+}
+
+static void SIM host_adc_event(int ev)
+{
+	uint32_t *cr = &R(HOST_ADC1, ADC_TypeDef, CR);
+
+	switch (ev) {
+	case EV_ADC_CAL:
+		*cr &= ~ADC_CR_ADCAL;
+		break;
+	case EV_ADC_RDY:
+		if ((*cr & ADC_CR_ADEN) != 0) {
+			R(HOST_ADC1, ADC_TypeDef, ISR) |= ADC_ISR_ADRDY;
+		}
+		break;
+	case EV_ADC_DIS:
+		*cr &= ~(ADC_CR_ADEN | ADC_CR_ADDIS);
+		break;
+	case EV_ADC_STP:
+		*cr &= ~(ADC_CR_ADSTART | ADC_CR_ADSTP);
+		host_adc_seq = 0;
+		host_adc_ch = -1;
+		host_adc_waiting = 0;
+		host_ev[EV_ADC_CONV] = HOST_NEVER;
+		break;
+	default:
+		break;
+	}
+}
+
+/* ---- USART1 ---- */
+
+static struct {
+	uint8_t byte;
+	host_time_t end; //board time the stop bit is done
+	host_time_t start;
+} host_rx[HOST_RX_LEN];
+static size_t host_rx_head, host_rx_tail;
+static double host_rx_true; //true time the last queued byte ends
+static int host_tx_busy, host_tx_full;
+static uint8_t host_tx_shift, host_tx_tdr;
+static int host_pty = -1, host_pty_slave = -1;
+
+char host_uart_out[1 << 16];
+size_t host_uart_len = 0;
+
+void SIM host_uart_clear(void)
+{
+	host_uart_len = 0;
+}
+
+static void SIM host_tx_start(uint8_t b)
+{
+	host_tx_shift = b;
+	host_tx_busy = 1;
+	R(HOST_USART1, USART_TypeDef, ISR) &= ~USART_ISR_TC;
+	host_ev[EV_UART_TX] = host_now + 10 * (host_time_t)R(HOST_USART1, USART_TypeDef, BRR) * host_upc;
+}
+
+static void SIM host_tdr_write(uint8_t b)
+{
+	uint32_t cr1 = R(HOST_USART1, USART_TypeDef, CR1);
+
+	if ((cr1 & (USART_CR1_UE | USART_CR1_TE)) != (USART_CR1_UE | USART_CR1_TE)) {
+		return;
+	}
+	R(HOST_USART1, USART_TypeDef, ISR) &= ~USART_ISR_TC;
+	if (!host_tx_busy) {
+		host_tx_start(b);
+	} else {
+		host_tx_tdr = b;
+		host_tx_full = 1;
+	}
+}
+
+void SIM host_uart_kick(void)
+{
+	uint32_t v;
+
+	while (!host_tx_full && (R(HOST_USART1, USART_TypeDef, CR3) & USART_CR3_DMAT) != 0
+			&& (R(HOST_USART1, USART_TypeDef, CR1) & (USART_CR1_UE | USART_CR1_TE)) == (USART_CR1_UE | USART_CR1_TE)
+			&& host_dma_request(2, &v)) {
+		host_tdr_write((uint8_t)v);
+	}
+	host_resched();
+}
+
+static void SIM host_tx_done(host_time_t t)
+{
+	if (host_uart_len < sizeof(host_uart_out)) {
+		host_uart_out[host_uart_len++] = (char)host_tx_shift;
+	}
+	if (host_uart_hook != NULL) {
+		host_uart_hook(host_tx_shift, t);
+	}
+	if (host_pty >= 0 && write(host_pty, &host_tx_shift, 1) < 0) {
+		host_fatal("pty write failed");
+	}
+
+	host_tx_busy = 0;
+	host_ev[EV_UART_TX] = HOST_NEVER;
+	if (host_tx_full) {
+		host_tx_full = 0;
+		host_tx_start(host_tx_tdr);
+	}
+	host_uart_kick();
+	if (!host_tx_busy) {
+		R(HOST_USART1, USART_TypeDef, ISR) |= USART_ISR_TC;
+	}
+}
+
+void SIM host_uart_send(const char *s, size_t n)
+{
+	double now_s = host_true_s(host_now);
+	double byte_s = 10.0 / 115200.0;
+
+	if (host_rx_true < now_s) {
+		host_rx_true = now_s;
+	}
+	for (size_t i = 0; i < n; i++) {
+		size_t next = (host_rx_head + 1) % HOST_RX_LEN;
+		if (next == host_rx_tail) {
+			host_fatal("uart receive queue full");
+		}
+		host_rx[host_rx_head].byte = (uint8_t)s[i];
+		host_rx[host_rx_head].start = host_board_time(host_rx_true);
+		host_rx_true += byte_s;
+		host_rx[host_rx_head].end = host_board_time(host_rx_true);
+		host_rx_head = next;
+	}
+	if (host_ev[EV_UART_RX] == HOST_NEVER && host_rx_head != host_rx_tail) {
+		host_ev[EV_UART_RX] = host_rx[host_rx_tail].end;
+	}
+	host_resched();
+}
+
+static void SIM host_rx_done(host_time_t t)
+{
+	uint32_t cr1 = R(HOST_USART1, USART_TypeDef, CR1);
+	uint32_t v = host_rx[host_rx_tail].byte;
+	uint32_t brr = R(HOST_USART1, USART_TypeDef, BRR);
+
+	host_rx_tail = (host_rx_tail + 1) % HOST_RX_LEN;
+	host_ev[EV_UART_RX] = (host_rx_head != host_rx_tail) ? host_rx[host_rx_tail].end : HOST_NEVER;
+
+	if ((cr1 & (USART_CR1_UE | USART_CR1_RE)) != (USART_CR1_UE | USART_CR1_RE) || brr == 0) {
+		return;
+	}
+	double baud = 48e6 / host_upc / brr;
+	if (fabs(baud / 115200.0 - 1.0) > 0.03) {
+		v = 0xFF; //framing garbage
+	}
+	(void)t;
+
+	if ((R(HOST_USART1, USART_TypeDef, CR3) & USART_CR3_DMAR) != 0 && host_dma_request(3, &v)) {
+		return;
+	}
+	R(HOST_USART1, USART_TypeDef, RDR) = v;
+	R(HOST_USART1, USART_TypeDef, ISR) |= USART_ISR_RXNE;
+}
+
+static uint32_t SIM host_usart_isr(void)
+{
+	uint32_t isr = R(HOST_USART1, USART_TypeDef, ISR) & ~(USART_ISR_TXE | USART_ISR_BUSY);
+
+	if (!host_tx_full) {
+		isr |= USART_ISR_TXE;
+	}
+	if (host_rx_head != host_rx_tail && host_now >= host_rx[host_rx_tail].start) {
+		isr |= USART_ISR_BUSY;
+	}
+	return isr;
+}
+
+static void SIM host_usart_write(unsigned w, uint32_t v)
+{
+	switch (w) {
+	case W(USART_TypeDef, TDR):
+		host_tdr_write((uint8_t)v);
+		break;
+	case W(USART_TypeDef, ICR):
+		R(HOST_USART1, USART_TypeDef, ISR) &= ~(v & 0x00121B5F);
+		break;
+	case W(USART_TypeDef, ISR):
+	case W(USART_TypeDef, RDR):
+		break;
+	case W(USART_TypeDef, CR3):
+		host_reg[HOST_USART1][w] = v;
+		host_uart_kick();
+		break;
+	default:
+		host_reg[HOST_USART1][w] = v;
+		break;
+	}
+}
+
+static void SIM host_pty_poll(host_time_t t)
+{
+	char buf[256];
+	ssize_t n = read(host_pty, buf, sizeof(buf));
+
+	if (n > 0) {
+		host_uart_send(buf, (size_t)n);
+	}
+	host_ev[EV_PTY] = t + HOST_PTY_POLL;
+}
+
+const char * SIM host_uart_pty(void)
+{
+	struct termios tio;
+
+	host_pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (host_pty < 0 || grantpt(host_pty) != 0 || unlockpt(host_pty) != 0) {
+		host_fatal("cannot open a pty");
+	}
+	const char *name = ptsname(host_pty);
+	host_pty_slave = open(name, O_RDWR | O_NOCTTY); //held open so the master never sees a hang-up
+	if (host_pty_slave >= 0 && tcgetattr(host_pty_slave, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(host_pty_slave, TCSANOW, &tio);
+	}
+	fcntl(host_pty, F_SETFL, fcntl(host_pty, F_GETFL) | O_NONBLOCK);
+	host_ev[EV_PTY] = host_now + HOST_PTY_POLL;
+	host_resched();
+	return name;
+}
+
+/* ---- SPI1 and the OLED ---- */
+
+uint8_t host_oled_ram[8][132];
+static int host_oled_page, host_oled_col, host_oled_skip;
+static const unsigned char (*host_font)[8];
+static int host_font_n;
+
+void SIM host_oled_font(const unsigned char (*font)[8], int n)
+{
+	host_font = font;
+	host_font_n = n;
+}
+
+void SIM host_spi_bytes(const uint8_t *data, uint16_t n)
+{
+	uint32_t odr = R(HOST_GPIOB, GPIO_TypeDef, ODR);
+
+	if ((odr & (1u << 6)) != 0) {
+		return; //CS# high: the display is not listening
+	}
+	for (uint16_t i = 0; i < n; i++) {
+		uint8_t b = data[i];
+		if ((odr & (1u << 7)) != 0) {
+			host_oled_ram[host_oled_page][host_oled_col] = b;
+			host_oled_col = (host_oled_col + 1) % 132;
+		} else if (host_oled_skip > 0) {
+			host_oled_skip--;
+		} else if ((b & 0xF8) == 0xB0) {
+			host_oled_page = b & 7;
+		} else if ((b & 0xF0) == 0x10) {
+			host_oled_col = (host_oled_col & 0x0F) | ((b & 0x0F) << 4);
+		} else if ((b & 0xF0) == 0x00) {
+			host_oled_col = (host_oled_col & 0xF0) | (b & 0x0F);
+		} else if (b == 0x81 || b == 0xA8 || b == 0xD3 || b == 0xD5 || b == 0xD9 || b == 0xDA
+				|| b == 0xDB || b == 0x8D || b == 0x20 || b == 0xAD) {
+			host_oled_skip = 1; //command with one argument byte
+		}
+	}
+	if (host_oled_col > 131) {
+		host_oled_col %= 132;
+	}
+}
+
+const char * SIM host_oled_text(int page)
+{
+	static char text[17];
+
+	for (int c = 0; c < 16; c++) {
+		const uint8_t *cell = &host_oled_ram[page & 7][2 + 8 * c];
+		text[c] = '?';
+		for (int i = 0; i < host_font_n; i++) {
+			int ch = (i + ' ') % host_font_n; //printable glyphs first: the blank one is also ' '
+			if (memcmp(host_font[ch], cell, 8) == 0 && ch != 0) {
+				text[c] = (char)ch;
+				break;
+			}
+		}
+	}
+	text[16] = '\0';
+	return text;
+}
+
+/* ---- register dispatch ---- */
+
+uint32_t SIM host_dev_read(int p, unsigned w)
+{
+	if (host_tim_index(p) >= 0) {
+		return host_tim_read(p, w, 0);
+	}
+	switch (p) {
+	case HOST_GPIOA:
+	case HOST_GPIOB:
+		if (w == W(GPIO_TypeDef, IDR)) {
+			return host_idr(p - HOST_GPIOA);
+		}
+		break;
+	case HOST_CRC:
+		if (w == W(CRC_TypeDef, DR)) {
+			return host_crc;
+		}
+		break;
+	case HOST_USART1:
+		if (w == W(USART_TypeDef, ISR)) {
+			return host_usart_isr();
+		}
+		break;
+	case HOST_SPI1:
+		if (w == W(SPI_TypeDef, SR)) {
+			return SPI_SR_TXE;
+		}
+		break;
+	default:
+		break;
+	}
+	return host_reg[p][w];
+}
+
+void SIM host_dev_read_done(int p, unsigned w)
+{
+	if (host_tim_index(p) >= 0) {
+		host_tim_read(p, w, 1);
+	} else if (p == HOST_USART1 && w == W(USART_TypeDef, RDR)) {
+		R(HOST_USART1, USART_TypeDef, ISR) &= ~USART_ISR_RXNE;
+	} else if (p == HOST_ADC1 && w == W(ADC_TypeDef, DR)) {
+		R(HOST_ADC1, ADC_TypeDef, ISR) &= ~ADC_ISR_EOC;
+	}
+}
+
+void SIM host_dev_write(int p, unsigned w, uint32_t v)
+{
+	if (host_tim_index(p) >= 0) {
+		host_tim_write(p, w, v);
+		return;
+	}
+
+	switch (p) {
+	case HOST_GPIOA:
+	case HOST_GPIOB: {
+		uint32_t *odr = &host_reg[p][W(GPIO_TypeDef, ODR)];
+		if (w == W(GPIO_TypeDef, BSRR)) {
+			*odr = (*odr & ~(v >> 16)) | (v & 0xFFFF);
+		} else if (w == W(GPIO_TypeDef, BRR)) {
+			*odr &= ~(v & 0xFFFF);
+		} else if (w != W(GPIO_TypeDef, IDR)) {
+			host_reg[p][w] = v;
+		}
+		if (w == W(GPIO_TypeDef, MODER) && p == HOST_GPIOA) {
+			host_comp_update();
+		}
+		break;
+	}
+	case HOST_EXTI:
+		if (w == W(EXTI_TypeDef, PR)) {
+			R(HOST_EXTI, EXTI_TypeDef, PR) &= ~v;
+		} else if (w == W(EXTI_TypeDef, SWIER)) {
+			R(HOST_EXTI, EXTI_TypeDef, PR) |= v & R(HOST_EXTI, EXTI_TypeDef, IMR);
+		} else {
+			host_reg[p][w] = v;
+		}
+		break;
+	case HOST_RCC:
+		host_rcc_write(w, v);
+		break;
+	case HOST_FLASH:
+		host_flash_write(w, v);
+		break;
+	case HOST_CRC:
+		if (w == W(CRC_TypeDef, DR)) {
+			host_crc_word(v);
+		} else if (w == W(CRC_TypeDef, CR)) {
+			if ((v & CRC_CR_RESET) != 0) {
+				host_crc = R(HOST_CRC, CRC_TypeDef, INIT);
+			}
+			host_reg[p][w] = v & ~CRC_CR_RESET;
+		} else {
+			host_reg[p][w] = v;
+		}
+		break;
+	case HOST_ADC1:
+		host_adc_write(w, v);
+		break;
+	case HOST_DAC:
+		host_reg[p][w] = v;
+		if (w == W(DAC_TypeDef, DHR12R1)) {
+			R(HOST_DAC, DAC_TypeDef, DOR1) = v & 0xFFF;
+			if (host_dac_hook != NULL) {
+				host_dac_hook(v & 0xFFF, host_now);
+			}
+			host_comp_update();
+		}
+		break;
+	case HOST_COMP1:
+		host_reg[p][w] = (v & ~COMP_CSR_COMP1OUT) | (host_reg[p][w] & COMP_CSR_COMP1OUT);
+		host_comp_update();
+		break;
+	case HOST_DMA1:
+		if (w == W(DMA_TypeDef, IFCR)) {
+			R(HOST_DMA1, DMA_TypeDef, ISR) &= ~v;
+		}
+		break;
+	case HOST_DMA1_CH1:
+	case HOST_DMA1_CH2:
+	case HOST_DMA1_CH3:
+		host_dma_write(p - HOST_DMA1_CH1 + 1, w, v);
+		break;
+	case HOST_USART1:
+		host_usart_write(w, v);
+		break;
+	case HOST_SPI1:
+		if (w == W(SPI_TypeDef, DR)) {
+			uint8_t b = (uint8_t)v;
+			host_spi_bytes(&b, 1);
+		} else if (w != W(SPI_TypeDef, SR)) {
+			host_reg[p][w] = v;
+		}
+		break;
+	case HOST_SCB:
+		if (w == W(SCB_Type, ICSR)) {
+			if ((v & SCB_ICSR_PENDSVSET_Msk) != 0) {
+				host_pend(PendSV_IRQn);
+			}
+		} else {
+			host_reg[p][w] = v;
+		}
+		break;
+	default:
+		host_reg[p][w] = v;
+		break;
+	}
+	host_resched();
+}
+
+int SIM host_dev_line(int irqn)
+{
+	uint32_t pr = R(HOST_EXTI, EXTI_TypeDef, PR) & R(HOST_EXTI, EXTI_TypeDef, IMR);
+
+	switch (irqn) {
+	case EXTI0_1_IRQn: return (pr & 0x3) != 0;
+	case EXTI2_3_IRQn: return (pr & 0xC) != 0;
+	case EXTI4_15_IRQn: return (pr & 0xFFF0) != 0;
+	case DMA1_Channel1_IRQn: return host_dma_line(1);
+	case ADC1_COMP_IRQn: return (R(HOST_ADC1, ADC_TypeDef, ISR) & R(HOST_ADC1, ADC_TypeDef, IER) & 0x9F) != 0;
+	case TIM2_IRQn: return host_tim_line(HOST_TIM2);
+	case TIM3_IRQn: return host_tim_line(HOST_TIM3);
+	case TIM14_IRQn: return host_tim_line(HOST_TIM14);
+	case TIM15_IRQn: return host_tim_line(HOST_TIM15);
+	case TIM16_IRQn: return host_tim_line(HOST_TIM16);
+	case TIM17_IRQn: return host_tim_line(HOST_TIM17);
+	default: return 0;
+	}
+}
+
+int SIM host_dev_volatile(int p, unsigned w, host_time_t *change)
+{
+	if (host_tim_index(p) >= 0 && w == W(TIM_TypeDef, CNT)) {
+		*change = host_tim_cnt_change(p);
+		return 1;
+	}
+	if (p == HOST_USART1 && w == W(USART_TypeDef, ISR) && host_rx_head != host_rx_tail) {
+		*change = (host_now < host_rx[host_rx_tail].start) ? host_rx[host_rx_tail].start : host_rx[host_rx_tail].end;
+		return 1;
+	}
+	return 0;
+}
+
+uint32_t SIM host_peek(int periph, unsigned offset)
+{
+	return host_dev_read(periph, offset / 4);
+}
+
+uint32_t SIM host_dac_out(void)
+{
+	return R(HOST_DAC, DAC_TypeDef, DOR1);
+}
+
+/* ---- events ---- */
+
+host_time_t SIM host_dev_next(void)
+{
+	host_time_t best = host_tim_next();
+	host_time_t t = host_pin_next();
+
+	if (t < best) {
+		best = t;
+	}
+	for (int i = 0; i < EV_N; i++) {
+		if (host_ev[i] < best) {
+			best = host_ev[i];
+		}
+	}
+	return best;
+}
+
+void SIM host_dev_run(host_time_t t)
+{
+	host_pin_run(t);
+	host_tim_run(t);
+
+	for (int i = 0; i < EV_N; i++) {
+		if (host_ev[i] > t) {
+			continue;
+		}
+		host_time_t at = host_ev[i];
+		host_ev[i] = HOST_NEVER;
+		switch (i) {
+		case EV_PLL:
+			R(HOST_RCC, RCC_TypeDef, CR) |= RCC_CR_PLLRDY;
+			host_rcc_switch();
+			break;
+		case EV_ADC_CONV:
+			host_adc_conv_done(at);
+			break;
+		case EV_UART_TX:
+			host_tx_done(at);
+			break;
+		case EV_UART_RX:
+			host_rx_done(at);
+			break;
+		case EV_PTY:
+			host_pty_poll(at);
+			break;
+		default:
+			host_adc_event(i);
+			break;
+		}
+	}
+	host_resched();
+}
+
+void SIM host_dev_clock_change(int upc)
+{
+	host_tim_resync(upc);
+}
+
+void SIM host_dev_reset(void)
+{
+	for (int i = 0; i < EV_N; i++) {
+		host_ev[i] = HOST_NEVER;
+	}
+	host_tim_reset();
+	host_pin_reset();
+
+	R(HOST_RCC, RCC_TypeDef, CR) = 0x00000083; //HSION, HSIRDY
+	R(HOST_FLASH, FLASH_TypeDef, CR) = FLASH_CR_LOCK;
+	R(HOST_USART1, USART_TypeDef, ISR) = USART_ISR_TC | USART_ISR_TXE;
+	R(HOST_CRC, CRC_TypeDef, DR) = 0xFFFFFFFF;
+	R(HOST_CRC, CRC_TypeDef, INIT) = 0xFFFFFFFF;
+	R(HOST_GPIOA, GPIO_TypeDef, MODER) = 0x28000000; //PA13/PA14 on the debug port
+	host_crc = 0xFFFFFFFF;
+	host_flash_keys = 0;
+	host_fail_erase = 0;
+	host_fail_program = -1;
+	host_power_cut = -1;
+	host_flash_erases = 0;
+	host_flash_programs = 0;
+
+	memset(host_dma, 0, sizeof(host_dma));
+	host_adc_seq = 0;
+	host_adc_ch = -1;
+	host_adc_waiting = 0;
+
+	host_rx_head = host_rx_tail = 0;
+	host_rx_true = 0;
+	host_tx_busy = host_tx_full = 0;
+	host_uart_len = 0;
+	if (host_pty >= 0) {
+		close(host_pty);
+		close(host_pty_slave);
+		host_pty = host_pty_slave = -1;
+	}
+
+	memset(host_oled_ram, 0, sizeof(host_oled_ram));
+	host_oled_page = host_oled_col = host_oled_skip = 0;
+	host_dac_hook = NULL;
+	host_uart_hook = NULL;
+	host_pulse_hook = NULL;
+}
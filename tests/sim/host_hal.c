@@ -0,0 +1,25 @@
+// ----------------------------------------------------------------------------
+// Host simulator: HAL SPI calls. A blocking transmit keeps the core busy for the time the
+// bytes take on the wire (8 SPI clocks each) and hands them to the OLED model.
+// ----------------------------------------------------------------------------
+
+#include "host_int.h"
+#include "../stub/stm32f0xx_hal.h"
+
+HAL_StatusTypeDef SIM HAL_SPI_Init(SPI_HandleTypeDef *hspi)
+{
+	hspi->Instance->CR1 = hspi->Init.Mode | hspi->Init.Direction | hspi->Init.NSS
+			| hspi->Init.BaudRatePrescaler | hspi->Init.FirstBit | hspi->Init.CLKPolarity | hspi->Init.CLKPhase;
+	hspi->Instance->CR2 = hspi->Init.DataSize;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef SIM HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	uint32_t br = (hspi->Instance->CR1 & SPI_CR1_BR) >> 3;
+	(void)Timeout;
+
+	host_spi_bytes(pData, Size);
+	host_busy((uint64_t)Size * 8 * (2u << br));
+	return HAL_OK;
+}
@@ -0,0 +1,82 @@
+// ----------------------------------------------------------------------------
+// Host simulator internals shared by host_core.c, host_tim.c and host_dev.c.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_INT_H_
+#define HOST_INT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "host_sim.h"
+#include "../stub/stm32f0xx.h"
+
+/* Simulator code is kept out of instrumentation and out of the single-step instruction count */
+#define SIM __attribute__((section("host_sim_text"), no_instrument_function, noinline))
+
+#define HOST_WINDOW (0x40000000UL) //one page per peripheral from here
+#define HOST_PAGE (4096UL)
+#define HOST_WORDS (64)
+#define HOST_FLASH_BASE (0x0800F000UL)
+#define HOST_FLASH_SIZE (0x1000UL)
+#define HOST_SYSMEM_BASE (0x1FFFF000UL) //factory calibration values
+
+/* Register state by peripheral and word; the fault handler copies it in and out of the window */
+extern uint32_t host_reg[HOST_PERIPHS][HOST_WORDS];
+#define R(p, type, reg) host_reg[p][offsetof(type, reg) / 4]
+#define W(type, reg) (offsetof(type, reg) / 4)
+
+extern int host_upc; //time units per CPU cycle (48 MHz / SYSCLK)
+extern int host_isr_depth;
+
+/* Core services */
+void host_resched(void); //an event time may have changed
+void host_advance(host_time_t t); //process events up to t, no interrupt is taken
+void host_stall(host_time_t units); //the core is halted (flash, semihosting), events still run
+void host_busy(uint64_t cycles); //the core polls for cycles, interrupts are taken
+void host_set_upc(int upc);
+void host_pend(int irqn); //software pending (PendSV)
+void host_fatal(const char *fmt, ...);
+
+/* Devices: register access (w = word index) */
+uint32_t host_dev_read(int p, unsigned w);
+void host_dev_read_done(int p, unsigned w);
+void host_dev_write(int p, unsigned w, uint32_t v);
+int host_dev_line(int irqn); //interrupt request line level
+void host_dev_reset(void);
+int host_dev_volatile(int p, unsigned w, host_time_t *change); //value changes without an event
+
+/* Devices: events */
+host_time_t host_dev_next(void);
+void host_dev_run(host_time_t t);
+void host_dev_clock_change(int upc);
+
+/* Timers (host_tim.c) */
+int host_tim_index(int p); //0-6, -1 if p is not a timer
+uint32_t host_tim_read(int p, unsigned w, int side_effects);
+void host_tim_write(int p, unsigned w, uint32_t v);
+void host_tim_input(int p, int ti, int level, host_time_t t); //sampled edge on TIx
+int host_tim_line(int p);
+host_time_t host_tim_next(void);
+void host_tim_run(host_time_t t);
+void host_tim_resync(int new_upc);
+void host_tim_reset(void);
+host_time_t host_tim_cnt_change(int p);
+
+/* Pins and comparator (host_tim.c) */
+host_time_t host_pin_next(void);
+void host_pin_run(host_time_t t);
+void host_pin_reset(void);
+int host_pin_mode(int pin); //GPIO MODER field
+double host_pin_volts(int pin, host_time_t t);
+void host_comp_update(void); //COMP1 configuration or threshold changed
+
+/* Cross-device hooks */
+void host_adc_trigger(host_time_t t); //TIM1 TRGO
+void host_uart_kick(void);
+int host_dma_request(int ch, uint32_t *value); //1 if the channel took (or gave) a transfer
+uint32_t host_dac_out(void);
+void host_spi_bytes(const uint8_t *data, uint16_t n);
+int host_flash_program(uintptr_t addr, uint16_t old, uint16_t value); //0: the store is undone
+
+#endif // HOST_INT_H_
@@ -0,0 +1,118 @@
+// ----------------------------------------------------------------------------
+// Host simulator for the two STM32F051 applications.
+//
+// The firmware is compiled for the host against tests/stub, where every peripheral base
+// macro calls host_io(). Peripheral pages are mapped without access rights, so each register
+// access faults into the simulator, which applies the real read/write semantics, charges the
+// access to simulated time and single-steps the instruction. Interrupts are delivered between
+// accesses (and on function entry, with -finstrument-functions) by priority, like the NVIC.
+//
+// Time is board time in units of 1/48 us: one unit is one cycle at 48 MHz. A board whose
+// crystal is off by host_set_ppm() counts more or fewer units per true second.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_SIM_H_
+#define HOST_SIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef int64_t host_time_t;
+
+#define HOST_NEVER INT64_MAX
+#define HOST_US(x) ((host_time_t)((x) * 48))
+#define HOST_MS(x) ((host_time_t)((x) * 48000))
+#define HOST_S(x) ((host_time_t)((x) * 48000000))
+
+/* Pins: port A is 0-15, port B 16-31 */
+#define HOST_PA(n) (n)
+#define HOST_PB(n) (16 + (n))
+
+/* Exit status of a forked board whose power was cut by host_flash_power_cut */
+#define HOST_EXIT_POWER_CUT (77)
+
+extern host_time_t host_now; //board time
+extern uint64_t host_cycles; //CPU cycles executed (or stalled) so far
+
+/* Set-up and running */
+void host_init(void);
+void host_main_start(int (*fn)(int, char **));
+int host_main_done(void);
+void host_run_until(host_time_t t);
+void host_run(host_time_t dt);
+void host_at(host_time_t t, void (*fn)(void *), void *arg);
+pid_t host_fork(void);
+int host_wait(pid_t pid); //exit status, or 128 + signal
+
+/* Board clock against true time */
+void host_set_ppm(double ppm);
+void host_set_true_offset(double seconds); //true time at which this board's time was 0
+double host_true_s(host_time_t t);
+host_time_t host_board_time(double true_s);
+uint32_t host_sysclk(void);
+
+/* Input pins and analog sources */
+void host_pin_set(int pin, int level);
+int host_pin_get(int pin);
+void host_pin_square(int pin, double hz, double duty, host_time_t t0);
+void host_pin_edges(int pin, const host_time_t *t, size_t n, int level0);
+void host_pin_fn(int pin, host_time_t (*next)(void *ctx, host_time_t t, int *level), void *ctx);
+void host_pin_off(int pin);
+void host_analog(int pin, double (*volts)(void *ctx, host_time_t t), void *ctx);
+void host_analog_const(int pin, double volts);
+extern double host_vdda; //supply, V
+extern double host_temp_c; //die temperature, C
+
+/* USART1 */
+void host_uart_send(const char *s, size_t n);
+const char *host_uart_pty(void); //open a pseudo-terminal on USART1, returns the slave path
+extern char host_uart_out[1 << 16];
+extern size_t host_uart_len;
+void host_uart_clear(void);
+extern void (*host_uart_hook)(uint8_t byte, host_time_t t);
+
+/* OLED behind SPI1 (PB6 = CS#, PB7 = D/C#) */
+extern uint8_t host_oled_ram[8][132];
+void host_oled_font(const unsigned char (*font)[8], int n);
+const char *host_oled_text(int page); //16 character cells decoded with the registered font
+
+/* Trace output */
+const char *host_trace(void);
+void host_trace_clear(void);
+extern int host_trace_echo;
+extern host_time_t host_trace_cost; //time one trace_printf call halts the core (semihosting)
+
+/* Interrupt statistics, indexed by IRQn (PendSV_IRQn included) */
+typedef struct {
+	uint64_t count;
+	uint64_t cycles; //exclusive of nested handlers, entry and exit included
+	uint64_t max_cycles;
+	uint64_t instr; //instructions, while host_count_instructions is on
+	uint64_t max_instr;
+} host_irq_stat_t;
+host_irq_stat_t *host_irq(int irqn);
+void host_irq_reset(void); //also clears host_irq_off_max
+extern uint64_t host_irq_off_max; //longest stretch with PRIMASK set, in cycles
+extern void *host_irq_off_where; //return address of the call that started it
+void host_count_instructions(int on); //single-steps the handlers, and the main loop while PRIMASK is set
+extern int host_access_cycles; //cost of one peripheral access
+extern int host_call_cycles; //cost charged on each instrumented function entry
+
+/* Output hooks */
+extern void (*host_dac_hook)(uint32_t code, host_time_t t);
+extern void (*host_pulse_hook)(host_time_t rise, host_time_t width); //TIM17 CH1 PWM pulses
+
+/* Flash (the last 4 KB, 0x0800F000-0x0800FFFF, shared with forked boards) */
+uint8_t *host_flash(uint32_t addr);
+void host_flash_erase_all(void);
+void host_flash_poke(uint32_t addr, const void *data, size_t n); //bypasses the controller (corruption)
+void host_flash_fail_erase(int on);
+void host_flash_fail_program(int n); //the n-th half-word programmed from now fails, -1 = off
+void host_flash_power_cut(int n); //power is cut before the (n+1)-th half-word, -1 = off
+extern uint32_t host_flash_erases, host_flash_programs;
+
+/* Register state without side effects, by peripheral (HOST_TIM2, ...) and byte offset */
+uint32_t host_peek(int periph, unsigned offset);
+
+#endif // HOST_SIM_H_
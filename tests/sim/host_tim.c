@@ -0,0 +1,812 @@
+// ----------------------------------------------------------------------------
+// Host simulator: general-purpose timers, input pins (with the timer input
+// synchroniser) and COMP1.
+// ----------------------------------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+
+#include "host_int.h"
+
+#define T(t, reg) host_reg[(t)->p][W(TIM_TypeDef, reg)]
+#define HOST_TIMS (7)
+#define HOST_PINS (32)
+#define HOST_COMP_STEP (12) //comparator input sampled every 0.25 us
+
+typedef struct {
+	int p;
+	uint32_t max;
+	uint32_t psc, arr, ccr[4]; //active (shadow) values, loaded by an update event
+	uint32_t cnt; //counter at t_ref
+	host_time_t t_ref; //a tick boundary while running
+	int running; //counting the internal clock
+	host_time_t fired; //compare events up to here are done
+	uint32_t psc_cnt; //prescaler position in external clock mode
+	uint8_t ic_cnt[4]; //input capture prescaler positions
+} host_tim_t;
+
+static host_tim_t host_tims[HOST_TIMS];
+
+/* Internal trigger sources (ITR0-3) of each timer, as timer indices */
+static const int host_itr[HOST_TIMS][4] = {
+	{ -1, -1, -1, -1 }, //TIM1
+	{ 0, 4, 2, 3 }, //TIM2: TIM1, TIM15, TIM3, TIM14
+	{ 0, 1, 4, 3 }, //TIM3: TIM1, TIM2, TIM15, TIM14
+	{ -1, -1, -1, -1 }, //TIM14
+	{ 1, 2, 5, 6 }, //TIM15: TIM2, TIM3, TIM16, TIM17
+	{ -1, -1, -1, -1 }, //TIM16
+	{ -1, -1, -1, -1 }, //TIM17
+};
+
+void (*host_pulse_hook)(host_time_t rise, host_time_t width) = NULL;
+
+static void host_tim_uev(host_tim_t *t, host_time_t time, int overflow);
+
+int SIM host_tim_index(int p)
+{
+	return (p >= HOST_TIM1 && p <= HOST_TIM17) ? p - HOST_TIM1 : -1;
+}
+
+static host_time_t SIM host_tick(const host_tim_t *t)
+{
+	return (host_time_t)host_upc * ((host_time_t)t->psc + 1);
+}
+
+static uint32_t SIM host_cnt_at(const host_tim_t *t, host_time_t time)
+{
+	if (!t->running || time <= t->t_ref) {
+		return t->cnt;
+	}
+	return t->cnt + (uint32_t)((time - t->t_ref) / host_tick(t));
+}
+
+static uint32_t SIM host_ccmr(const host_tim_t *t, int c)
+{
+	uint32_t ccmr = (c < 2) ? T(t, CCMR1) : T(t, CCMR2);
+	return (ccmr >> (8 * (c & 1))) & 0xFF;
+}
+
+static volatile uint32_t * SIM host_ccr_reg(host_tim_t *t, int c)
+{
+	return &host_reg[t->p][W(TIM_TypeDef, CCR1) + c];
+}
+
+static int SIM host_pwm_out(const host_tim_t *t)
+{
+	return t->p == HOST_TIM17 && (host_ccmr(t, 0) & 3) == 0 && ((host_ccmr(t, 0) >> 4) & 6) == 6
+			&& (T(t, CCER) & TIM_CCER_CC1E) != 0 && (T(t, BDTR) & TIM_BDTR_MOE) != 0;
+}
+
+static void SIM host_tim_sync(host_tim_t *t, host_time_t now)
+{
+	int want = (T(t, CR1) & TIM_CR1_CEN) != 0 && (T(t, SMCR) & 7) != 7;
+
+	if (t->running && !want) {
+		t->cnt = host_cnt_at(t, now);
+		t->running = 0;
+	} else if (!t->running && want) {
+		t->t_ref = now;
+		t->running = 1;
+	}
+}
+
+static void SIM host_capture(host_tim_t *t, int c, host_time_t time)
+{
+	uint32_t v = host_cnt_at(t, time) & t->max;
+
+	*host_ccr_reg(t, c) = v;
+	t->ccr[c] = v;
+	if ((T(t, SR) & (TIM_SR_CC1IF << c)) != 0) {
+		T(t, SR) |= TIM_SR_CC1OF << c;
+	}
+	T(t, SR) |= TIM_SR_CC1IF << c;
+}
+
+static void SIM host_ic(host_tim_t *t, int c, host_time_t time)
+{
+	unsigned psc = (host_ccmr(t, c) >> 2) & 3;
+
+	if (++t->ic_cnt[c] >= (1u << psc)) {
+		t->ic_cnt[c] = 0;
+		host_capture(t, c, time);
+	}
+}
+
+/* One external clock edge through the prescaler */
+static void SIM host_ext_tick(host_tim_t *t, host_time_t time)
+{
+	if (++t->psc_cnt <= t->psc) {
+		return;
+	}
+	t->psc_cnt = 0;
+
+	uint32_t top = (t->cnt > t->arr) ? t->max : t->arr;
+	if (t->cnt == top) {
+		t->cnt = 0;
+		host_tim_uev(t, time, 1);
+	} else {
+		t->cnt++;
+	}
+}
+
+/* Trigger input (TRGI) edge: TRC captures, then the slave mode */
+static void SIM host_trgi(host_tim_t *t, host_time_t time)
+{
+	for (int c = 0; c < 4; c++) {
+		if ((host_ccmr(t, c) & 3) == 3 && (T(t, CCER) & (TIM_CCER_CC1E << (4 * c))) != 0) {
+			host_ic(t, c, time);
+		}
+	}
+
+	T(t, SR) |= TIM_SR_TIF;
+
+	switch (T(t, SMCR) & 7) {
+	case 4: //reset mode
+		t->cnt = 0;
+		t->t_ref = time;
+		host_tim_uev(t, time, 0);
+		break;
+	case 6: //trigger mode
+		T(t, CR1) |= TIM_CR1_CEN;
+		host_tim_sync(t, time);
+		break;
+	case 7: //external clock mode 1
+		if ((T(t, CR1) & TIM_CR1_CEN) != 0) {
+			host_ext_tick(t, time);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void SIM host_trgo(host_tim_t *src, host_time_t time)
+{
+	int s = (int)(src - host_tims);
+
+	for (int i = 0; i < HOST_TIMS; i++) {
+		host_tim_t *t = &host_tims[i];
+		unsigned ts = (T(t, SMCR) >> 4) & 7;
+		if (ts < 4 && host_itr[i][ts] == s) {
+			host_trgi(t, time);
+		}
+	}
+	if (src->p == HOST_TIM1) {
+		host_adc_trigger(time);
+	}
+}
+
+static void SIM host_tim_uev(host_tim_t *t, host_time_t time, int overflow)
+{
+	t->psc = T(t, PSC);
+	t->arr = T(t, ARR);
+	for (int c = 0; c < 4; c++) {
+		if ((host_ccmr(t, c) & 3) == 0 && (host_ccmr(t, c) & 0x08) != 0) {
+			t->ccr[c] = *host_ccr_reg(t, c);
+		}
+	}
+	t->psc_cnt = 0;
+
+	if (overflow || (T(t, CR1) & TIM_CR1_URS) == 0) {
+		T(t, SR) |= TIM_SR_UIF;
+	}
+	if (((T(t, CR2) >> 4) & 7) == 2) {
+		host_trgo(t, time);
+	}
+	if (overflow && host_pulse_hook != NULL && host_pwm_out(t) && t->ccr[0] != 0) {
+		uint64_t width = (t->ccr[0] > t->arr) ? (uint64_t)t->arr + 1 : t->ccr[0];
+		host_pulse_hook(time, (host_time_t)width * host_tick(t));
+	}
+	if (overflow && (T(t, CR1) & TIM_CR1_OPM) != 0) {
+		T(t, CR1) &= ~TIM_CR1_CEN;
+		host_tim_sync(t, time);
+	}
+}
+
+/* ---- events ---- */
+
+static host_time_t SIM host_tim_next_one(host_tim_t *t, int *which)
+{
+	if (!t->running) {
+		return HOST_NEVER;
+	}
+
+	host_time_t tick = host_tick(t);
+	uint32_t top = (t->cnt > t->arr) ? t->max : t->arr;
+	host_time_t best = t->t_ref + (host_time_t)((uint64_t)(top - t->cnt) + 1) * tick;
+	*which = -1;
+
+	for (int c = 0; c < 4; c++) {
+		uint32_t ccr = t->ccr[c];
+		if ((host_ccmr(t, c) & 3) != 0 || ccr <= t->cnt || ccr > top) {
+			continue;
+		}
+		if ((T(t, DIER) & (TIM_DIER_CC1IE << c)) == 0 && !(c == 0 && host_pwm_out(t))) {
+			continue;
+		}
+		host_time_t tc = t->t_ref + (host_time_t)(ccr - t->cnt) * tick;
+		if (tc > t->fired && tc < best) {
+			best = tc;
+			*which = c;
+		}
+	}
+	return best;
+}
+
+host_time_t SIM host_tim_next(void)
+{
+	host_time_t best = HOST_NEVER;
+	int which;
+
+	for (int i = 0; i < HOST_TIMS; i++) {
+		host_time_t n = host_tim_next_one(&host_tims[i], &which);
+		if (n < best) {
+			best = n;
+		}
+	}
+	return best;
+}
+
+void SIM host_tim_run(host_time_t time)
+{
+	for (int i = 0; i < HOST_TIMS; i++) {
+		host_tim_t *t = &host_tims[i];
+		int which;
+		host_time_t n;
+
+		while ((n = host_tim_next_one(t, &which)) <= time) {
+			if (which >= 0) {
+				T(t, SR) |= TIM_SR_CC1IF << which;
+				t->fired = n;
+			} else {
+				t->cnt = 0;
+				t->t_ref = n;
+				t->fired = n;
+				host_tim_uev(t, n, 1);
+				for (int c = 0; c < 4; c++) {
+					if ((host_ccmr(t, c) & 3) == 0 && t->ccr[c] == 0
+							&& (T(t, DIER) & (TIM_DIER_CC1IE << c)) != 0) {
+						T(t, SR) |= TIM_SR_CC1IF << c;
+					}
+				}
+			}
+		}
+	}
+}
+
+void SIM host_tim_resync(int new_upc)
+{
+	(void)new_upc;
+	for (int i = 0; i < HOST_TIMS; i++) {
+		host_tim_t *t = &host_tims[i];
+		if (t->running) {
+			t->cnt = host_cnt_at(t, host_now);
+			t->t_ref = host_now;
+		}
+	}
+}
+
+host_time_t SIM host_tim_cnt_change(int p)
+{
+	host_tim_t *t = &host_tims[host_tim_index(p)];
+
+	if (!t->running) {
+		return HOST_NEVER;
+	}
+	host_time_t tick = host_tick(t);
+	return t->t_ref + ((host_now - t->t_ref) / tick + 1) * tick;
+}
+
+/* Sampled edge on input TIx (1-4) */
+void SIM host_tim_input(int p, int ti, int level, host_time_t time)
+{
+	host_tim_t *t = &host_tims[host_tim_index(p)];
+	uint32_t ccer = T(t, CCER);
+
+	for (int c = 0; c < 4; c++) {
+		unsigned ccs = host_ccmr(t, c) & 3;
+		if (ccs == 0 || ccs == 3 || (ccer & (TIM_CCER_CC1E << (4 * c))) == 0) {
+			continue;
+		}
+		int src = (ccs == 1) ? c + 1 : (c ^ 1) + 1;
+		if (src != ti) {
+			continue;
+		}
+		int p_bit = (ccer >> (4 * c + 1)) & 1;
+		int np_bit = (ccer >> (4 * c + 3)) & 1;
+		if ((p_bit && np_bit) || level == !p_bit) {
+			host_ic(t, c, time);
+		}
+	}
+
+	unsigned ts = (T(t, SMCR) >> 4) & 7;
+	if (ts == 4 && ti == 1) {
+		host_trgi(t, time);
+	} else if ((ts == 5 && ti == 1) || (ts == 6 && ti == 2)) {
+		int c = ti - 1;
+		int p_bit = (ccer >> (4 * c + 1)) & 1;
+		int np_bit = (ccer >> (4 * c + 3)) & 1;
+		if ((p_bit && np_bit) || level == !p_bit) {
+			host_trgi(t, time);
+		}
+	}
+	host_resched();
+}
+
+int SIM host_tim_line(int p)
+{
+	return (host_reg[p][W(TIM_TypeDef, SR)] & host_reg[p][W(TIM_TypeDef, DIER)] & 0x5F) != 0;
+}
+
+/* ---- registers ---- */
+
+uint32_t SIM host_tim_read(int p, unsigned w, int side_effects)
+{
+	host_tim_t *t = &host_tims[host_tim_index(p)];
+
+	if (w == W(TIM_TypeDef, CNT)) {
+		return host_cnt_at(t, host_now) & t->max;
+	}
+	if (w == W(TIM_TypeDef, EGR)) {
+		return 0;
+	}
+	if (side_effects && w >= W(TIM_TypeDef, CCR1) && w <= W(TIM_TypeDef, CCR4)) {
+		int c = (int)(w - W(TIM_TypeDef, CCR1));
+		if ((host_ccmr(t, c) & 3) != 0) {
+			T(t, SR) &= ~(TIM_SR_CC1IF << c); //reading a capture clears its flag
+		}
+	}
+	return host_reg[p][w];
+}
+
+void SIM host_tim_write(int p, unsigned w, uint32_t v)
+{
+	host_tim_t *t = &host_tims[host_tim_index(p)];
+	uint32_t old = host_reg[p][w];
+
+	switch (w) {
+	case W(TIM_TypeDef, SR):
+		T(t, SR) = old & v; //rc_w0
+		break;
+	case W(TIM_TypeDef, EGR):
+		if ((v & TIM_EGR_UG) != 0) {
+			t->cnt = 0;
+			t->t_ref = host_now;
+			t->fired = host_now - 1;
+			host_tim_uev(t, host_now, 0);
+		}
+		break;
+	case W(TIM_TypeDef, CNT):
+		if (t->running) {
+			host_time_t tick = host_tick(t);
+			t->t_ref += ((host_now - t->t_ref) / tick) * tick;
+		}
+		t->cnt = v & t->max;
+		t->fired = host_now;
+		break;
+	case W(TIM_TypeDef, ARR):
+		T(t, ARR) = v & t->max;
+		if ((T(t, CR1) & TIM_CR1_ARPE) == 0) {
+			if (t->running) {
+				t->cnt = host_cnt_at(t, host_now);
+				t->t_ref = host_now;
+			}
+			t->arr = v & t->max;
+		}
+		break;
+	case W(TIM_TypeDef, CCER):
+		T(t, CCER) = v;
+		for (int c = 0; c < 4; c++) {
+			if ((v & (TIM_CCER_CC1E << (4 * c))) == 0) {
+				t->ic_cnt[c] = 0; //clearing CCxE resets the capture prescaler
+			}
+		}
+		break;
+	case W(TIM_TypeDef, CCR1):
+	case W(TIM_TypeDef, CCR2):
+	case W(TIM_TypeDef, CCR3):
+	case W(TIM_TypeDef, CCR4): {
+		int c = (int)(w - W(TIM_TypeDef, CCR1));
+		if ((host_ccmr(t, c) & 3) == 0) {
+			host_reg[p][w] = v & t->max;
+			if ((host_ccmr(t, c) & 0x08) == 0) {
+				t->ccr[c] = v & t->max;
+			}
+		}
+		break;
+	}
+	case W(TIM_TypeDef, CR1):
+	case W(TIM_TypeDef, SMCR):
+		host_reg[p][w] = v;
+		host_tim_sync(t, host_now);
+		break;
+	default:
+		host_reg[p][w] = v;
+		break;
+	}
+	host_resched();
+}
+
+void SIM host_tim_reset(void)
+{
+	memset(host_tims, 0, sizeof(host_tims));
+	for (int i = 0; i < HOST_TIMS; i++) {
+		host_tim_t *t = &host_tims[i];
+		t->p = HOST_TIM1 + i;
+		t->max = (t->p == HOST_TIM2) ? 0xFFFFFFFFu : 0xFFFFu;
+		t->arr = t->max;
+		T(t, ARR) = t->max;
+		t->fired = -1;
+	}
+}
+
+/* ---- pins ---- */
+
+typedef struct {
+	int level;
+	int gen; //0 none, 1 square, 2 edge list, 3 callback
+	double period, duty;
+	host_time_t t0;
+	int64_t edge; //square: index of the next edge (even = rising)
+	const host_time_t *list;
+	size_t n, i;
+	host_time_t (*fn)(void *, host_time_t, int *);
+	void *ctx;
+	int fn_level;
+	host_time_t next;
+	double (*volts)(void *, host_time_t);
+	void *vctx;
+	double vconst;
+	int sync_level; //level the timer input synchroniser last passed on
+	host_time_t sync_at;
+} host_pin_t;
+
+static host_pin_t host_pins[HOST_PINS];
+static int host_comp_out = 0;
+static host_time_t host_comp_next = HOST_NEVER;
+double host_vdda = 3.3;
+double host_temp_c = 30.0;
+
+int SIM host_pin_mode(int pin)
+{
+	int p = (pin < 16) ? HOST_GPIOA : HOST_GPIOB;
+	return (int)((R(p, GPIO_TypeDef, MODER) >> (2 * (pin & 15))) & 3);
+}
+
+static int SIM host_pin_af(int pin)
+{
+	int p = (pin < 16) ? HOST_GPIOA : HOST_GPIOB;
+	uint32_t afr = host_reg[p][W(GPIO_TypeDef, AFR) + ((pin & 15) >> 3)];
+	return (int)((afr >> (4 * (pin & 7))) & 0xF);
+}
+
+/* Timer input a pin drives in its current alternate function, 0 if none */
+static int SIM host_pin_route(int pin, int *ti)
+{
+	int af = host_pin_af(pin);
+
+	switch (pin) {
+	case HOST_PA(0): *ti = 1; return (af == 2) ? HOST_TIM2 : -1;
+	case HOST_PA(1): *ti = 2; return (af == 2) ? HOST_TIM2 : -1;
+	case HOST_PA(2): *ti = (af == 2) ? 3 : 1; return (af == 2) ? HOST_TIM2 : (af == 0) ? HOST_TIM15 : -1;
+	case HOST_PA(3): *ti = (af == 2) ? 4 : 2; return (af == 2) ? HOST_TIM2 : (af == 0) ? HOST_TIM15 : -1;
+	case HOST_PA(7): *ti = 1; return (af == 5) ? HOST_TIM17 : -1;
+	default: return -1;
+	}
+}
+
+double SIM host_pin_volts(int pin, host_time_t t)
+{
+	host_pin_t *s = &host_pins[pin];
+
+	if (s->volts != NULL) {
+		return s->volts(s->vctx, t);
+	}
+	return s->level ? host_vdda : 0.0;
+}
+
+static double SIM host_comp_threshold(void)
+{
+	uint32_t csr = R(HOST_COMP1, COMP_TypeDef, CSR);
+	double vref = 1526.0 / 4095.0 * 3.3;
+
+	switch ((csr >> COMP_CSR_COMP1INSEL_Pos) & 7) {
+	case 0: return vref / 4;
+	case 1: return vref / 2;
+	case 2: return vref * 3 / 4;
+	case 4: return host_dac_out() / 4095.0 * host_vdda;
+	default: return vref;
+	}
+}
+
+static void SIM host_comp_eval(host_time_t t)
+{
+	uint32_t csr = R(HOST_COMP1, COMP_TypeDef, CSR);
+	static const double hyst[4] = { 0.0, 0.008, 0.015, 0.031 };
+
+	if ((csr & COMP_CSR_COMP1EN) == 0) {
+		return;
+	}
+
+	double v = host_pin_volts(HOST_PA(1), t);
+	double thr = host_comp_threshold();
+	double h = hyst[(csr >> COMP_CSR_COMP1HYST_Pos) & 3] / 2;
+	int out = host_comp_out;
+
+	if (out == 0 && v > thr + h) {
+		out = 1;
+	} else if (out != 0 && v < thr - h) {
+		out = 0;
+	}
+	if (out == host_comp_out) {
+		return;
+	}
+	host_comp_out = out;
+
+	int level = out ^ (int)((csr & COMP_CSR_COMP1POL) != 0);
+	if (level) {
+		R(HOST_COMP1, COMP_TypeDef, CSR) |= COMP_CSR_COMP1OUT;
+	} else {
+		R(HOST_COMP1, COMP_TypeDef, CSR) &= ~COMP_CSR_COMP1OUT;
+	}
+	if ((csr & COMP_CSR_COMP1OUTSEL) == COMP_CSR_COMP1OUTSEL_2) {
+		host_tim_input(HOST_TIM2, 4, level, t); //100: TIM2 IC4
+	}
+}
+
+void SIM host_comp_update(void)
+{
+	uint32_t csr = R(HOST_COMP1, COMP_TypeDef, CSR);
+
+	if ((csr & COMP_CSR_COMP1EN) != 0 && host_pins[HOST_PA(1)].volts != NULL) {
+		if (host_comp_next == HOST_NEVER) {
+			host_comp_next = (host_now / HOST_COMP_STEP + 1) * HOST_COMP_STEP;
+		}
+	} else {
+		host_comp_next = HOST_NEVER;
+	}
+	host_comp_eval(host_now);
+	host_resched();
+}
+
+static void SIM host_pin_edge(int pin, int level, host_time_t t)
+{
+	host_pin_t *s = &host_pins[pin];
+	int mode = host_pin_mode(pin);
+	int ti;
+
+	if (level == s->level) {
+		return;
+	}
+	s->level = level;
+
+	if (mode == 3) {
+		if (pin == HOST_PA(1) && s->volts == NULL) {
+			host_comp_eval(t); //a digital source on the comparator input
+		}
+		return; //analog: no Schmitt trigger, so neither EXTI nor the timers see it
+	}
+	if (mode == 1) {
+		return;
+	}
+
+	if (pin < 16) {
+		unsigned sel = (R(HOST_SYSCFG, SYSCFG_TypeDef, EXTICR[pin >> 2]) >> (4 * (pin & 3))) & 0xF;
+		if (sel == 0) {
+			uint32_t bit = 1u << pin;
+			uint32_t trig = level ? R(HOST_EXTI, EXTI_TypeDef, RTSR) : R(HOST_EXTI, EXTI_TypeDef, FTSR);
+			if ((trig & bit) != 0 && (R(HOST_EXTI, EXTI_TypeDef, IMR) & bit) != 0) {
+				R(HOST_EXTI, EXTI_TypeDef, PR) |= bit;
+			}
+		}
+	}
+
+	if (mode == 2 && host_pin_route(pin, &ti) >= 0 && s->sync_at == HOST_NEVER) {
+		s->sync_at = (t / host_upc + 1) * host_upc; //resynchronised to the timer clock
+	}
+	host_resched();
+}
+
+static void SIM host_gen_next(host_pin_t *s, host_time_t after)
+{
+	switch (s->gen) {
+	case 1:
+		for (;;) {
+			double k = (double)(s->edge >> 1) + ((s->edge & 1) ? s->duty : 0.0);
+			host_time_t t = s->t0 + (host_time_t)llround(k * s->period);
+			if (t > after || s->edge == 0) {
+				s->next = (t < after) ? after : t;
+				return;
+			}
+			s->edge++;
+		}
+	case 2:
+		s->next = (s->i < s->n) ? s->list[s->i] : HOST_NEVER;
+		return;
+	case 3:
+		s->next = s->fn(s->ctx, after, &s->fn_level);
+		return;
+	default:
+		s->next = HOST_NEVER;
+		return;
+	}
+}
+
+host_time_t SIM host_pin_next(void)
+{
+	host_time_t best = host_comp_next;
+
+	for (int i = 0; i < HOST_PINS; i++) {
+		host_pin_t *s = &host_pins[i];
+		if (s->next < best) {
+			best = s->next;
+		}
+		if (s->sync_at < best) {
+			best = s->sync_at;
+		}
+	}
+	return best;
+}
+
+void SIM host_pin_run(host_time_t time)
+{
+	for (;;) {
+		host_time_t best = HOST_NEVER;
+		int pin = -1, kind = 0;
+
+		for (int i = 0; i < HOST_PINS; i++) {
+			host_pin_t *s = &host_pins[i];
+			if (s->sync_at < best) {
+				best = s->sync_at;
+				pin = i;
+				kind = 1;
+			}
+			if (s->next < best) {
+				best = s->next;
+				pin = i;
+				kind = 0;
+			}
+		}
+		if (host_comp_next < best) {
+			best = host_comp_next;
+			kind = 2;
+		}
+		if (best > time) {
+			return;
+		}
+
+		if (kind == 2) {
+			host_comp_eval(best);
+			host_comp_next = best + HOST_COMP_STEP;
+			continue;
+		}
+
+		host_pin_t *s = &host_pins[pin];
+		if (kind == 1) {
+			int ti;
+			int p = host_pin_route(pin, &ti);
+			s->sync_at = HOST_NEVER;
+			if (host_pin_mode(pin) == 2 && p >= 0 && s->level != s->sync_level) {
+				s->sync_level = s->level;
+				host_tim_input(p, ti, s->level, best);
+			}
+			continue;
+		}
+
+		int level;
+		switch (s->gen) {
+		case 1:
+			level = (s->edge & 1) == 0;
+			s->edge++;
+			break;
+		case 2:
+			s->i++;
+			level = !s->level;
+			break;
+		default:
+			level = s->fn_level;
+			break;
+		}
+		host_pin_edge(pin, level, best);
+		host_gen_next(s, best);
+	}
+}
+
+void SIM host_pin_reset(void)
+{
+	memset(host_pins, 0, sizeof(host_pins));
+	for (int i = 0; i < HOST_PINS; i++) {
+		host_pins[i].next = HOST_NEVER;
+		host_pins[i].sync_at = HOST_NEVER;
+	}
+	host_comp_out = 0;
+	host_comp_next = HOST_NEVER;
+	host_vdda = 3.3;
+	host_temp_c = 30.0;
+}
+
+void SIM host_pin_off(int pin)
+{
+	host_pins[pin].gen = 0;
+	host_pins[pin].next = HOST_NEVER;
+	host_resched();
+}
+
+void SIM host_pin_set(int pin, int level)
+{
+	host_pin_off(pin);
+	host_pin_edge(pin, level != 0, host_now);
+}
+
+int SIM host_pin_get(int pin)
+{
+	if (host_pin_mode(pin) == 1) {
+		int p = (pin < 16) ? HOST_GPIOA : HOST_GPIOB;
+		return (int)((R(p, GPIO_TypeDef, ODR) >> (pin & 15)) & 1);
+	}
+	return host_pins[pin].level;
+}
+
+void SIM host_pin_square(int pin, double hz, double duty, host_time_t t0)
+{
+	host_pin_t *s = &host_pins[pin];
+
+	host_pin_set(pin, 0);
+	s->gen = 1;
+	s->period = 48e6 / hz;
+	s->duty = duty;
+	s->t0 = (t0 < host_now) ? host_now : t0;
+	s->edge = 0;
+	host_gen_next(s, host_now);
+	host_resched();
+}
+
+void SIM host_pin_edges(int pin, const host_time_t *t, size_t n, int level0)
+{
+	host_pin_t *s = &host_pins[pin];
+
+	host_pin_set(pin, level0);
+	s->gen = 2;
+	s->list = t;
+	s->n = n;
+	s->i = 0;
+	while (s->i < n && t[s->i] < host_now) {
+		s->i++;
+		host_pin_edge(pin, !s->level, host_now);
+	}
+	host_gen_next(s, host_now);
+	host_resched();
+}
+
+void SIM host_pin_fn(int pin, host_time_t (*next)(void *ctx, host_time_t t, int *level), void *ctx)
+{
+	host_pin_t *s = &host_pins[pin];
+
+	host_pin_off(pin);
+	s->gen = 3;
+	s->fn = next;
+	s->ctx = ctx;
+	host_gen_next(s, host_now);
+	host_resched();
+}
+
+void SIM host_analog(int pin, double (*volts)(void *ctx, host_time_t t), void *ctx)
+{
+	host_pins[pin].volts = volts;
+	host_pins[pin].vctx = ctx;
+	if (pin == HOST_PA(1)) {
+		host_comp_update();
+	}
+}
+
+static double SIM host_const_volts(void *ctx, host_time_t t)
+{
+	(void)t;
+	return *(double *)ctx;
+}
+
+void SIM host_analog_const(int pin, double volts)
+{
+	host_pins[pin].vconst = volts;
+	host_analog(pin, host_const_volts, &host_pins[pin].vconst);
+}
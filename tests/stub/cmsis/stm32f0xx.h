@@ -0,0 +1,2 @@
+// Host stand-in: the device header lives one level up in tests/stub.
+#include "../stm32f0xx.h"
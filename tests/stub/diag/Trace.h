@@ -0,0 +1,13 @@
+// ----------------------------------------------------------------------------
+// Host stand-in for the semihosting trace channel. The simulator collects the output
+// (host_trace()) and halts the simulated core for host_trace_cost per call.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_DIAG_TRACE_H_
+#define HOST_DIAG_TRACE_H_
+
+int trace_printf(const char *format, ...);
+int trace_puts(const char *s);
+int trace_putchar(int c);
+
+#endif // HOST_DIAG_TRACE_H_
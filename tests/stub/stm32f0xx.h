@@ -0,0 +1,470 @@
+// ----------------------------------------------------------------------------
+// Host stand-in for the STM32F051 CMSIS device header.
+//
+// Register layouts and bit values are those of system/include/cmsis/stm32f051x8.h, so the
+// firmware compiles unchanged. The difference is the peripheral base macros: host_io()
+// (tests/sim/host_core.c) delivers any due interrupt and returns the peripheral's page in a
+// window mapped without access rights, so the access itself traps into the simulator, which
+// applies it with the register's read/write semantics.
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_STM32F0XX_H_
+#define HOST_STM32F0XX_H_
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __I volatile const
+
+/* Interrupt numbers (only the ones the two applications use are wired in the simulator) */
+typedef enum {
+	NonMaskableInt_IRQn = -14,
+	HardFault_IRQn = -13,
+	SVC_IRQn = -5,
+	PendSV_IRQn = -2,
+	SysTick_IRQn = -1,
+	WWDG_IRQn = 0,
+	PVD_IRQn = 1,
+	RTC_IRQn = 2,
+	FLASH_IRQn = 3,
+	RCC_IRQn = 4,
+	EXTI0_1_IRQn = 5,
+	EXTI2_3_IRQn = 6,
+	EXTI4_15_IRQn = 7,
+	TSC_IRQn = 8,
+	DMA1_Channel1_IRQn = 9,
+	DMA1_Channel2_3_IRQn = 10,
+	DMA1_Channel4_5_IRQn = 11,
+	ADC1_COMP_IRQn = 12,
+	TIM1_BRK_UP_TRG_COM_IRQn = 13,
+	TIM1_CC_IRQn = 14,
+	TIM2_IRQn = 15,
+	TIM3_IRQn = 16,
+	TIM6_DAC_IRQn = 17,
+	TIM14_IRQn = 19,
+	TIM15_IRQn = 20,
+	TIM16_IRQn = 21,
+	TIM17_IRQn = 22,
+	I2C1_IRQn = 23,
+	I2C2_IRQn = 24,
+	SPI1_IRQn = 25,
+	SPI2_IRQn = 26,
+	USART1_IRQn = 27,
+	USART2_IRQn = 28,
+	CEC_CAN_IRQn = 30
+} IRQn_Type;
+
+/* Register blocks */
+
+typedef struct {
+	__IO uint32_t ISR, IER, CR, CFGR1, CFGR2, SMPR;
+	uint32_t RESERVED1, RESERVED2;
+	__IO uint32_t TR;
+	uint32_t RESERVED3;
+	__IO uint32_t CHSELR;
+	uint32_t RESERVED4[5];
+	__IO uint32_t DR;
+} ADC_TypeDef;
+
+typedef struct {
+	__IO uint32_t CCR;
+} ADC_Common_TypeDef;
+
+typedef struct {
+	__IO uint32_t CSR;
+} COMP_TypeDef;
+
+typedef struct {
+	__IO uint32_t DR;
+	__IO uint8_t IDR;
+	uint8_t RESERVED0;
+	uint16_t RESERVED1;
+	__IO uint32_t CR;
+	uint32_t RESERVED2;
+	__IO uint32_t INIT;
+} CRC_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR, SWTRIGR, DHR12R1, DHR12L1, DHR8R1, DHR12R2, DHR12L2, DHR8R2;
+	__IO uint32_t DHR12RD, DHR12LD, DHR8RD, DOR1, DOR2, SR;
+} DAC_TypeDef;
+
+typedef struct {
+	__IO uint32_t CCR, CNDTR, CPAR, CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+	__IO uint32_t ISR, IFCR;
+} DMA_TypeDef;
+
+typedef struct {
+	__IO uint32_t IMR, EMR, RTSR, FTSR, SWIER, PR;
+} EXTI_TypeDef;
+
+typedef struct {
+	__IO uint32_t ACR, KEYR, OPTKEYR, SR, CR, AR;
+	uint32_t RESERVED;
+	__IO uint32_t OBR, WRPR;
+} FLASH_TypeDef;
+
+typedef struct {
+	__IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR;
+	__IO uint32_t AFR[2];
+	__IO uint32_t BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+	__IO uint32_t CFGR1;
+	uint32_t RESERVED;
+	__IO uint32_t EXTICR[4];
+	__IO uint32_t CFGR2;
+} SYSCFG_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR, CFGR, CIR, APB2RSTR, APB1RSTR, AHBENR, APB2ENR, APB1ENR;
+	__IO uint32_t BDCR, CSR, AHBRSTR, CFGR2, CFGR3, CR2;
+} RCC_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR1, CR2, SR, DR, CRCPR, RXCRCR, TXCRCR, I2SCFGR, I2SPR;
+} SPI_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR, RCR;
+	__IO uint32_t CCR1, CCR2, CCR3, CCR4;
+	__IO uint32_t BDTR, DCR, DMAR, OR;
+} TIM_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR1, CR2, CR3, BRR, GTPR, RTOR, RQR, ISR, ICR, RDR, TDR;
+} USART_TypeDef;
+
+typedef struct {
+	__I uint32_t CPUID;
+	__IO uint32_t ICSR;
+	uint32_t RESERVED0;
+	__IO uint32_t AIRCR, SCR, CCR;
+	uint32_t RESERVED1;
+	__IO uint32_t SHP[2];
+	__IO uint32_t SHCSR;
+} SCB_Type;
+
+/* Peripheral instances: every use is one access, announced to the simulator */
+
+enum {
+	HOST_TIM1, HOST_TIM2, HOST_TIM3, HOST_TIM14, HOST_TIM15, HOST_TIM16, HOST_TIM17,
+	HOST_GPIOA, HOST_GPIOB, HOST_EXTI, HOST_SYSCFG, HOST_RCC, HOST_FLASH,
+	HOST_ADC1, HOST_ADC, HOST_DAC, HOST_COMP1, HOST_CRC,
+	HOST_DMA1, HOST_DMA1_CH1, HOST_DMA1_CH2, HOST_DMA1_CH3,
+	HOST_USART1, HOST_SPI1, HOST_SCB,
+	HOST_PERIPHS
+};
+
+void *host_io(int periph);
+
+#define TIM1 ((TIM_TypeDef *)host_io(HOST_TIM1))
+#define TIM2 ((TIM_TypeDef *)host_io(HOST_TIM2))
+#define TIM3 ((TIM_TypeDef *)host_io(HOST_TIM3))
+#define TIM14 ((TIM_TypeDef *)host_io(HOST_TIM14))
+#define TIM15 ((TIM_TypeDef *)host_io(HOST_TIM15))
+#define TIM16 ((TIM_TypeDef *)host_io(HOST_TIM16))
+#define TIM17 ((TIM_TypeDef *)host_io(HOST_TIM17))
+#define GPIOA ((GPIO_TypeDef *)host_io(HOST_GPIOA))
+#define GPIOB ((GPIO_TypeDef *)host_io(HOST_GPIOB))
+#define EXTI ((EXTI_TypeDef *)host_io(HOST_EXTI))
+#define SYSCFG ((SYSCFG_TypeDef *)host_io(HOST_SYSCFG))
+#define RCC ((RCC_TypeDef *)host_io(HOST_RCC))
+#define FLASH ((FLASH_TypeDef *)host_io(HOST_FLASH))
+#define ADC1 ((ADC_TypeDef *)host_io(HOST_ADC1))
+#define ADC ((ADC_Common_TypeDef *)host_io(HOST_ADC))
+#define DAC ((DAC_TypeDef *)host_io(HOST_DAC))
+#define COMP1 ((COMP_TypeDef *)host_io(HOST_COMP1))
+#define CRC ((CRC_TypeDef *)host_io(HOST_CRC))
+#define DMA1 ((DMA_TypeDef *)host_io(HOST_DMA1))
+#define DMA1_Channel1 ((DMA_Channel_TypeDef *)host_io(HOST_DMA1_CH1))
+#define DMA1_Channel2 ((DMA_Channel_TypeDef *)host_io(HOST_DMA1_CH2))
+#define DMA1_Channel3 ((DMA_Channel_TypeDef *)host_io(HOST_DMA1_CH3))
+#define USART1 ((USART_TypeDef *)host_io(HOST_USART1))
+#define SPI1 ((SPI_TypeDef *)host_io(HOST_SPI1))
+#define SCB ((SCB_Type *)host_io(HOST_SCB))
+
+/* Core: PRIMASK and the NVIC, implemented by the simulator */
+
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irq);
+uint32_t NVIC_GetEnableIRQ(IRQn_Type irq);
+void NVIC_SetPendingIRQ(IRQn_Type irq);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+
+extern uint32_t SystemCoreClock;
+void SystemCoreClockUpdate(void);
+
+#define SET_BIT(REG, BIT) ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT) ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT) ((REG) & (BIT))
+
+#define SCB_ICSR_PENDSVSET_Msk (1UL << 28)
+
+/* ADC */
+#define ADC_ISR_ADRDY (0x00000001UL)
+#define ADC_ISR_EOSMP (0x00000002UL)
+#define ADC_ISR_EOC (0x00000004UL)
+#define ADC_ISR_EOS (0x00000008UL)
+#define ADC_ISR_OVR (0x00000010UL)
+#define ADC_ISR_AWD (0x00000080UL)
+#define ADC_IER_ADRDYIE (0x00000001UL)
+#define ADC_IER_EOCIE (0x00000004UL)
+#define ADC_IER_OVRIE (0x00000010UL)
+#define ADC_IER_AWDIE (0x00000080UL)
+#define ADC_CR_ADEN (0x00000001UL)
+#define ADC_CR_ADDIS (0x00000002UL)
+#define ADC_CR_ADSTART (0x00000004UL)
+#define ADC_CR_ADSTP (0x00000010UL)
+#define ADC_CR_ADCAL (0x80000000UL)
+#define ADC_CFGR1_DMAEN (0x00000001UL)
+#define ADC_CFGR1_DMACFG (0x00000002UL)
+#define ADC_CFGR1_EXTSEL (0x000001C0UL)
+#define ADC_CFGR1_EXTEN (0x00000C00UL)
+#define ADC_CFGR1_EXTEN_0 (0x00000400UL)
+#define ADC_CFGR1_OVRMOD (0x00001000UL)
+#define ADC_CFGR1_CONT (0x00002000UL)
+#define ADC_CFGR1_AWDSGL (0x00400000UL)
+#define ADC_CFGR1_AWDEN (0x00800000UL)
+#define ADC_CFGR1_AWDCH_Pos (26U)
+#define ADC_CFGR1_AWDCH (0x7C000000UL)
+#define ADC_SMPR_SMP (0x00000007UL)
+#define ADC_TR_LT (0x00000FFFUL)
+#define ADC_TR_HT_Pos (16U)
+#define ADC_TR_HT (0x0FFF0000UL)
+#define ADC_CHSELR_CHSEL5 (0x00000020UL)
+#define ADC_CHSELR_CHSEL16 (0x00010000UL)
+#define ADC_CHSELR_CHSEL17 (0x00020000UL)
+#define ADC_CCR_VREFEN (0x00400000UL)
+#define ADC_CCR_TSEN (0x00800000UL)
+
+/* COMP */
+#define COMP_CSR_COMP1EN (0x00000001UL)
+#define COMP_CSR_COMP1MODE (0x0000000CUL)
+#define COMP_CSR_COMP1INSEL_Pos (4U)
+#define COMP_CSR_COMP1INSEL (0x00000070UL)
+#define COMP_CSR_COMP1OUTSEL (0x00000700UL)
+#define COMP_CSR_COMP1OUTSEL_2 (0x00000400UL)
+#define COMP_CSR_COMP1POL (0x00000800UL)
+#define COMP_CSR_COMP1HYST_Pos (12U)
+#define COMP_CSR_COMP1HYST (0x00003000UL)
+#define COMP_CSR_COMP1OUT (0x00004000UL)
+
+/* CRC */
+#define CRC_CR_RESET (0x00000001UL)
+
+/* DAC */
+#define DAC_CR_EN1 (0x00000001UL)
+
+/* DMA */
+#define DMA_ISR_GIF1 (0x00000001UL)
+#define DMA_ISR_TCIF1 (0x00000002UL)
+#define DMA_ISR_HTIF1 (0x00000004UL)
+#define DMA_IFCR_CGIF1 (0x00000001UL)
+#define DMA_CCR_EN (0x00000001UL)
+#define DMA_CCR_TCIE (0x00000002UL)
+#define DMA_CCR_DIR (0x00000010UL)
+#define DMA_CCR_CIRC (0x00000020UL)
+#define DMA_CCR_MINC (0x00000080UL)
+#define DMA_CCR_PSIZE_0 (0x00000100UL)
+#define DMA_CCR_MSIZE_0 (0x00000400UL)
+
+/* EXTI */
+#define EXTI_IMR_IM0 (0x00000001UL)
+#define EXTI_IMR_IM1 (0x00000002UL)
+#define EXTI_IMR_IM2 (0x00000004UL)
+#define EXTI_RTSR_TR0 (0x00000001UL)
+#define EXTI_PR_PR0 (0x00000001UL)
+
+/* FLASH */
+#define FLASH_ACR_LATENCY (0x00000001UL)
+#define FLASH_SR_BSY (0x00000001UL)
+#define FLASH_SR_PGERR (0x00000004UL)
+#define FLASH_SR_WRPRTERR (0x00000010UL)
+#define FLASH_SR_EOP (0x00000020UL)
+#define FLASH_CR_PG (0x00000001UL)
+#define FLASH_CR_PER (0x00000002UL)
+#define FLASH_CR_STRT (0x00000040UL)
+#define FLASH_CR_LOCK (0x00000080UL)
+#define FLASH_KEY1 (0x45670123UL)
+#define FLASH_KEY2 (0xCDEF89ABUL)
+
+/* GPIO: two bits per pin in MODER/PUPDR, four in AFR, one in IDR/ODR, set/reset halves in BSRR */
+#define GPIO_MODER_MODER_(n) (0x3UL << (2 * (n)))
+#define GPIO_MODER_MODER1 GPIO_MODER_MODER_(1)
+#define GPIO_MODER_MODER1_1 (0x2UL << 2)
+#define GPIO_MODER_MODER2 GPIO_MODER_MODER_(2)
+#define GPIO_MODER_MODER2_1 (0x2UL << 4)
+#define GPIO_MODER_MODER3 GPIO_MODER_MODER_(3)
+#define GPIO_MODER_MODER3_1 (0x2UL << 6)
+#define GPIO_MODER_MODER4 GPIO_MODER_MODER_(4)
+#define GPIO_MODER_MODER4_0 (0x1UL << 8)
+#define GPIO_MODER_MODER5 GPIO_MODER_MODER_(5)
+#define GPIO_MODER_MODER5_1 (0x2UL << 10)
+#define GPIO_MODER_MODER6 GPIO_MODER_MODER_(6)
+#define GPIO_MODER_MODER6_0 (0x1UL << 12)
+#define GPIO_MODER_MODER7 GPIO_MODER_MODER_(7)
+#define GPIO_MODER_MODER7_0 (0x1UL << 14)
+#define GPIO_MODER_MODER7_1 (0x2UL << 14)
+#define GPIO_MODER_MODER9 GPIO_MODER_MODER_(9)
+#define GPIO_MODER_MODER9_1 (0x2UL << 18)
+#define GPIO_MODER_MODER10 GPIO_MODER_MODER_(10)
+#define GPIO_MODER_MODER10_1 (0x2UL << 20)
+#define GPIO_PUPDR_PUPDR1 (0x3UL << 2)
+#define GPIO_PUPDR_PUPDR2 (0x3UL << 4)
+#define GPIO_PUPDR_PUPDR3 (0x3UL << 6)
+#define GPIO_PUPDR_PUPDR4 (0x3UL << 8)
+#define GPIO_PUPDR_PUPDR5 (0x3UL << 10)
+#define GPIO_PUPDR_PUPDR6 (0x3UL << 12)
+#define GPIO_PUPDR_PUPDR7 (0x3UL << 14)
+#define GPIO_PUPDR_PUPDR10 (0x3UL << 20)
+#define GPIO_PUPDR_PUPDR10_0 (0x1UL << 20)
+#define GPIO_AFRL_AFSEL1_Pos (4U)
+#define GPIO_AFRL_AFSEL1 (0xFUL << GPIO_AFRL_AFSEL1_Pos)
+#define GPIO_AFRL_AFSEL2_Pos (8U)
+#define GPIO_AFRL_AFSEL2 (0xFUL << GPIO_AFRL_AFSEL2_Pos)
+#define GPIO_AFRL_AFSEL3_Pos (12U)
+#define GPIO_AFRL_AFSEL3 (0xFUL << GPIO_AFRL_AFSEL3_Pos)
+#define GPIO_AFRL_AFSEL5_Pos (20U)
+#define GPIO_AFRL_AFSEL5 (0xFUL << GPIO_AFRL_AFSEL5_Pos)
+#define GPIO_AFRL_AFSEL7_Pos (28U)
+#define GPIO_AFRL_AFSEL7 (0xFUL << GPIO_AFRL_AFSEL7_Pos)
+#define GPIO_AFRH_AFSEL9_Pos (4U)
+#define GPIO_AFRH_AFSEL9 (0xFUL << GPIO_AFRH_AFSEL9_Pos)
+#define GPIO_AFRH_AFSEL10_Pos (8U)
+#define GPIO_AFRH_AFSEL10 (0xFUL << GPIO_AFRH_AFSEL10_Pos)
+#define GPIO_IDR_0 (0x00000001UL)
+#define GPIO_BSRR_BS_4 (1UL << 4)
+#define GPIO_BSRR_BS_6 (1UL << 6)
+#define GPIO_BSRR_BS_7 (1UL << 7)
+#define GPIO_BSRR_BR_4 (1UL << 20)
+#define GPIO_BSRR_BR_6 (1UL << 22)
+#define GPIO_BSRR_BR_7 (1UL << 23)
+
+/* RCC */
+#define RCC_CR_PLLON (0x01000000UL)
+#define RCC_CR_PLLRDY (0x02000000UL)
+#define RCC_CFGR_SW_Msk (0x00000003UL)
+#define RCC_CFGR_SW_HSI (0x00000000UL)
+#define RCC_CFGR_SW_PLL (0x00000002UL)
+#define RCC_CFGR_SWS (0x0000000CUL)
+#define RCC_CFGR_SWS_HSI (0x00000000UL)
+#define RCC_CFGR_SWS_PLL (0x00000008UL)
+#define RCC_CFGR_PLLSRC (0x00018000UL)
+#define RCC_CFGR_PLLMUL_Pos (18U)
+#define RCC_CFGR_PLLMUL (0x003C0000UL)
+#define RCC_AHBENR_DMA1EN (0x00000001UL)
+#define RCC_AHBENR_CRCEN (0x00000040UL)
+#define RCC_AHBENR_GPIOAEN (0x00020000UL)
+#define RCC_AHBENR_GPIOBEN (0x00040000UL)
+#define RCC_APB2ENR_SYSCFGCOMPEN (0x00000001UL)
+#define RCC_APB2ENR_ADCEN (0x00000200UL)
+#define RCC_APB2ENR_TIM1EN (0x00000800UL)
+#define RCC_APB2ENR_SPI1EN (0x00001000UL)
+#define RCC_APB2ENR_USART1EN (0x00004000UL)
+#define RCC_APB2ENR_TIM15EN (0x00010000UL)
+#define RCC_APB2ENR_TIM16EN (0x00020000UL)
+#define RCC_APB2ENR_TIM17EN (0x00040000UL)
+#define RCC_APB1ENR_TIM2EN (0x00000001UL)
+#define RCC_APB1ENR_TIM3EN (0x00000002UL)
+#define RCC_APB1ENR_TIM14EN (0x00000100UL)
+#define RCC_APB1ENR_DACEN (0x20000000UL)
+
+/* SPI */
+#define SPI_CR1_BR (0x00000038UL)
+#define SPI_CR1_SPE (0x00000040UL)
+#define SPI_SR_TXE (0x00000002UL)
+
+/* SYSCFG */
+#define SYSCFG_EXTICR1_EXTI0_PA (0x00000000UL)
+
+/* TIM */
+#define TIM_CR1_CEN (0x00000001UL)
+#define TIM_CR1_UDIS (0x00000002UL)
+#define TIM_CR1_URS (0x00000004UL)
+#define TIM_CR1_OPM (0x00000008UL)
+#define TIM_CR1_ARPE (0x00000080UL)
+#define TIM_CR2_MMS (0x00000070UL)
+#define TIM_CR2_MMS_1 (0x00000020UL)
+#define TIM_SMCR_SMS (0x00000007UL)
+#define TIM_SMCR_SMS_2 (0x00000004UL)
+#define TIM_SMCR_TS (0x00000070UL)
+#define TIM_SMCR_TS_0 (0x00000010UL)
+#define TIM_SMCR_TS_1 (0x00000020UL)
+#define TIM_SMCR_TS_2 (0x00000040UL)
+#define TIM_DIER_UIE (0x00000001UL)
+#define TIM_DIER_CC1IE (0x00000002UL)
+#define TIM_DIER_CC2IE (0x00000004UL)
+#define TIM_DIER_CC3IE (0x00000008UL)
+#define TIM_DIER_CC4IE (0x00000010UL)
+#define TIM_SR_UIF (0x00000001UL)
+#define TIM_SR_CC1IF (0x00000002UL)
+#define TIM_SR_CC2IF (0x00000004UL)
+#define TIM_SR_CC3IF (0x00000008UL)
+#define TIM_SR_CC4IF (0x00000010UL)
+#define TIM_SR_TIF (0x00000040UL)
+#define TIM_SR_CC1OF (0x00000200UL)
+#define TIM_SR_CC2OF (0x00000400UL)
+#define TIM_SR_CC3OF (0x00000800UL)
+#define TIM_SR_CC4OF (0x00001000UL)
+#define TIM_EGR_UG (0x00000001UL)
+#define TIM_CCMR1_CC1S (0x00000003UL)
+#define TIM_CCMR1_CC1S_0 (0x00000001UL)
+#define TIM_CCMR1_CC1S_1 (0x00000002UL)
+#define TIM_CCMR1_IC1PSC (0x0000000CUL)
+#define TIM_CCMR1_OC1PE (0x00000008UL)
+#define TIM_CCMR1_IC1F (0x000000F0UL)
+#define TIM_CCMR1_OC1M (0x00000070UL)
+#define TIM_CCMR1_OC1M_1 (0x00000020UL)
+#define TIM_CCMR1_OC1M_2 (0x00000040UL)
+#define TIM_CCMR1_CC2S (0x00000300UL)
+#define TIM_CCMR1_CC2S_0 (0x00000100UL)
+#define TIM_CCMR1_CC2S_1 (0x00000200UL)
+#define TIM_CCMR1_IC2PSC_Pos (10U)
+#define TIM_CCMR1_IC2PSC (0x00000C00UL)
+#define TIM_CCMR1_IC2F (0x0000F000UL)
+#define TIM_CCMR2_CC3S (0x00000003UL)
+#define TIM_CCMR2_CC3S_0 (0x00000001UL)
+#define TIM_CCMR2_IC3PSC_Pos (2U)
+#define TIM_CCMR2_IC3PSC (0x0000000CUL)
+#define TIM_CCMR2_IC3F (0x000000F0UL)
+#define TIM_CCMR2_CC4S_0 (0x00000100UL)
+#define TIM_CCMR2_IC4PSC_Pos (10U)
+#define TIM_CCMR2_IC4PSC (0x00000C00UL)
+#define TIM_CCER_CC1E (0x00000001UL)
+#define TIM_CCER_CC1P (0x00000002UL)
+#define TIM_CCER_CC1NP (0x00000008UL)
+#define TIM_CCER_CC2E (0x00000010UL)
+#define TIM_CCER_CC2P (0x00000020UL)
+#define TIM_CCER_CC2NP (0x00000080UL)
+#define TIM_CCER_CC3E (0x00000100UL)
+#define TIM_CCER_CC3P (0x00000200UL)
+#define TIM_CCER_CC3NP (0x00000800UL)
+#define TIM_CCER_CC4E (0x00001000UL)
+#define TIM_CCER_CC4P (0x00002000UL)
+#define TIM_CCER_CC4NP (0x00008000UL)
+#define TIM_BDTR_MOE (0x00008000UL)
+
+/* USART */
+#define USART_CR1_UE (0x00000001UL)
+#define USART_CR1_RE (0x00000004UL)
+#define USART_CR1_TE (0x00000008UL)
+#define USART_CR3_DMAR (0x00000040UL)
+#define USART_CR3_DMAT (0x00000080UL)
+#define USART_CR3_OVRDIS (0x00001000UL)
+#define USART_ISR_RXNE (0x00000020UL)
+#define USART_ISR_TC (0x00000040UL)
+#define USART_ISR_TXE (0x00000080UL)
+#define USART_ISR_BUSY (0x00010000UL)
+
+#endif // HOST_STM32F0XX_H_
@@ -0,0 +1,59 @@
+// ----------------------------------------------------------------------------
+// Host stand-in for the parts of the STM32F0 HAL the Main Project uses: SPI1 set-up and
+// blocking transmit to the OLED (tests/sim/host_hal.c).
+// ----------------------------------------------------------------------------
+
+#ifndef HOST_STM32F0XX_HAL_H_
+#define HOST_STM32F0XX_HAL_H_
+
+#include <stdint.h>
+
+#include "stm32f0xx.h"
+
+typedef enum {
+	HAL_OK = 0,
+	HAL_ERROR = 1,
+	HAL_BUSY = 2,
+	HAL_TIMEOUT = 3
+} HAL_StatusTypeDef;
+
+typedef struct {
+	uint32_t Mode;
+	uint32_t Direction;
+	uint32_t DataSize;
+	uint32_t CLKPolarity;
+	uint32_t CLKPhase;
+	uint32_t NSS;
+	uint32_t BaudRatePrescaler;
+	uint32_t FirstBit;
+	uint32_t TIMode;
+	uint32_t CRCCalculation;
+	uint32_t CRCPolynomial;
+	uint32_t CRCLength;
+	uint32_t NSSPMode;
+} SPI_InitTypeDef;
+
+typedef struct {
+	SPI_TypeDef *Instance;
+	SPI_InitTypeDef Init;
+} SPI_HandleTypeDef;
+
+#define SPI_MODE_MASTER (0x00000104U)
+#define SPI_DIRECTION_1LINE (0x00008000U)
+#define SPI_DATASIZE_8BIT (0x00000700U)
+#define SPI_POLARITY_LOW (0x00000000U)
+#define SPI_PHASE_1EDGE (0x00000000U)
+#define SPI_NSS_SOFT (0x00000200U)
+#define SPI_BAUDRATEPRESCALER_2 (0x00000000U)
+#define SPI_BAUDRATEPRESCALER_4 (0x00000008U)
+#define SPI_BAUDRATEPRESCALER_8 (0x00000010U)
+#define SPI_BAUDRATEPRESCALER_16 (0x00000018U)
+#define SPI_FIRSTBIT_MSB (0x00000000U)
+#define HAL_MAX_DELAY (0xFFFFFFFFU)
+
+#define __HAL_SPI_ENABLE(__HANDLE__) ((__HANDLE__)->Instance->CR1 |= SPI_CR1_SPE)
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+
+#endif // HOST_STM32F0XX_HAL_H_
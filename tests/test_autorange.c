@@ -0,0 +1,56 @@
+// ----------------------------------------------------------------------------
+// Auto-ranging frequency counter on PA1 from 1 Hz to 5 MHz: every gate resolves
+// AR_TARGET_PPM or better and reads the input within that, Freq is right to whole Hz, and the
+// reported measurement time matches the gate.
+// ----------------------------------------------------------------------------
+
+#include <math.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+int main(void)
+{
+	static const double freqs[] = {
+		1.0, 3.7, 12.3, 101.3, 1234.5, 12345.6, 98765.4, 456789.0, 1234567.0, 3300000.0, 5000000.0,
+	};
+
+	host_init();
+	host_pin_square(HOST_PA(1), freqs[0], 0.5, HOST_MS(50));
+	host_main_start(firmware_main);
+	host_run_until(HOST_MS(100));
+
+	for (size_t i = 0; i < sizeof(freqs) / sizeof(freqs[0]); i++) {
+		double f = freqs[i];
+
+		host_pin_square(HOST_PA(1), f, 0.5, host_now);
+		host_run((host_time_t)(HOST_S(3) / f) + HOST_MS(500)); //a few periods, then settle
+
+		/* a fresh reading, taken with this input only */
+		Freq = 0;
+		host_run((host_time_t)(HOST_S(2) / f) + HOST_MS(300));
+
+		/* the gate itself: edges over span, before Freq rounds it to whole Hz */
+		double f_gate = (double)ar_edges * timer_clock / ar_span;
+		double ppm = (f_gate - f) / f * 1e6;
+		CHECK(meas_ppm <= AR_TARGET_PPM, "%.1f Hz: resolution %u ppm", f, meas_ppm);
+		CHECK(fabs(ppm) <= 2e6 / ar_span, "%.1f Hz: gate reads %.3f Hz (%.2f ppm over %u ticks)",
+				f, f_gate, ppm, ar_span);
+		CHECK(fabs(Freq - f) <= 0.5 + f * AR_TARGET_PPM * 2e-6, "%.1f Hz: Freq %u", f, Freq);
+
+		/* the gate covers at least AR_TARGET_COUNTS ticks, or a single period below that rate */
+		double gate_s = meas_time_us / 1e6;
+		double min_gate = fmin((double)AR_TARGET_COUNTS / timer_clock, 1.0 / f) * 0.99;
+		CHECK(gate_s >= min_gate && gate_s <= 1.5 / f + 0.2, "%.1f Hz: measured over %u us", f, meas_time_us);
+
+		printf("  %10.1f Hz: Freq %8u, gate error %6.2f ppm (resolution %2u ppm) over %7u us, IC prescaler /%d%s\n",
+				f, Freq, ppm, meas_ppm, meas_time_us, 1 << ar_psc, ar_hw ? ", hardware count" : "");
+	}
+
+	CHECK(!host_main_done(), "main returned");
+	return check_done("autorange");
+}
@@ -0,0 +1,32 @@
+// ----------------------------------------------------------------------------
+// Main Project on the host: boots to the welcome frame, then shows the PA1 frequency.
+// ----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+int main(void)
+{
+	host_init();
+	host_oled_font(Characters, 128);
+	host_pin_square(HOST_PA(1), 1000.0, 0.5, 0);
+	host_main_start(firmware_main);
+
+	host_run_until(HOST_MS(300));
+	CHECK(SystemCoreClock == 48000000, "clock %u", SystemCoreClock);
+	CHECK(strncmp(host_oled_text(0), "Hi Guoliang! :)", 15) == 0, "page 0 '%s'", host_oled_text(0));
+
+	host_run_until(HOST_S(3));
+	CHECK(strstr(host_trace(), "boot: splash at") != NULL, "trace '%s'", host_trace());
+	CHECK(Freq >= 999 && Freq <= 1001, "Freq %u", (unsigned)Freq);
+	CHECK(strncmp(host_oled_text(4), "Freq: ", 6) == 0, "page 4 '%s'", host_oled_text(4));
+	CHECK(!host_main_done(), "main returned");
+
+	return check_done("boot");
+}
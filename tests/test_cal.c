@@ -0,0 +1,219 @@
+// ----------------------------------------------------------------------------
+// Calibration record in flash: round trip, every kind of damaged page, flash errors,
+// and power cut at each step of cal_save followed by a reboot.
+// ----------------------------------------------------------------------------
+
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+#define CAL_HALF_WORDS (sizeof(cal_record_t) / 2)
+
+static const cal_record_t *stored = (const cal_record_t *)CAL_FLASH_ADDR;
+
+/* Put a record with a valid CRC on the page without going through the flash controller */
+static void store(cal_record_t rec)
+{
+	rec.crc = cal_crc((const uint32_t *)&rec, (sizeof(cal_record_t) / 4) - 1);
+	host_flash_poke(CAL_FLASH_ADDR, &rec, sizeof(rec));
+}
+
+static void set_cal(int32_t ppm, uint32_t gain, int32_t offset)
+{
+	cal.clk_ppm = ppm;
+	cal.pot_gain = gain;
+	cal.pot_offset = offset;
+}
+
+static int is_default(void)
+{
+	return cal.clk_ppm == 0 && cal.pot_gain == CAL_GAIN_ONE && cal.pot_offset == 0
+			&& cal.magic == CAL_MAGIC && cal.version == CAL_VERSION;
+}
+
+static void loads_default(const char *what)
+{
+	set_cal(1234, 1, 1);
+	cal_load();
+	CHECK(is_default(), "%s: ppm %d gain %u offset %d", what, (int)cal.clk_ppm,
+			(unsigned)cal.pot_gain, (int)cal.pot_offset);
+	CHECK(timer_clock == SystemCoreClock, "%s: timer_clock %u", what, (unsigned)timer_clock);
+}
+
+static void round_trip(void)
+{
+	uint32_t erases = host_flash_erases, programs = host_flash_programs;
+
+	set_cal(150, 0x12345, -7);
+	CHECK(cal_save() == 0, "cal_save failed");
+	CHECK(host_flash_erases - erases == 1, "%u erases", (unsigned)(host_flash_erases - erases));
+	CHECK(host_flash_programs - programs == CAL_HALF_WORDS, "%u half-words",
+			(unsigned)(host_flash_programs - programs));
+	CHECK((FLASH->CR & FLASH_CR_LOCK) != 0, "flash left unlocked");
+
+	set_cal(0, 0, 0);
+	cal_load();
+	CHECK(cal.clk_ppm == 150 && cal.pot_gain == 0x12345 && cal.pot_offset == -7,
+			"loaded ppm %d gain %x offset %d", (int)cal.clk_ppm, (unsigned)cal.pot_gain, (int)cal.pot_offset);
+	CHECK(timer_clock == SystemCoreClock + SystemCoreClock / 1000000 * 150, "timer_clock %u",
+			(unsigned)timer_clock);
+}
+
+static void damaged_pages(void)
+{
+	cal_record_t good = { CAL_MAGIC, CAL_VERSION, 0x20000, 5, 300, 0 };
+	cal_record_t rec;
+	uint8_t byte;
+
+	host_flash_erase_all();
+	loads_default("erased page");
+
+	store(good);
+	set_cal(0, 0, 0);
+	cal_load();
+	CHECK(cal.clk_ppm == 300 && cal.pot_gain == 0x20000, "valid record not loaded");
+
+	byte = *host_flash(CAL_FLASH_ADDR + offsetof(cal_record_t, pot_offset)) ^ 0x10;
+	host_flash_poke(CAL_FLASH_ADDR + offsetof(cal_record_t, pot_offset), &byte, 1);
+	loads_default("flipped data bit");
+
+	store(good);
+	byte = *host_flash(CAL_FLASH_ADDR + offsetof(cal_record_t, crc)) ^ 0x01;
+	host_flash_poke(CAL_FLASH_ADDR + offsetof(cal_record_t, crc), &byte, 1);
+	loads_default("flipped crc bit");
+
+	rec = good;
+	rec.magic = 0xFFFF;
+	store(rec);
+	loads_default("bad magic");
+
+	rec = good;
+	rec.version = CAL_VERSION + 1;
+	store(rec);
+	loads_default("newer layout");
+
+	rec = good;
+	rec.clk_ppm = CAL_PPM_LIMIT + 1;
+	store(rec);
+	loads_default("ppm above limit");
+
+	rec = good;
+	rec.clk_ppm = -CAL_PPM_LIMIT - 1;
+	store(rec);
+	loads_default("ppm below limit");
+
+	rec = good;
+	rec.clk_ppm = -CAL_PPM_LIMIT;
+	store(rec);
+	cal_load();
+	CHECK(cal.clk_ppm == -CAL_PPM_LIMIT, "limit itself rejected");
+}
+
+static void flash_errors(void)
+{
+	cal_record_t good = { CAL_MAGIC, CAL_VERSION, CAL_GAIN_ONE, 0, 42, 0 };
+
+	/* A write-protected page cannot be erased: the old record stays and is still loaded */
+	store(good);
+	host_flash_fail_erase(1);
+	set_cal(-99, CAL_GAIN_ONE, 0);
+	CHECK(cal_save() != 0, "erase error not reported");
+	host_flash_fail_erase(0);
+	CHECK((FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPRTERR)) == 0, "error flags left set");
+	CHECK((FLASH->CR & FLASH_CR_LOCK) != 0, "flash left unlocked");
+	cal_load();
+	CHECK(cal.clk_ppm == 42, "old record lost, ppm %d", (int)cal.clk_ppm);
+
+	/* A half-word that fails to program leaves a partial record, which must not load */
+	host_flash_fail_program(3);
+	set_cal(-99, CAL_GAIN_ONE, 0);
+	CHECK(cal_save() != 0, "program error not reported");
+	host_flash_fail_program(-1);
+	CHECK((FLASH->CR & (FLASH_CR_LOCK | FLASH_CR_PG)) == FLASH_CR_LOCK, "CR %x", (unsigned)FLASH->CR);
+	loads_default("partial record");
+
+	/* The next save recovers the page */
+	set_cal(-99, CAL_GAIN_ONE, 0);
+	CHECK(cal_save() == 0, "save after error failed");
+	cal_load();
+	CHECK(cal.clk_ppm == -99, "ppm %d", (int)cal.clk_ppm);
+}
+
+/* Power is cut before the erase (n = 0) or after n half-words; the next boot must load
+ * either the old record, the new one, or the defaults, never a mix */
+static void power_cuts(void)
+{
+	for (int n = 0; n <= (int)CAL_HALF_WORDS; n++) {
+		set_cal(100, CAL_GAIN_ONE, 0);
+		CHECK(cal_save() == 0, "n=%d: old record not saved", n);
+
+		pid_t pid = host_fork();
+		if (pid == 0) {
+			set_cal(-200, 0x8000, 3);
+			host_flash_power_cut(n);
+			_exit(cal_save() == 0 ? 0 : 1);
+		}
+		int status = host_wait(pid);
+		int whole = (n == (int)CAL_HALF_WORDS);
+		CHECK(status == (whole ? 0 : HOST_EXIT_POWER_CUT), "n=%d: exit %d", n, status);
+
+		set_cal(7, 7, 7);
+		cal_load();
+		if (n == 0) {
+			CHECK(cal.clk_ppm == 100, "n=0: old record lost, ppm %d", (int)cal.clk_ppm);
+		} else if (whole) {
+			CHECK(cal.clk_ppm == -200 && cal.pot_gain == 0x8000 && cal.pot_offset == 3,
+					"n=%d: new record not loaded", n);
+		} else {
+			CHECK(is_default(), "n=%d: partial record loaded, ppm %d", n, (int)cal.clk_ppm);
+		}
+	}
+}
+
+/* A full boot after a cut in the middle of the record runs uncalibrated, then saves again */
+static void reboot_after_cut(void)
+{
+	set_cal(100, CAL_GAIN_ONE, 0);
+	cal_save();
+	pid_t pid = host_fork();
+	if (pid == 0) {
+		set_cal(-200, CAL_GAIN_ONE, 0);
+		host_flash_power_cut(CAL_HALF_WORDS / 2);
+		cal_save();
+		_exit(0);
+	}
+	CHECK(host_wait(pid) == HOST_EXIT_POWER_CUT, "no power cut");
+
+	host_init();
+	host_main_start(firmware_main);
+	host_run_until(HOST_MS(300));
+	CHECK(is_default(), "boot loaded ppm %d", (int)cal.clk_ppm);
+	CHECK(timer_clock == 48000000, "timer_clock %u", (unsigned)timer_clock);
+	CHECK(stored->magic != CAL_MAGIC || stored->crc != cal_crc((const uint32_t *)stored, 4),
+			"damaged page reads as valid");
+
+	set_cal(-200, CAL_GAIN_ONE, 0);
+	CHECK(cal_save() == 0, "save after reboot failed");
+	cal_load();
+	CHECK(cal.clk_ppm == -200 && timer_clock == 48000000 - 9600, "timer_clock %u", (unsigned)timer_clock);
+}
+
+int main(void)
+{
+	host_init();
+
+	loads_default("fresh part");
+	round_trip();
+	damaged_pages();
+	flash_errors();
+	power_cuts();
+	reboot_after_cut();
+
+	return check_done("cal");
+}
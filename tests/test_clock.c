@@ -0,0 +1,110 @@
+// ----------------------------------------------------------------------------
+// Clock scaling: the policy drops to 8 or 24 MHz once the reading is stable and comes back
+// to 48 MHz on activity, and every reading taken on the way (Freq, the PWM high time, the
+// millisecond clock, the UART) stays correct across each switch.
+// ----------------------------------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+static int seen[3]; //passes spent at each clock level
+static int switches;
+static uint16_t last_level = CLK_LEVEL_48MHZ;
+static uint16_t last_ms;
+
+static void command(const char *line, const char *reply)
+{
+	host_uart_clear();
+	host_uart_send(line, strlen(line));
+	host_run(HOST_MS(2 * MAIN_LOOP_MS));
+	CHECK(strstr(host_uart_out, reply) != NULL, "%s answered '%s', expected '%s'", line, host_uart_out, reply);
+}
+
+//Function to run one main loop pass at a time, checking the readings after every one of them
+static void watch(const char *what, double f, double high_ns, host_time_t dt)
+{
+	host_time_t end = host_now + dt;
+	int bad = 0;
+
+	last_ms = ms_now();
+	while (host_now < end) {
+		host_run(HOST_MS(MAIN_LOOP_MS));
+		seen[clk_level]++;
+		switches += (clk_level != last_level);
+		last_level = clk_level;
+
+		/* the millisecond clock keeps counting through the prescaler changes (a switch restarts
+		 * the prescaler, so it may drop the part of a millisecond already counted) */
+		uint16_t ms = ms_now() - last_ms;
+		last_ms = ms_now();
+		CHECK((ms >= MAIN_LOOP_MS - 2 && ms <= MAIN_LOOP_MS + 1) || bad++ > 5, "%s: %u ms in one pass at %u MHz",
+				what, ms, SystemCoreClock / 1000000);
+
+		if (high_ns == 0) {
+			CHECK(fabs(Freq - f) <= 1 + f * 20e-6 || bad++ > 5, "%s: Freq %u at %u MHz (t %.1f s)",
+					what, Freq, SystemCoreClock / 1000000, host_now / 48e6);
+		} else {
+			/* one tick of the slowest clock on each edge, plus the input synchroniser */
+			CHECK(fabs(pwm_high_ns - high_ns) <= 2 * 125 + 50 || bad++ > 5, "%s: high %u ns at %u MHz (t %.1f s)",
+					what, pwm_high_ns, SystemCoreClock / 1000000, host_now / 48e6);
+		}
+	}
+}
+
+int main(void)
+{
+	host_init();
+	host_trace_cost = 0;
+	host_pin_square(HOST_PA(1), 100.0, 0.5, 0);
+	host_main_start(firmware_main);
+	host_run_until(HOST_S(2));
+
+	/* a slow input: 8 MHz once it has been stable for CLK_IDLE_MS */
+	watch("100 Hz", 100.0, 0, HOST_MS(CLK_IDLE_MS) + HOST_S(3));
+	CHECK(clk_level == CLK_LEVEL_8MHZ, "100 Hz: clock %u MHz", SystemCoreClock / 1000000);
+	CHECK(host_sysclk() == SystemCoreClock, "RCC runs at %u Hz, SystemCoreClock %u", host_sysclk(), SystemCoreClock);
+
+	/* a command is answered at the baud rate of the slow clock, then speeds the unit up */
+	command("CLK\r\n", "OK MHZ=8 AUTO=1");
+	watch("after CLK", 100.0, 0, HOST_S(1));
+	CHECK(clk_level == CLK_LEVEL_48MHZ, "after CLK: clock %u MHz", SystemCoreClock / 1000000);
+
+	/* more capture interrupts than CLK_LOW_EDGE_RATE: 24 MHz */
+	host_pin_square(HOST_PA(1), 5000.0, 0.5, host_now);
+	host_run(HOST_S(1));
+	watch("5 kHz", 5000.0, 0, HOST_MS(CLK_IDLE_MS) + HOST_S(3));
+	CHECK(clk_level == CLK_LEVEL_24MHZ, "5 kHz: clock %u MHz (%u edges per capture)", SystemCoreClock / 1000000, 1 << ar_psc);
+
+	/* pinned switches in quick succession */
+	host_pin_square(HOST_PA(1), 1000.0, 0.5, host_now);
+	host_run(HOST_S(1));
+	static const char *const pins[] = { "CLK 8", "CLK 48", "CLK 24", "CLK 8", "CLK 48" };
+	for (size_t i = 0; i < sizeof(pins) / sizeof(pins[0]); i++) {
+		char line[16];
+		snprintf(line, sizeof(line), "%s\r\n", pins[i]);
+		command(line, "OK");
+		host_run(HOST_MS(2 * MAIN_LOOP_MS)); //the gate running across the switch is dropped
+		watch(pins[i], 1000.0, 0, HOST_S(1));
+	}
+	command("CLK AUTO\r\n", "OK");
+
+	/* PWM on PA1: a 3 Hz, 25 % wave is slow enough for 8 MHz; no period timed across a switch
+	 * shows up as a high time */
+	command("MODE PWM\r\n", "OK");
+	host_pin_square(HOST_PA(1), 3.0, 0.25, host_now);
+	host_run(HOST_S(2));
+	watch("PWM 3 Hz", 3.0, 0.25 / 3.0 * 1e9, HOST_MS(CLK_IDLE_MS) + HOST_S(3));
+	CHECK(clk_level == CLK_LEVEL_8MHZ, "PWM 3 Hz: clock %u MHz", SystemCoreClock / 1000000);
+
+	printf("  %d switches; passes at 8/24/48 MHz: %d/%d/%d\n", switches, seen[CLK_LEVEL_8MHZ],
+			seen[CLK_LEVEL_24MHZ], seen[CLK_LEVEL_48MHZ]);
+	CHECK(!host_main_done(), "main returned");
+	return check_done("clock");
+}
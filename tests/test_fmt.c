@@ -0,0 +1,86 @@
+// ----------------------------------------------------------------------------
+// fmt.c against snprintf: every width and decimal count around each power of ten, the
+// 32- and 64-bit extremes, a pseudo-random sample, and the SI forms. fmt_exhaustive.c
+// covers the whole 32-bit range.
+// ----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "fmt_ref.h"
+
+static void check_digits(uint32_t v)
+{
+	char ref[32];
+
+	for (uint16_t dec = 0; dec <= 3; dec++) {
+		for (uint16_t width = 0; width <= 12; width++) {
+			fmt_ref_digits(ref, v, width, dec);
+			out_len = 0;
+			fmt_digits(out_put, v, width, dec);
+			out[out_len] = '\0';
+			CHECK(strcmp(out, ref) == 0, "%u w%u d%u: '%s', expected '%s'", v, width, dec, out, ref);
+		}
+	}
+
+	fmt_ref_si(ref, v, "Hz");
+	out_len = 0;
+	fmt_si(out_put, v, "Hz");
+	out[out_len] = '\0';
+	CHECK(strcmp(out, ref) == 0, "SI %u: '%s', expected '%s'", v, out, ref);
+}
+
+static void check_uint64(uint64_t v)
+{
+	char ref[32];
+
+	snprintf(ref, sizeof(ref), "%llu", (unsigned long long)v);
+	out_len = 0;
+	fmt_uint64(out_put, v);
+	out[out_len] = '\0';
+	CHECK(strcmp(out, ref) == 0, "%s: '%s'", ref, out);
+}
+
+int main(void)
+{
+	static const struct {
+		uint32_t v;
+		const char *text;
+	} si[] = {
+		{ 0, "    0 Hz" }, { 999, "  999 Hz" }, { 1000, "1.000 kHz" }, { 1234, "1.234 kHz" },
+		{ 99999, "99.99 kHz" }, { 999999, "999.9 kHz" }, { 1000000, "1.000 MHz" },
+		{ 12345678, "12.34 MHz" }, { 999999999, "999.9 MHz" }, { 4294967295u, "4294.9 MHz" },
+	};
+	uint64_t p = 1;
+	uint32_t x = 12345;
+
+	/* every power of ten and its neighbours, where the digit count changes */
+	for (int i = 0; i < 10; i++, p *= 10) {
+		check_digits((uint32_t)p - 1);
+		check_digits((uint32_t)p);
+		check_digits((uint32_t)p + 1);
+	}
+	check_digits(UINT32_MAX);
+	check_digits(UINT32_MAX - 1);
+	for (int i = 0; i < 100000; i++) {
+		x = x * 1664525u + 1013904223u;
+		check_digits(x >> (i % 32));
+	}
+
+	p = 1;
+	for (int i = 0; i < 20; i++, p *= 10) {
+		check_uint64(p - 1);
+		check_uint64(p);
+	}
+	check_uint64(UINT64_MAX);
+
+	for (size_t i = 0; i < sizeof(si) / sizeof(si[0]); i++) {
+		out_len = 0;
+		fmt_si(out_put, si[i].v, "Hz");
+		out[out_len] = '\0';
+		CHECK(strcmp(out, si[i].text) == 0, "SI %u: '%s', expected '%s'", si[i].v, out, si[i].text);
+	}
+
+	return check_done("fmt");
+}
@@ -0,0 +1,107 @@
+// ----------------------------------------------------------------------------
+// Interrupt priorities and the latency budget: only the edge timestampers run at
+// IRQ_PRIO_EDGE, the edge-to-timestamp delay stays under LAT_BUDGET_NS at the highest input
+// rate of each mode with every handler charged its instructions, no capture is lost, and
+// the reset functions leave PRIMASK as they found it.
+// ----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+#define EDGE_MAX_HZ (100000) //EDGE mode: two handler runs per period still fit
+#define WINDOW_MS (50) //measurement window per rate, every instruction single-stepped
+
+static void command(const char *line)
+{
+	host_uart_clear();
+	host_uart_send(line, strlen(line));
+	host_run(HOST_MS(2 * MAIN_LOOP_MS));
+	CHECK(strstr(host_uart_out, "OK") != NULL, "%s answered '%s'", line, host_uart_out);
+}
+
+//Function to check that nothing but an edge timestamper can hold off an edge
+static void priorities(const char *what, int tim2_edge)
+{
+	for (int irq = WWDG_IRQn; irq <= CEC_CAN_IRQn; irq++) {
+		int edge = irq == EXTI0_1_IRQn || irq == EXTI2_3_IRQn || irq == TIM15_IRQn || (irq == TIM2_IRQn && tim2_edge);
+		if (NVIC_GetEnableIRQ((IRQn_Type)irq) && !edge) {
+			CHECK(NVIC_GetPriority((IRQn_Type)irq) > IRQ_PRIO_EDGE, "%s: IRQ %d at priority %u",
+					what, irq, NVIC_GetPriority((IRQn_Type)irq));
+		}
+	}
+	CHECK(NVIC_GetPriority(EXTI0_1_IRQn) == IRQ_PRIO_EDGE && NVIC_GetPriority(EXTI2_3_IRQn) == IRQ_PRIO_EDGE,
+			"%s: EXTI at %u/%u", what, NVIC_GetPriority(EXTI0_1_IRQn), NVIC_GetPriority(EXTI2_3_IRQn));
+	CHECK(NVIC_GetPriority(TIM2_IRQn) == (tim2_edge ? IRQ_PRIO_EDGE : IRQ_PRIO_HOUSEKEEPING),
+			"%s: TIM2 at %u", what, NVIC_GetPriority(TIM2_IRQn));
+	CHECK(NVIC_GetPriority(PendSV_IRQn) > IRQ_PRIO_HOUSEKEEPING, "%s: PendSV at %u", what, NVIC_GetPriority(PendSV_IRQn));
+}
+
+//Function to feed one rate and run a window with every handler and masked stretch single-stepped
+static void window(double f)
+{
+	host_pin_square(HOST_PA(1), f, 0.5, host_now);
+	host_run(HOST_MS(3 * MAIN_LOOP_MS)); //settle: gate size, capture prescaler
+	lat_reset();
+	host_irq_reset();
+	host_count_instructions(1);
+	host_uart_send("STATS\r\n", 7); //the command path runs during the window too
+	host_run(HOST_MS(WINDOW_MS));
+	host_count_instructions(0);
+	host_run(HOST_MS(MAIN_LOOP_MS)); //one lat_check
+}
+
+int main(void)
+{
+	host_init();
+	host_trace_cost = 0;
+
+	/* the reset functions restore PRIMASK instead of unmasking */
+	__disable_irq();
+	lat_reset();
+	CHECK(__get_PRIMASK() == 1, "lat_reset unmasked interrupts");
+	stats_reset();
+	CHECK(__get_PRIMASK() == 1, "stats_reset unmasked interrupts");
+	__enable_irq();
+	lat_reset();
+	stats_reset();
+	CHECK(__get_PRIMASK() == 0, "PRIMASK left set");
+
+	host_main_start(firmware_main);
+	host_run_until(HOST_MS(100));
+	uint32_t budget = (uint32_t)(((uint64_t)LAT_BUDGET_NS * timer_clock) / 1000000000);
+
+	/* EDGE: software timestamps, lat_record compares them with the TIM2 latch */
+	command("MODE EDGE\r\n");
+	priorities("EDGE", 0);
+	window(EDGE_MAX_HZ);
+	CHECK(lat_samples >= EDGE_MAX_HZ / 2 * WINDOW_MS / 1000 * 9 / 10, "EDGE: %u edges timed", lat_samples);
+	CHECK(lat_worst <= budget, "EDGE %d Hz: worst %u ticks, budget %u", EDGE_MAX_HZ, lat_worst, budget);
+	CHECK(lat_missed == 0 && lat_fail == 0, "EDGE: %u captures lost", lat_missed);
+	printf("  EDGE %6d Hz: worst %3u ticks (%4u ns, budget %u) over %u edges; EXTI0_1 at most %llu cycles, masked at most %llu\n",
+			EDGE_MAX_HZ, lat_worst, (unsigned)((uint64_t)lat_worst * 1000000000 / timer_clock), LAT_BUDGET_NS,
+			lat_samples, (unsigned long long)host_irq(EXTI0_1_IRQn)->max_cycles, (unsigned long long)host_irq_off_max);
+
+	/* AUTO: hardware captures, so the delay only matters once a capture is overwritten unread.
+	 * The top capture rate with no input prescaler, and with the largest one */
+	command("MODE AUTO\r\n");
+	static const double rates[] = { AR_MAX_CAPTURE_RATE, (AR_MAX_CAPTURE_RATE << AR_PSC_MAX) * 0.99 };
+	for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		window(rates[i]);
+		priorities("AUTO", 1);
+		CHECK(ar_hw == 0, "AUTO %.0f Hz: counted in hardware", rates[i]);
+		CHECK(lat_missed == 0 && lat_fail == 0, "AUTO %.0f Hz: %u captures lost", rates[i], lat_missed);
+		printf("  AUTO %6.0f Hz: /%d, %u captures lost; TIM2 at most %llu cycles, masked at most %llu\n",
+				rates[i], 1 << ar_psc, lat_missed, (unsigned long long)host_irq(TIM2_IRQn)->max_cycles,
+				(unsigned long long)host_irq_off_max);
+	}
+
+	CHECK(strstr(host_trace(), "latency budget exceeded") == NULL, "trace '%.200s'", host_trace());
+	CHECK(!host_main_done(), "main returned");
+	return check_done("latency");
+}
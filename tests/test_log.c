@@ -0,0 +1,227 @@
+// ----------------------------------------------------------------------------
+// Measurement logger: encoder density and round trip, the three triggers with their pre- and
+// post-trigger windows, and a capture taken over the command line and dumped a few records
+// per main loop pass.
+// ----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+#define MAX_PERIODS (4 * LOG_WORDS)
+
+static uint32_t fed[MAX_PERIODS]; //periods handed to log_period, in order
+static int n_fed;
+
+static void command(const char *line)
+{
+	host_uart_clear();
+	host_uart_send(line, strlen(line));
+	host_run(HOST_MS(2 * MAIN_LOOP_MS));
+	CHECK(strstr(host_uart_out, "OK") != NULL, "%s answered '%s'", line, host_uart_out);
+}
+
+static void feed(uint32_t ticks)
+{
+	if (n_fed < MAX_PERIODS) {
+		fed[n_fed++] = ticks;
+	}
+	log_period(ticks);
+}
+
+//Function to decode the frozen arena and check it against the tail of what was fed.
+//Returns the index of the trigger record among the decoded periods, or -1.
+static int decode(const char *what, int *periods)
+{
+	uint32_t got[LOG_WORDS];
+	uint16_t left = log_count;
+	uint16_t pos = (log_count < LOG_WORDS) ? 0 : log_head;
+	uint32_t period = 0;
+	uint16_t synced = 0;
+	log_record_t rec;
+	int n = 0, trig = -1;
+
+	while (log_next(&pos, &left, &period, &synced, &rec)) {
+		if (rec.tag != LOG_TAG_ADC) {
+			if (rec.trigger != 0) {
+				trig = n;
+			}
+			got[n++] = rec.value;
+		}
+	}
+
+	/* the decoded periods are the last ones fed, in order */
+	int bad = 0;
+	for (int i = 0; i < n && bad < 5; i++) {
+		uint32_t want = fed[n_fed - n + i];
+		if (got[i] != want) {
+			CHECK(0, "%s: period %d of %d decoded as %u, fed %u", what, i, n, got[i], want);
+			bad++;
+		}
+	}
+	*periods = n;
+	return trig;
+}
+
+//Function to check the density of a full ring: one word per delta, four per absolute record
+//every LOG_KEY_INTERVAL, and at most the first interval lost before the first absolute record
+static void density(const char *what, uint32_t spread, uint32_t seed)
+{
+	int periods;
+
+	n_fed = 0;
+	log_arm(LOG_TRIG_NONE, 0, LOG_WORDS / 2, LOG_WORDS / 2);
+	while (log_state != LOG_DONE && n_fed < MAX_PERIODS) {
+		seed = seed * 1664525u + 1013904223u;
+		feed(48000 + (seed >> 8) % (spread + 1));
+	}
+	CHECK(log_state == LOG_DONE, "%s: capture not closed after %d periods", what, n_fed);
+	CHECK(log_count == LOG_WORDS, "%s: %u words", what, log_count);
+
+	decode(what, &periods);
+	double words = (double)LOG_WORDS / periods;
+	double ideal = (LOG_KEY_INTERVAL + 4.0) / (LOG_KEY_INTERVAL + 1.0);
+	if (spread <= LOG_DELTA_MAX) {
+		CHECK(periods >= LOG_WORDS / ideal - LOG_KEY_INTERVAL, "%s: %d periods decoded from %d words", what, periods, LOG_WORDS);
+	}
+	printf("  %s: %d periods in %d words, %.3f words per period (%.3f ideal)\n", what, periods, LOG_WORDS, words, ideal);
+}
+
+static void freq_trigger(const char *what, uint16_t trigger, uint32_t glitch)
+{
+	int32_t away = (trigger == LOG_TRIG_FREQ_ABOVE) ? 1 : -1; //direction that never fires
+	int periods;
+	uint16_t pre = 300, post = 200;
+
+	n_fed = 0;
+	log_arm(trigger, 1000, pre, post);
+	CHECK(log_threshold == timer_clock / 1000, "%s: threshold %u ticks", what, log_threshold);
+
+	/* a glitch inside the pre-trigger window does not fire */
+	for (int i = 0; i < 10; i++) {
+		feed(timer_clock / 1000);
+	}
+	feed(glitch);
+	CHECK(log_state == LOG_ARMED, "%s: fired before the pre-trigger window was full", what);
+
+	/* nor does the threshold itself, and a long steady run keeps the ring armed */
+	for (int i = 0; i < 2 * LOG_WORDS; i++) {
+		feed(timer_clock / 1000 + (uint32_t)(away * (i & 7)));
+	}
+	CHECK(log_state == LOG_ARMED, "%s: fired on a steady input", what);
+
+	feed(glitch);
+	CHECK(log_state == LOG_TRIGGERED, "%s: state %u after the glitch", what, log_state);
+	uint16_t head = log_head;
+	while (log_state != LOG_DONE && n_fed < MAX_PERIODS) {
+		feed(timer_clock / 1000 + (uint32_t)(away * 3));
+	}
+	CHECK(((log_head - head) & (LOG_WORDS - 1)) == post, "%s: %u words after the trigger",
+			what, (log_head - head) & (LOG_WORDS - 1));
+	CHECK(log_count == LOG_WORDS, "%s: %u words", what, log_count);
+
+	/* the marked record is the glitch, with the post window behind it */
+	int trig = decode(what, &periods);
+	CHECK(trig >= 0 && trig < periods && fed[n_fed - periods + trig] == glitch, "%s: trigger on record %d of %d",
+			what, trig, periods);
+	CHECK(periods - trig >= post * LOG_KEY_INTERVAL / (LOG_KEY_INTERVAL + 4) - 1, "%s: %d periods after the trigger",
+			what, periods - trig - 1);
+}
+
+static void res_trigger(void)
+{
+	int fired_at = -1;
+
+	log_arm(LOG_TRIG_RES_STEP, 500, 100, 50);
+	for (int i = 0; i < 400 && log_state == LOG_ARMED; i++) {
+		Res = 2000 + (i & 1) * 499 + ((i == 20) ? 600 : 0) + ((i >= 150) ? 1000 : 0); //steps under 500, a spike early on, a real step at 150
+		log_adc(0x100 + (uint32_t)i);
+		if (log_state != LOG_ARMED) {
+			fired_at = i;
+		}
+	}
+	CHECK(fired_at == 150, "Res step fired at sample %d", fired_at);
+
+	for (int i = 0; i < 100 && log_state != LOG_DONE; i++) {
+		log_adc(0x800);
+	}
+	CHECK(log_state == LOG_DONE, "Res step: capture not closed");
+
+	uint16_t left = log_count;
+	uint16_t pos = 0;
+	uint32_t period = 0;
+	uint16_t synced = 0;
+	log_record_t rec;
+	int n = 0, trig = -1;
+	while (log_next(&pos, &left, &period, &synced, &rec)) {
+		trig = (rec.trigger != 0) ? n : trig;
+		n++;
+	}
+	CHECK(n == 151 + 50 && trig == 150, "Res step: %d samples, trigger on %d", n, trig);
+}
+
+int main(void)
+{
+	host_init();
+	host_trace_cost = 0;
+
+	density("steady", 0, 1);
+	density("spread 1%", 480, 2);
+	density("spread 30%", 14400, 3); //steps over LOG_DELTA_MAX go out as absolute records
+	freq_trigger("ABOVE", LOG_TRIG_FREQ_ABOVE, timer_clock / 1001);
+	freq_trigger("BELOW", LOG_TRIG_FREQ_BELOW, timer_clock / 999);
+	res_trigger();
+
+	/* the same over the command line: 1 kHz, then a burst at 1.5 kHz (its first period is cut
+	 * short where the wave changes, so the trigger is somewhere under 1 / 1200 s) */
+	host_trace_cost = HOST_MS(1);
+	host_pin_square(HOST_PA(1), 1000.0, 0.5, HOST_MS(10));
+	host_main_start(firmware_main);
+	host_run_until(HOST_S(3));
+	command("CAP ABOVE 1200 200 600\r\n");
+	host_run(HOST_MS(500));
+	host_trace_clear();
+	host_pin_square(HOST_PA(1), 1500.0, 0.5, host_now);
+	host_run(HOST_MS(20));
+	host_pin_square(HOST_PA(1), 1000.0, 0.5, host_now);
+
+	/* the dump goes out LOG_DUMP_RECORDS lines per pass, so the loop keeps its period */
+	int passes = 0, most = 0, lines = 0;
+	while (passes < 400 && (log_state != LOG_IDLE || log_dump_busy != 0)) {
+		size_t before = strlen(host_trace());
+		host_run(HOST_MS(MAIN_LOOP_MS));
+		int now = 0;
+		for (const char *s = host_trace() + before; (s = strchr(s, '\n')) != NULL; s++) {
+			now++;
+		}
+		most = (now > most) ? now : most;
+		lines += now;
+		passes++;
+	}
+	CHECK(log_dump_busy == 0 && log_state == LOG_IDLE, "dump not finished after %d passes", passes);
+	CHECK(most <= LOG_DUMP_RECORDS + 1, "%d lines in one pass", most);
+	CHECK(strstr(host_trace(), "capture: ") != NULL, "no capture header");
+
+	const char *star = strchr(host_trace(), '*');
+	unsigned ticks = (star != NULL) ? (unsigned)strtoul(star + 4, NULL, 10) : 0;
+	CHECK(star != NULL && ticks < log_threshold && ticks > timer_clock * log_edges / 2000,
+			"trigger record '%.20s', threshold %u ticks", star ? star : "", log_threshold); //the wave restarts mid-period
+	printf("  CAP ABOVE: %d lines over %d passes, at most %d per pass\n", lines, passes, most);
+
+	/* re-arming in the middle of a dump cuts it short */
+	command("CAP NONE 0 100 900\r\n");
+	host_run(HOST_S(2));
+	host_trace_clear();
+	command("CAP NONE 0 100 100\r\n");
+	host_run(HOST_S(1));
+	CHECK(strstr(host_trace(), "capture: dump cut short") != NULL, "trace '%.200s'", host_trace());
+
+	CHECK(!host_main_done(), "main returned");
+	return check_done("log");
+}
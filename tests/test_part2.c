@@ -0,0 +1,36 @@
+// ----------------------------------------------------------------------------
+// Part 2 on the host: the PA2 period printed from the trace ring.
+// ----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Part 2/main.c"
+#undef main
+
+int main(void)
+{
+	int periods = 0;
+
+	host_init();
+	host_pin_square(HOST_PA(2), 1000.0, 0.5, HOST_MS(10));
+	host_main_start(firmware_main);
+
+	host_run_until(HOST_MS(100));
+	CHECK(SystemCoreClock == 48000000, "clock %u", SystemCoreClock);
+
+	//each printed line halts the core for host_trace_cost, so an edge may be taken a little late
+	for (const char *s = host_trace(); (s = strstr(s, "Signal Period: ")) != NULL; s++) {
+		unsigned us = (unsigned)strtoul(s + 15, NULL, 10);
+		CHECK(us >= 995 && us <= 1005, "period %u us", us);
+		periods++;
+	}
+	CHECK(periods >= 20, "%d periods printed", periods);
+	CHECK(strstr(host_trace(), "Signal Frequency: 1000 Hz\n") != NULL, "trace '%.200s'", host_trace());
+
+	return check_done("part2");
+}
@@ -0,0 +1,78 @@
+// ----------------------------------------------------------------------------
+// PWM-input mode on both inputs: asymmetric square waves from 1 % to 99 % duty give the
+// high time, low time, duty and frequency to within one tick of the timer measuring them,
+// and the OLED shows them next to Freq.
+// ----------------------------------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+static void command(const char *line)
+{
+	host_uart_clear();
+	host_uart_send(line, strlen(line));
+	host_run(HOST_MS(2 * MAIN_LOOP_MS));
+	CHECK(strstr(host_uart_out, "OK") != NULL, "%s answered '%s'", line, host_uart_out);
+}
+
+static void sweep(int pin, double f)
+{
+	static const double duties[] = { 0.01, 0.05, 0.25, 0.333, 0.5, 0.667, 0.75, 0.95, 0.99 };
+
+	for (size_t i = 0; i < sizeof(duties) / sizeof(duties[0]); i++) {
+		double d = duties[i];
+		double high_ns = d / f * 1e9, low_ns = (1 - d) / f * 1e9;
+
+		host_pin_square(pin, f, d, host_now);
+		/* the period straddling the change, and one more if the clock policy switches back to full speed */
+		host_run(HOST_MS(3 * MAIN_LOOP_MS) + (host_time_t)(HOST_S(4) / f));
+
+		/* one tick either way on each capture, plus the input synchroniser */
+		double tick_ns = (pin == 1) ? 1e9 / timer_clock : 1e9 * (PWM_TIM15_PRESCALER + 1) / timer_clock;
+		double tol_ns = tick_ns + 50;
+		CHECK(fabs(pwm_high_ns - high_ns) <= tol_ns, "PA%d %.0f Hz %.1f%%: high %u ns, expected %.0f",
+				pin, f, d * 100, pwm_high_ns, high_ns);
+		CHECK(fabs(pwm_low_ns - low_ns) <= tol_ns, "PA%d %.0f Hz %.1f%%: low %u ns, expected %.0f",
+				pin, f, d * 100, pwm_low_ns, low_ns);
+		CHECK(fabs(Duty - d * 1000) <= 1 + tol_ns * f * 1e-6, "PA%d %.0f Hz %.1f%%: Duty %u",
+				pin, f, d * 100, Duty);
+		CHECK(fabs(Freq - f) <= 1 + f * f * tick_ns * 1e-9, "PA%d %.0f Hz: Freq %u", pin, f, Freq);
+	}
+}
+
+int main(void)
+{
+	host_init();
+	host_oled_font(Characters, 128);
+	host_trace_cost = 0;
+	host_main_start(firmware_main);
+	host_run_until(HOST_MS(100));
+
+	command("MODE PWM\r\n");
+
+	/* PA1: TIM2 at the full timer clock */
+	sweep(1, 1000.0);
+	sweep(1, 20000.0);
+	sweep(1, 3.0);
+
+	CHECK(strncmp(host_oled_text(0), "Hi:", 3) == 0, "page 0 '%s'", host_oled_text(0));
+	CHECK(strncmp(host_oled_text(4), "Freq: ", 6) == 0, "page 4 '%s'", host_oled_text(4));
+	CHECK(strncmp(host_oled_text(6), "Duty:  99.0 %", 13) == 0, "page 6 '%s'", host_oled_text(6));
+	CHECK(strncmp(host_oled_text(7), "Lo:", 3) == 0, "page 7 '%s'", host_oled_text(7));
+
+	/* PA2: TIM15 in 1 us ticks */
+	host_pin_off(HOST_PA(1));
+	command("CH 2\r\n");
+	sweep(2, 1000.0);
+	sweep(2, 50.0);
+
+	CHECK(!host_main_done(), "main returned");
+	return check_done("pwm");
+}
@@ -0,0 +1,130 @@
+// ----------------------------------------------------------------------------
+// VREFINT supply compensation across 2.4-3.6 V, the temperature reading, and the
+// background ADC recalibration (non-blocking, ring realigned to PA5 afterwards).
+// ----------------------------------------------------------------------------
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "host_sim.h"
+
+#define main firmware_main
+#include "../Main Project/main.c"
+#undef main
+
+#define POT_VOLTS (1.2)
+
+static host_time_t dac_last = 0, dac_gap = 0;
+
+static void dac_write(uint32_t code, host_time_t t)
+{
+	(void)code;
+	if (dac_last != 0 && t - dac_last > dac_gap) {
+		dac_gap = t - dac_last;
+	}
+	dac_last = t;
+}
+
+static void compensate_math(void)
+{
+	CHECK(ADC_compensate(1000, FACTORY_VREFINT_CAL) == 1000, "identity at 3.3 V");
+	CHECK(ADC_compensate(ADC_FULL_SCALE, FACTORY_VREFINT_CAL / 2) == ADC_FULL_SCALE, "not clipped");
+	/* a 2.4 V supply reads VREFINT high; the reading scales down by the same ratio */
+	uint32_t vref = (uint32_t)lround(FACTORY_VREFINT_CAL * 3.3 / 2.4);
+	uint32_t expect = (uint32_t)lround(3000 * 2.4 / 3.3);
+	CHECK(labs((long)ADC_compensate(3000, vref) - (long)expect) <= 1, "%u, expected %u",
+			(unsigned)ADC_compensate(3000, vref), (unsigned)expect);
+}
+
+static void supply_sweep(void)
+{
+	uint32_t raw_lo = 0, raw_hi = 0;
+	uint32_t expect = (uint32_t)lround(POT_VOLTS / 3.3 * ADC_FULL_SCALE);
+
+	for (int mv = 2400; mv <= 3600; mv += 100) {
+		host_vdda = mv / 1000.0;
+		host_run(HOST_MS(200));
+
+		CHECK(abs((int)VDDA_mV - mv) <= mv / 200, "VDDA_mV %u at %d mV", VDDA_mV, mv);
+		CHECK(abs((int)POT_val - (int)expect) <= 3, "POT_val %u at %d mV, expected %u",
+				(unsigned)POT_val, mv, (unsigned)expect);
+		CHECK(abs((int)Res - (int)(expect * POT_FULL_SCALE / ADC_FULL_SCALE)) <= 5, "Res %u at %d mV", Res, mv);
+		CHECK(abs(Temp - 30) <= 2, "Temp %d at %d mV", Temp, mv);
+		if (mv == 2400) {
+			raw_lo = adc_samples[ADC_SEQ_POT];
+		}
+		raw_hi = adc_samples[ADC_SEQ_POT];
+	}
+	/* the uncompensated reading moved by a third over the sweep */
+	CHECK(raw_lo > raw_hi + 500, "raw %u at 2.4 V, %u at 3.6 V", (unsigned)raw_lo, (unsigned)raw_hi);
+}
+
+static void temperature(void)
+{
+	static const double temps[] = { -20.0, 30.0, 85.0 };
+
+	/* PA5 does not move, so the event-mode reader picks the change up on its periodic refresh */
+	host_vdda = 3.0;
+	for (size_t i = 0; i < sizeof(temps) / sizeof(temps[0]); i++) {
+		host_temp_c = temps[i];
+		host_run(HOST_MS((ADC_AWD_REFRESH + 2) * MAIN_LOOP_MS));
+		CHECK(fabs(Temp - temps[i]) <= 2.0, "Temp %d at %.0f C", Temp, temps[i]);
+	}
+	host_temp_c = 30.0;
+	host_vdda = 3.3;
+}
+
+/* Force recalibrations, which land at scattered points of the scan; each must finish one step
+ * per pass, leave the ring aligned to PA5, and never hold up the DAC passthrough */
+static void recalibration(void)
+{
+	uint32_t pot = (uint32_t)lround(POT_VOLTS / 3.3 * ADC_FULL_SCALE);
+	uint32_t vref = FACTORY_VREFINT_CAL;
+
+	adc_event = 0; //the DAC is written on every pass
+	host_dac_hook = dac_write;
+	host_run(HOST_MS(10));
+	dac_gap = 0;
+
+	for (int i = 0; i < 8; i++) {
+		host_run(HOST_US(37 * i + 5));
+		adc_recal_timer = ADC_RECAL_INTERVAL;
+		host_time_t start = host_now;
+		int seen = 0;
+		while (host_now - start < HOST_MS(8 * MAIN_LOOP_MS) && !(seen && adc_recal_state == 0)) {
+			host_run(HOST_MS(1));
+			seen |= (adc_recal_state != 0);
+		}
+		CHECK(seen && adc_recal_state == 0, "recal %d stuck in state %u", i, adc_recal_state);
+		host_run(HOST_MS(5)); //refill the ring
+
+		for (int j = 0; j < ADC_OVERSAMPLE * ADC_SEQ_LEN; j += ADC_SEQ_LEN) {
+			CHECK(abs((int)adc_samples[j + ADC_SEQ_POT] - (int)pot) <= 2
+					&& abs((int)adc_samples[j + ADC_SEQ_VREF] - (int)vref) <= 2,
+					"recal %d: scan %d holds %u/%u/%u", i, j / ADC_SEQ_LEN, adc_samples[j],
+					adc_samples[j + 1], adc_samples[j + 2]);
+		}
+	}
+	CHECK(dac_gap <= HOST_MS(MAIN_LOOP_MS + 1), "DAC held for %.0f us", dac_gap / 48.0);
+
+	host_dac_hook = NULL;
+	adc_event = ADC_EVENT_DEFAULT;
+}
+
+int main(void)
+{
+	host_init();
+	host_analog_const(HOST_PA(5), POT_VOLTS);
+	host_main_start(firmware_main);
+	host_run_until(HOST_MS(300));
+
+	compensate_math();
+	supply_sweep();
+	temperature();
+	recalibration();
+
+	CHECK(!host_main_done(), "main returned");
+	return check_done("supply");
+}